@@ -0,0 +1,327 @@
+/*
+ * archive.c
+ * an archive of many EA-EGA images in one file, with a directory at the front giving the
+ * name, size and place of each and, optionally, its scanline index
+ *
+ * This code is offered without warranty under the MIT License. Use it as you will
+ * personally or commercially, just give credit if you do.
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include "archive.h"
+#include "eaega.h"
+#include "util.h"
+
+// each directory entry is the offset of the name in the name table, the width and height as
+// 16 bits, the offset and length of the EGA file, the offset of the index, 0 if there isn't
+// one, and 4 bytes kept for later, 0 for now. the offsets are from the start of the archive
+#define EGR_MIN_ITEMS (64)           // images there is room for to start with
+#define EGR_ALIGN(N) (((N) + 3) & ~(size_t)3) // the images and indexes start on 4 byte boundaries
+
+static inline uint16_t get_le16(const uint8_t *p) { return p[0] | (p[1] << 8); }
+static inline uint32_t get_le32(const uint8_t *p) { return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24); }
+static inline void put_le16(uint8_t *p, uint16_t v) { p[0] = v & 0xff; p[1] = v >> 8; }
+static inline void put_le32(uint8_t *p, uint32_t v) { p[0] = v & 0xff; p[1] = (v >> 8) & 0xff; p[2] = (v >> 16) & 0xff; p[3] = v >> 24; }
+
+/// @brief reads a directory entry, without checking it
+static void read_entry(const egr_t *arc, uint32_t i, egr_entry_t *e) {
+    const uint8_t *p = &arc->dir[(size_t)i * EGR_ENTRY_SZ];
+    uint32_t off = get_le32(&p[8]);
+    uint32_t index_off = get_le32(&p[16]);
+    e->name = &arc->names[get_le32(&p[0])];
+    e->width = get_le16(&p[4]);
+    e->height = get_le16(&p[6]);
+    e->data = (memstream_buf_t){get_le32(&p[12]), 0, &arc->buf.data[off]};
+    e->index = index_off ? &arc->buf.data[index_off] : NULL;
+}
+
+/// @brief opens an archive held in memory, usually mapped. the header and every directory
+///        entry are checked here, so the entries can be used without checking them again,
+///        the images themselves aren't read
+/// @param arc receives the archive
+/// @param buf the archive, it must stay in memory for as long as arc is used
+/// @return 0 on success, -3 if it is too short, -4 if it isn't a valid archive, otherwise an error code
+int egr_open(egr_t *arc, const memstream_buf_t *buf) {
+    if((NULL == arc) || (NULL == buf) || (NULL == buf->data)) {
+        return -1; // NULL pointer error
+    }
+    memset(arc, 0, sizeof(egr_t));
+    const uint8_t *p = buf->data;
+    if((buf->len < EGR_HDR_SZ) || memcmp(p, EGR_MAGIC, 4)) {
+        return -4; // not an archive
+    }
+    uint32_t count = get_le32(&p[4]);
+    size_t names_len = get_le32(&p[8]);
+    size_t total = get_le32(&p[12]);
+    if(buf->len < total) {
+        return -3; // truncated
+    }
+    size_t names_off = EGR_HDR_SZ + (size_t)count * EGR_ENTRY_SZ;
+    if(((names_off + names_len) > total) || (count && ((0 == names_len) || p[names_off + names_len - 1]))) {
+        return -4; // the directory doesn't fit, or the last name isn't terminated
+    }
+    arc->buf = (memstream_buf_t){total, 0, buf->data};
+    arc->count = count;
+    arc->dir = &p[EGR_HDR_SZ];
+    arc->names = (const char *)&p[names_off];
+    arc->names_len = names_len;
+
+    // the names have to be in order for egr_find(), and everything has to lie within the archive
+    const char *last = NULL;
+    for(uint32_t i = 0; i < count; i++) {
+        const uint8_t *ep = &arc->dir[(size_t)i * EGR_ENTRY_SZ];
+        size_t name_off = get_le32(&ep[0]);
+        size_t off = get_le32(&ep[8]);
+        size_t len = get_le32(&ep[12]);
+        size_t index_off = get_le32(&ep[16]);
+        size_t height = get_le16(&ep[6]);
+        if((name_off >= names_len) || (len < EGA_HDR_SZ) || ((off + len) > total) ||
+           (index_off && ((index_off + height * sizeof(uint32_t)) > total))) {
+            memset(arc, 0, sizeof(egr_t));
+            return -4; // an entry points outside the archive
+        }
+        const char *name = &arc->names[name_off];
+        if(last && (strcmp(last, name) >= 0)) {
+            memset(arc, 0, sizeof(egr_t));
+            return -4; // out of order or repeated
+        }
+        last = name;
+    }
+    return 0;
+}
+
+/// @brief gets an image of an archive by its place in the directory
+/// @param arc the archive
+/// @param i the image's place, from 0 to arc->count - 1, in name order
+/// @param e receives the image
+/// @return 0 on success, otherwise an error code
+int egr_entry(const egr_t *arc, uint32_t i, egr_entry_t *e) {
+    if((NULL == arc) || (NULL == e)) {
+        return -1; // NULL pointer error
+    }
+    if(i >= arc->count) {
+        return -6; // no such image
+    }
+    read_entry(arc, i, e);
+    return 0;
+}
+
+/// @brief finds an image of an archive by its name, a binary search of the directory
+/// @param arc the archive
+/// @param name name of the image
+/// @param e receives the image
+/// @return 0 on success, -6 if there is no image of that name, otherwise an error code
+int egr_find(const egr_t *arc, const char *name, egr_entry_t *e) {
+    if((NULL == arc) || (NULL == name) || (NULL == e)) {
+        return -1; // NULL pointer error
+    }
+    uint32_t lo = 0;
+    uint32_t hi = arc->count;
+    while(lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        const char *mid_name = &arc->names[get_le32(&arc->dir[(size_t)mid * EGR_ENTRY_SZ])];
+        int cmp = strcmp(name, mid_name);
+        if(0 == cmp) {
+            read_entry(arc, mid, e);
+            return 0;
+        }
+        if(cmp < 0) {
+            hi = mid;
+        } else {
+            lo = mid + 1;
+        }
+    }
+    return -6; // no such image
+}
+
+/// @brief reads the scanline index of an image in an archive, as egx_read() would from a sidecar
+/// @param e the image
+/// @param offsets receives the offset of each line in e->data, must hold e->height entries
+/// @return 0 on success, -6 if the image has no index, -4 if the index doesn't fit the image,
+///         otherwise an error code
+int egr_read_index(const egr_entry_t *e, uint32_t *offsets) {
+    if((NULL == e) || (NULL == offsets)) {
+        return -1; // NULL pointer error
+    }
+    if(NULL == e->index) {
+        return -6; // no index
+    }
+    for(size_t i = 0; i < e->height; i++) {
+        offsets[i] = get_le32(&e->index[i * sizeof(uint32_t)]);
+        if((offsets[i] < EGA_HDR_SZ) || (offsets[i] >= e->data.len) || (i && (offsets[i] <= offsets[i - 1]))) {
+            return -4; // an offset outside the image, or out of order
+        }
+    }
+    return 0;
+}
+
+/// @brief the name a file is given in an archive, its name without the directories
+/// @param path name of the file
+/// @return pointer to the name within path
+const char *egr_base_name(const char *path) {
+    const char *base = path;
+    for(const char *p = path; *p; p++) {
+        if(('/' == *p) || ('\\' == *p)) base = p + 1;
+    }
+    return base;
+}
+
+/// @brief sets up an empty archive to add images to
+/// @param b pointer to the builder
+void egr_builder_init(egr_builder_t *b) {
+    if(NULL == b) return;
+    memset(b, 0, sizeof(egr_builder_t));
+    mutex_init(&b->lock);
+}
+
+/// @brief adds an image to an archive being put together, a copy is taken of it
+/// @param b pointer to the builder
+/// @param name name to give the image in the archive
+/// @param data the EGA file
+/// @param len length of the EGA file in bytes
+/// @param index also store the image's scanline index
+/// @return 0 on success, -4 if the EGA file is invalid or truncated, otherwise an error code
+int egr_add(egr_builder_t *b, const char *name, const uint8_t *data, size_t len, bool index) {
+    if((NULL == b) || (NULL == name) || (NULL == data)) {
+        return -1; // NULL pointer error
+    }
+    if(len > UINT32_MAX) {
+        return -7; // too large
+    }
+
+    egr_item_t it = {NULL, NULL, (uint32_t)len, NULL, 0, 0};
+    memstream_buf_t ms = {len, 0, (uint8_t *)data};
+    if(ega_read_header(&ms, &it.width, &it.height)) {
+        return -4; // not an EGA file
+    }
+    size_t name_len = strlen(name) + 1;
+    if((NULL == (it.name = malloc(name_len))) || (NULL == (it.data = malloc(len))) ||
+       (index && (NULL == (it.offsets = malloc(it.height * sizeof(uint32_t)))))) {
+        free_s(it.name);
+        free_s(it.data);
+        return -5; // unable to allocate
+    }
+    memcpy(it.name, name, name_len);
+    memcpy(it.data, data, len);
+    if(index && ega_index_lines(&ms, it.width, it.height, it.offsets)) {
+        free_s(it.name);
+        free_s(it.data);
+        free_s(it.offsets);
+        return -4; // invalid or truncated
+    }
+
+    int rval = 0;
+    mutex_lock(&b->lock);
+    if(b->count == b->cap) {
+        size_t cap = b->cap ? b->cap * 2 : EGR_MIN_ITEMS;
+        egr_item_t *items = realloc(b->items, cap * sizeof(egr_item_t));
+        if(NULL == items) {
+            rval = -5; // unable to allocate
+        } else {
+            b->items = items;
+            b->cap = cap;
+        }
+    }
+    if(0 == rval) b->items[b->count++] = it;
+    mutex_unlock(&b->lock);
+    if(rval) {
+        free_s(it.name);
+        free_s(it.data);
+        free_s(it.offsets);
+    }
+    return rval;
+}
+
+/// @brief orders images by name, for qsort()
+static int item_cmp(const void *a, const void *b) {
+    return strcmp(((const egr_item_t *)a)->name, ((const egr_item_t *)b)->name);
+}
+
+/// @brief writes out an archive of the images added so far, in name order
+/// @param b pointer to the builder
+/// @param fn name of the archive file, '-' for the standard output
+/// @return 0 on success, -6 if two images have the same name, -7 if the archive would be
+///         larger than 4GB, otherwise an error code
+int egr_save(egr_builder_t *b, const char *fn) {
+    if((NULL == b) || (NULL == fn)) {
+        return -1; // NULL pointer error
+    }
+    if(b->count > ((UINT32_MAX - EGR_HDR_SZ) / EGR_ENTRY_SZ)) {
+        return -7; // too many images
+    }
+    if(b->count) qsort(b->items, b->count, sizeof(egr_item_t), item_cmp);
+
+    // lay it out first, so the buffer can be made the right size
+    size_t names_len = 0;
+    for(size_t i = 0; i < b->count; i++) {
+        if(i && (0 == strcmp(b->items[i - 1].name, b->items[i].name))) {
+            fprintf(stderr, "Error: '%s' is in the archive twice\n", b->items[i].name);
+            return -6; // repeated name
+        }
+        names_len += strlen(b->items[i].name) + 1;
+    }
+    size_t names_off = EGR_HDR_SZ + b->count * EGR_ENTRY_SZ;
+    size_t total = EGR_ALIGN(names_off + names_len);
+    for(size_t i = 0; i < b->count; i++) {
+        total = EGR_ALIGN(total + b->items[i].len);
+        if(b->items[i].offsets) total += b->items[i].height * sizeof(uint32_t);
+    }
+    if(total > UINT32_MAX) {
+        return -7; // too large
+    }
+
+    uint8_t *buf = calloc(1, total); // the padding is left 0
+    if(NULL == buf) {
+        return -5; // unable to allocate
+    }
+    memcpy(buf, EGR_MAGIC, 4);
+    put_le32(&buf[4], b->count);
+    put_le32(&buf[8], names_len);
+    put_le32(&buf[12], total);
+    size_t name_pos = 0;
+    size_t pos = EGR_ALIGN(names_off + names_len);
+    for(size_t i = 0; i < b->count; i++) {
+        const egr_item_t *it = &b->items[i];
+        uint8_t *ep = &buf[EGR_HDR_SZ + i * EGR_ENTRY_SZ];
+        size_t nlen = strlen(it->name) + 1;
+        memcpy(&buf[names_off + name_pos], it->name, nlen);
+        put_le32(&ep[0], name_pos);
+        put_le16(&ep[4], it->width);
+        put_le16(&ep[6], it->height);
+        put_le32(&ep[8], pos);
+        put_le32(&ep[12], it->len);
+        name_pos += nlen;
+        memcpy(&buf[pos], it->data, it->len);
+        pos = EGR_ALIGN(pos + it->len);
+        if(it->offsets) {
+            put_le32(&ep[16], pos);
+            for(size_t y = 0; y < it->height; y++) {
+                put_le32(&buf[pos], it->offsets[y]);
+                pos += sizeof(uint32_t);
+            }
+        }
+    }
+
+    int rval = write_file(fn, buf, total) ? -4 : 0;
+    free(buf);
+    return rval;
+}
+
+/// @brief releases everything held by an archive being put together
+/// @param b pointer to the builder
+void egr_builder_free(egr_builder_t *b) {
+    if(NULL == b) return;
+    for(size_t i = 0; i < b->count; i++) {
+        free_s(b->items[i].name);
+        free_s(b->items[i].data);
+        free_s(b->items[i].offsets);
+    }
+    free_s(b->items);
+    b->count = 0;
+    b->cap = 0;
+    mutex_destroy(&b->lock);
+}
@@ -0,0 +1,76 @@
+/*
+ * archive.h
+ * an archive of many EA-EGA images in one file, with a directory at the front giving the
+ * name, size and place of each and, optionally, its scanline index. the whole archive is
+ * meant to be mapped, so finding an image is a search of the directory and reading it only
+ * touches its own pages
+ *
+ * This code is offered without warranty under the MIT License. Use it as you will
+ * personally or commercially, just give credit if you do.
+ */
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "memstream.h"
+#include "thread.h"
+
+#ifndef ARCHIVE_H
+#define ARCHIVE_H
+
+// .EGR archive, a 16 byte header: the signature, the number of images, the length of the
+// name table and the length of the whole archive. then the directory, an entry per image
+// sorted by name, then the name table of NUL terminated names, then the images, each a
+// whole EGA file, with its index after it if it has one. all values are little endian
+#define EGR_MAGIC "EGR\x1a"
+#define EGR_HDR_SZ (16)
+#define EGR_ENTRY_SZ (24)
+#define EGR_EXT ".EGR"
+
+// an archive, mapped or read in to memory
+typedef struct {
+    memstream_buf_t buf;     // the whole archive
+    uint32_t    count;       // number of images in it
+    const uint8_t *dir;      // the directory
+    const char  *names;      // the name table
+    size_t      names_len;   // length of the name table in bytes
+} egr_t;
+
+// an image in an archive, everything points in to the archive
+typedef struct {
+    const char  *name;       // name of the image
+    uint16_t    width;       // width of the image in pixels
+    uint16_t    height;      // height of the image in pixels or lines
+    memstream_buf_t data;    // the EGA file, header included
+    const uint8_t *index;    // the offset of each line in the EGA file, bottom line first,
+                             // 32 bits each, or NULL if it wasn't indexed
+} egr_entry_t;
+
+// an image waiting to be written to an archive
+typedef struct {
+    char        *name;       // name of the image
+    uint8_t     *data;       // the EGA file
+    uint32_t    len;         // length of the EGA file in bytes
+    uint32_t    *offsets;    // the offset of each line, NULL if it isn't to be indexed
+    uint16_t    width;       // width of the image in pixels
+    uint16_t    height;      // height of the image in pixels or lines
+} egr_item_t;
+
+// an archive being put together, the images can be added from several threads at once
+typedef struct {
+    egr_item_t  *items;      // the images added so far
+    size_t      count;       // number of images added
+    size_t      cap;         // number of images there is room for
+    mutex_t     lock;        // guards all of the above
+} egr_builder_t;
+
+int egr_open(egr_t *arc, const memstream_buf_t *buf);
+int egr_entry(const egr_t *arc, uint32_t i, egr_entry_t *e);
+int egr_find(const egr_t *arc, const char *name, egr_entry_t *e);
+int egr_read_index(const egr_entry_t *e, uint32_t *offsets);
+const char *egr_base_name(const char *path);
+void egr_builder_init(egr_builder_t *b);
+int egr_add(egr_builder_t *b, const char *name, const uint8_t *data, size_t len, bool index);
+int egr_save(egr_builder_t *b, const char *fn);
+void egr_builder_free(egr_builder_t *b);
+
+#endif
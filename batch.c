@@ -0,0 +1,594 @@
+/*
+ * batch.c
+ * converting many files in one run, spread over a pool of worker threads
+ *
+ * This code is offered without warranty under the MIT License. Use it as you will
+ * personally or commercially, just give credit if you do.
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include "batch.h"
+#include "util.h"
+#include "thread.h"
+#include "ioring.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#endif
+
+#define BATCH_MAX_WORKERS (64)
+#define BATCH_MAX_AHEAD (64)
+
+/// @brief adds a copy of a name to the end of the list as it is, it isn't looked for on disk,
+///        so it can be the name of an image in an archive
+/// @param nl pointer to the list to add to, zero it before the first use
+/// @param name the name to add
+/// @return 0 on success, otherwise an error code
+int batch_add_name(name_list_t *nl, const char *name) {
+    if(nl->count == nl->cap) {
+        int cap = nl->cap ? nl->cap * 2 : 64;
+        char **names = realloc(nl->names, cap * sizeof(char *));
+        if(NULL == names) return -5; // unable to allocate mem
+        nl->names = names;
+        nl->cap = cap;
+    }
+    size_t len = strlen(name);
+    if(NULL == (nl->names[nl->count] = malloc(len + 1))) {
+        return -5; // unable to allocate mem
+    }
+    memcpy(nl->names[nl->count++], name, len + 1);
+    return 0;
+}
+
+/// @brief checks if a file name ends with the given extension, ignoring case
+static bool has_ext(const char *name, const char *ext) {
+    size_t nlen = strlen(name);
+    size_t elen = strlen(ext);
+    if(nlen <= elen) return false;
+    for(size_t i = 0; i < elen; i++) {
+        if(tolower((unsigned char)name[nlen - elen + i]) != tolower((unsigned char)ext[i])) return false;
+    }
+    return true;
+}
+
+static int cmp_names(const void *a, const void *b) {
+    return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+/// @brief adds a file in a directory to the end of the list
+/// @return 0 on success, otherwise an error code
+static int add_joined(name_list_t *nl, const char *dir, const char *name) {
+    size_t dlen = strlen(dir);
+    size_t nlen = strlen(name);
+    char *path = malloc(dlen + nlen + 2);
+    if(NULL == path) return -5; // unable to allocate mem
+    memcpy(path, dir, dlen);
+    path[dlen] = '/';
+    memcpy(&path[dlen + 1], name, nlen + 1);
+    int rval = batch_add_name(nl, path);
+    free(path);
+    return rval;
+}
+
+/// @brief adds the files of a directory that have the given extension, sorted by name
+/// @return 0 on success, otherwise an error code
+static int add_dir(name_list_t *nl, const char *dir, const char *ext) {
+    int first = nl->count;
+    int rval = 0;
+
+#ifdef _WIN32
+    WIN32_FIND_DATAA fd;
+    size_t dlen = strlen(dir);
+    char *pattern = malloc(dlen + 3);
+    if(NULL == pattern) return -5; // unable to allocate mem
+    memcpy(pattern, dir, dlen);
+    memcpy(&pattern[dlen], "\\*", 3);
+    HANDLE hfind = FindFirstFileA(pattern, &fd);
+    free(pattern);
+    if(INVALID_HANDLE_VALUE == hfind) return -2; // can't open directory
+    do {
+        if(!(fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) && has_ext(fd.cFileName, ext)) {
+            rval = add_joined(nl, dir, fd.cFileName);
+        }
+    } while((0 == rval) && FindNextFileA(hfind, &fd));
+    FindClose(hfind);
+#else
+    DIR *dp = opendir(dir);
+    if(NULL == dp) return -2; // can't open directory
+    struct dirent *de;
+    while((0 == rval) && (NULL != (de = readdir(dp)))) {
+        if(('.' != de->d_name[0]) && has_ext(de->d_name, ext)) {
+            rval = add_joined(nl, dir, de->d_name);
+        }
+    }
+    closedir(dp);
+#endif
+
+    // directory order is arbitrary, sorting keeps runs repeatable
+    qsort(&nl->names[first], nl->count - first, sizeof(char *), cmp_names);
+    return rval;
+}
+
+/// @brief adds a file to the batch, or if it's a directory, the files in it with the given extension
+/// @param nl pointer to the list to add to, zero it before the first use
+/// @param path name of the file or directory
+/// @param ext extension of the files to take from a directory, including the '.'
+/// @return 0 on success, otherwise an error code
+int batch_add_path(name_list_t *nl, const char *path, const char *ext) {
+    if((NULL == nl) || (NULL == path) || (NULL == ext)) {
+        return -1; // NULL pointer error
+    }
+#ifdef _WIN32
+    DWORD attr = GetFileAttributesA(path);
+    bool dir = (INVALID_FILE_ATTRIBUTES != attr) && (attr & FILE_ATTRIBUTE_DIRECTORY);
+#else
+    struct stat st;
+    bool dir = (0 == stat(path, &st)) && S_ISDIR(st.st_mode);
+#endif
+    return dir ? add_dir(nl, path, ext) : batch_add_name(nl, path);
+}
+
+/// @brief adds the files named in a list file to the batch, one per line. blank lines
+///        and lines starting with '#' are skipped, directories are expanded as batch_add_path()
+/// @param nl pointer to the list to add to, zero it before the first use
+/// @param list_name name of the list file
+/// @param ext extension of the files to take from a directory, including the '.'
+/// @return 0 on success, otherwise an error code
+int batch_add_list(name_list_t *nl, const char *list_name, const char *ext) {
+    if((NULL == nl) || (NULL == list_name) || (NULL == ext)) {
+        return -1; // NULL pointer error
+    }
+    FILE *fp = fopen(list_name, "r");
+    if(NULL == fp) {
+        return -2; // can't open file
+    }
+    int rval = 0;
+    char line[4096];
+    while((0 == rval) && (NULL != fgets(line, sizeof(line), fp))) {
+        size_t len = strlen(line);
+        while(len && isspace((unsigned char)line[len - 1])) line[--len] = '\0';
+        if((0 == len) || ('#' == line[0])) continue;
+        rval = batch_add_path(nl, line, ext);
+    }
+    fclose_s(fp);
+    return rval;
+}
+
+/// @brief releases the names held by a list
+/// @param nl pointer to the list
+void batch_free(name_list_t *nl) {
+    if(NULL == nl) return;
+    for(int i = 0; i < nl->count; i++) {
+        free_s(nl->names[i]);
+    }
+    free_s(nl->names);
+    nl->count = 0;
+    nl->cap = 0;
+}
+
+/// @brief makes the name of the output file for an input file
+/// @param fi_name name of the input file
+/// @param out_dir directory to put the output in, NULL to put it next to the input
+/// @param ext extension for the output file, including the '.'
+/// @return the allocated name, or NULL if there was no memory for it
+char *batch_out_name(const char *fi_name, const char *out_dir, const char *ext) {
+    if(NULL == out_dir) {
+        return change_extension(fi_name, ext);
+    }
+    const char *base = fi_name;
+    for(const char *p = fi_name; *p; p++) {
+        if(('/' == *p) || ('\\' == *p)) base = p + 1;
+    }
+    size_t dlen = strlen(out_dir);
+    size_t blen = strlen(base);
+    char *path = malloc(dlen + blen + 2);
+    if(NULL == path) return NULL;
+    memcpy(path, out_dir, dlen);
+    path[dlen] = '/';
+    memcpy(&path[dlen + 1], base, blen + 1);
+    char *name = change_extension(path, ext);
+    free(path);
+    return name;
+}
+
+// states of a read ahead slot
+#define SLOT_FREE    (0)     // waiting for a file to be read in to it
+#define SLOT_READING (1)     // the file is being read
+#define SLOT_READY   (2)     // the file has been read, waiting for a worker
+#define SLOT_TAKEN   (3)     // a worker is converting the file
+
+// a file read ahead of the workers
+typedef struct {
+    int         state;       // one of the SLOT_ values
+    int         index;       // of the file in the list
+    int         err;         // 0, or the error reading the file
+    int         fd;          // the file while it is read through the ring
+    memstream_buf_t buf;     // the contents, len is the size of the file, pos the bytes read so far
+    size_t      cap;         // size allocated for buf
+} slot_t;
+
+// the state shared by the workers of a batch
+typedef struct {
+    const name_list_t *nl;   // the files to convert
+    const char  *out_dir;    // where the output goes, NULL for next to the input
+    const char  *out_ext;    // extension of the output files
+    batch_fn    fn;          // converts a single file
+    mutex_t     lock;        // guards everything below
+    int         next;        // index of the next file to be taken by a worker, or read in
+    int         failed;      // number of files that failed to convert
+    size_t      in_bytes;    // total size of the files read
+    size_t      out_bytes;   // total size of the files written
+    slot_t      *slots;      // files read ahead, NULL if the workers read their own
+    int         nslots;      // number of slots
+    int         taken;       // number of files the workers have taken from the slots
+    cond_t      ready;       // signalled when a slot is ready
+    cond_t      freed;       // signalled when a slot is freed
+} batch_t;
+
+// a worker of the pool, and its own context for the conversion function
+typedef struct {
+    batch_t     *batch;
+    void        *ctx;
+} worker_t;
+
+/// @brief makes sure a slot has room for a file of the given size
+/// @return 0 on success, otherwise an error code
+static int slot_reserve(slot_t *sl, size_t len) {
+    sl->buf.len = len;
+    sl->buf.pos = 0;
+    if((NULL != sl->buf.data) && (sl->cap >= len)) {
+        return 0;
+    }
+    free_s(sl->buf.data);
+    sl->cap = 0;
+    if(NULL == (sl->buf.data = malloc(len ? len : 1))) {
+        return -5; // unable to allocate mem
+    }
+    sl->cap = len;
+    return 0;
+}
+
+/// @brief claims a free slot for the next file to be read, waiting for one to be freed if need be
+/// @param wait false to return straight away if there is no free slot
+/// @return the slot, or NULL if there are no more files, or no free slot and wait was false
+static slot_t *claim_slot(batch_t *b, bool wait) {
+    slot_t *sl = NULL;
+    mutex_lock(&b->lock);
+    while(b->next < b->nl->count) {
+        for(int i = 0; i < b->nslots; i++) {
+            if(SLOT_FREE == b->slots[i].state) {
+                sl = &b->slots[i];
+                break;
+            }
+        }
+        if((NULL != sl) || !wait) break;
+        cond_wait(&b->freed, &b->lock);
+    }
+    if(NULL != sl) {
+        sl->state = SLOT_READING;
+        sl->index = b->next++;
+        sl->err = 0;
+    }
+    mutex_unlock(&b->lock);
+    return sl;
+}
+
+/// @brief hands a slot that has been read in to the workers
+static void slot_ready(batch_t *b, slot_t *sl) {
+    mutex_lock(&b->lock);
+    sl->state = SLOT_READY;
+    cond_broadcast(&b->ready);
+    mutex_unlock(&b->lock);
+}
+
+/// @brief reads a whole file in to a slot, blocking until it is done
+static void read_slot(slot_t *sl, const char *fn) {
+    FILE *fp = fopen(fn, "rb");
+    if(NULL == fp) {
+        sl->err = -2; // can't open file
+        return;
+    }
+    size_t fsz = filesize(fp);
+    if(0 != (sl->err = slot_reserve(sl, fsz))) {
+        // left with the reserve error
+    } else if(fsz && (1 != fread(sl->buf.data, fsz, 1, fp))) {
+        sl->err = -3; // unable to read file
+    }
+    sl->buf.pos = 0;
+    fclose_s(fp);
+}
+
+/// @brief a reader of the thread pool used where there is no io_uring, each reads
+///        one file at a time in to a free slot, blocking while it does
+static THREAD_FUNC(blocking_reader, arg) {
+    batch_t *b = arg;
+    slot_t *sl;
+    while(NULL != (sl = claim_slot(b, true))) {
+        read_slot(sl, b->nl->names[sl->index]);
+        slot_ready(b, sl);
+    }
+    THREAD_RETURN;
+}
+
+#ifndef _WIN32
+/// @brief queues the rest of a slot's file to be read through the ring
+static int queue_slot_read(ioring_t *ring, slot_t *sl, int tag) {
+    size_t left = sl->buf.len - sl->buf.pos;
+    unsigned len = (left > 0x40000000u) ? 0x40000000u : (unsigned)left; // reads are limited to 1GB
+    return ioring_read(ring, sl->fd, &sl->buf.data[sl->buf.pos], len, sl->buf.pos, tag);
+}
+
+/// @brief the reader used with io_uring, a single thread keeps a read in flight for every slot
+///        that is free, opening the next file as soon as one is, and passes each file on as it completes
+static THREAD_FUNC(ring_reader, arg) {
+    batch_t *b = ((worker_t *)arg)->batch;
+    ioring_t *ring = ((worker_t *)arg)->ctx;
+    int inflight = 0;
+    bool refused = false;    // the kernel has io_uring, but turned a read down
+    while(!refused) {
+        // fill every free slot, only waiting for one to be freed if there's nothing to reap
+        slot_t *sl;
+        while(NULL != (sl = claim_slot(b, 0 == inflight))) {
+            const char *fn = b->nl->names[sl->index];
+            struct stat st;
+            int tag = (int)(sl - b->slots);
+            if(0 > (sl->fd = open(fn, O_RDONLY))) {
+                sl->err = -2; // can't open file
+            } else if((0 != fstat(sl->fd, &st)) || (0 != (sl->err = slot_reserve(sl, st.st_size)))) {
+                if(0 == sl->err) sl->err = -3; // unable to read file
+            } else if((st.st_size > 0) && (0 == queue_slot_read(ring, sl, tag))) {
+                inflight++;
+                continue;
+            } else if(st.st_size > 0) {
+                read_slot(sl, fn); // the ring won't take it, so read it here instead
+            }
+            if(sl->fd >= 0) close(sl->fd);
+            slot_ready(b, sl);
+        }
+        if(0 == inflight) break; // every file has been read
+
+        // hand the reads to the kernel and wait for at least one to complete
+        if(ioring_submit(ring, 1)) break;
+        uint64_t tag;
+        int res;
+        while(ioring_reap(ring, &tag, &res)) {
+            sl = &b->slots[tag];
+            if((-EINVAL == res) || (-EOPNOTSUPP == res)) {
+                // the read can't be done through the ring at all, so it is done here, and the
+                // rest of the files are read the slow way once the ring is drained
+                inflight--;
+                close(sl->fd);
+                read_slot(sl, b->nl->names[sl->index]);
+                slot_ready(b, sl);
+                refused = true;
+                continue;
+            }
+            if(res > 0) sl->buf.pos += res;
+            if((res > 0) && (sl->buf.pos < sl->buf.len) && (0 == queue_slot_read(ring, sl, (int)tag))) {
+                continue; // a short read, queue the rest
+            }
+            inflight--;
+            if(sl->buf.pos < sl->buf.len) sl->err = -3; // unable to read file
+            sl->buf.pos = 0;
+            close(sl->fd);
+            slot_ready(b, sl);
+        }
+    }
+
+    if(!inflight && !refused) THREAD_RETURN; // every file has been read
+
+    // should the ring fail, the reads it still has are waited for before their files are read 
+    // again the slow way. closing the ring doesn't stop a read already queued, so one that 
+    // can't be waited for may still land, and its buffer is left to it rather than reused
+    uint64_t tag;
+    int res;
+    while(inflight && (0 == ioring_submit(ring, 1))) {
+        while(ioring_reap(ring, &tag, &res)) {
+            slot_t *sl = &b->slots[tag];
+            inflight--;
+            close(sl->fd);
+            read_slot(sl, b->nl->names[sl->index]);
+            slot_ready(b, sl);
+        }
+    }
+    for(int i = 0; inflight && (i < b->nslots); i++) {
+        slot_t *sl = &b->slots[i];
+        mutex_lock(&b->lock);
+        bool reading = (SLOT_READING == sl->state);
+        mutex_unlock(&b->lock);
+        if(reading) {
+            sl->buf.data = NULL; // still the kernel's
+            sl->cap = 0;
+            close(sl->fd);
+            read_slot(sl, b->nl->names[sl->index]);
+            slot_ready(b, sl);
+        }
+    }
+    ioring_close(ring);
+    return blocking_reader(b);
+}
+#endif
+
+/// @brief takes the next file for a worker to convert, waiting for it to be read in if need be
+/// @param src set to the file's contents if it was read ahead, otherwise NULL
+/// @param sl set to the slot the file was in, or NULL
+/// @return index of the file in the list, or -1 when there are no more
+static int take_file(batch_t *b, slot_t **sl) {
+    int i = -1;
+    *sl = NULL;
+    mutex_lock(&b->lock);
+    if(NULL == b->slots) {
+        // files are handed out one at a time, so a few large ones don't hold up the rest
+        if(b->next < b->nl->count) i = b->next++;
+    } else {
+        while(b->taken < b->nl->count) {
+            for(int s = 0; s < b->nslots; s++) {
+                if(SLOT_READY == b->slots[s].state) {
+                    *sl = &b->slots[s];
+                    break;
+                }
+            }
+            if(NULL != *sl) break;
+            cond_wait(&b->ready, &b->lock);
+        }
+        if(NULL != *sl) {
+            (*sl)->state = SLOT_TAKEN;
+            b->taken++;
+            i = (*sl)->index;
+        }
+    }
+    mutex_unlock(&b->lock);
+    return i;
+}
+
+static THREAD_FUNC(batch_worker, arg) {
+    worker_t *w = arg;
+    batch_t *b = w->batch;
+    slot_t *sl;
+    int i;
+    while(0 <= (i = take_file(b, &sl))) {
+        const char *fi_name = b->nl->names[i];
+        size_t in_bytes = 0;
+        size_t out_bytes = 0;
+        int err = sl ? sl->err : 0;
+        char *fo_name = NULL;
+        if(0 == err) {
+            fo_name = batch_out_name(fi_name, b->out_dir, b->out_ext);
+            err = (NULL == fo_name) ? -5 : b->fn(w->ctx, fi_name, sl ? &sl->buf : NULL, fo_name, &in_bytes, &out_bytes);
+        }
+        free_s(fo_name);
+
+        mutex_lock(&b->lock);
+        if(sl) {
+            sl->state = SLOT_FREE;
+            cond_broadcast(&b->freed);
+        }
+        if(err) {
+            b->failed++;
+            fprintf(stderr, "Failed: '%s' (error %d)\n", fi_name, err);
+        } else {
+            b->in_bytes += in_bytes;
+            b->out_bytes += out_bytes;
+        }
+        mutex_unlock(&b->lock);
+    }
+    THREAD_RETURN;
+}
+
+/// @brief converts every file in a list, spread over a pool of worker threads. a file that
+///        fails is reported and the rest of the batch carries on. the totals are printed at the end.
+///        with read ahead, the files are read in to memory ahead of the workers, through io_uring 
+///        on Linux where it is available, otherwise on a pool of reader threads, so the workers 
+///        don't wait on the disk
+/// @param nl the files to convert
+/// @param out_dir directory to put the output in, NULL to put it next to the input
+/// @param out_ext extension for the output files, including the '.'
+/// @param workers number of worker threads, limited to BATCH_MAX_WORKERS
+/// @param ahead number of files to keep read ahead of the workers, limited to BATCH_MAX_AHEAD,
+///        0 to have the workers read their own files
+/// @param fn converts a single file
+/// @param ctxs array of one context per worker, each ctx_size bytes, passed to fn
+/// @param ctx_size size of a single context in bytes
+/// @return the number of files that failed, or a negative error code
+int batch_run(const name_list_t *nl, const char *out_dir, const char *out_ext, int workers, int ahead,
+              batch_fn fn, void *ctxs, size_t ctx_size) {
+    if((NULL == nl) || (NULL == out_ext) || (NULL == fn) || (NULL == ctxs)) {
+        return -1; // NULL pointer error
+    }
+    if(workers < 1) workers = 1;
+    if(workers > BATCH_MAX_WORKERS) workers = BATCH_MAX_WORKERS;
+    if(workers > nl->count) workers = nl->count ? nl->count : 1;
+    if(ahead < 0) ahead = 0;
+    if(ahead > BATCH_MAX_AHEAD) ahead = BATCH_MAX_AHEAD;
+    if(ahead > nl->count) ahead = nl->count;
+
+    batch_t b;
+    memset(&b, 0, sizeof(b));
+    b.nl = nl;
+    b.out_dir = out_dir;
+    b.out_ext = out_ext;
+    b.fn = fn;
+    worker_t w[BATCH_MAX_WORKERS];
+    thread_t tid[BATCH_MAX_WORKERS];
+    bool running[BATCH_MAX_WORKERS] = {false};
+    thread_t rtid[BATCH_MAX_AHEAD];
+    bool rrunning[BATCH_MAX_AHEAD] = {false};
+    int readers = 0;
+    ioring_t ring;
+    memset(&ring, 0, sizeof(ring));
+    ring.fd = -1;
+    worker_t rw = {&b, &ring};
+    mutex_init(&b.lock);
+    cond_init(&b.ready);
+    cond_init(&b.freed);
+
+    double start = timer_now();
+    if(ahead && (NULL != (b.slots = calloc(ahead, sizeof(slot_t))))) {
+        b.nslots = ahead;
+        // one thread drives the ring, otherwise there is a reader per slot
+        bool started = false;
+#ifndef _WIN32
+        if(0 == ioring_init(&ring, ahead)) {
+            started = (0 == thread_create(&rtid[0], ring_reader, &rw));
+            rrunning[0] = started;
+            readers = 1;
+        }
+#endif
+        for(int t = 0; !started && (t < ahead); t++) {
+            rrunning[t] = (0 == thread_create(&rtid[t], blocking_reader, &b));
+            readers = t + 1;
+        }
+        bool any = false;
+        for(int t = 0; t < readers; t++) any |= rrunning[t];
+        if(!any) {
+            free_s(b.slots); // no reader could be started, so the workers read their own files
+            b.nslots = 0;
+        }
+    }
+
+    for(int t = 0; t < workers; t++) {
+        w[t].batch = &b;
+        w[t].ctx = (uint8_t *)ctxs + t * ctx_size;
+    }
+    // worker 0 runs on the calling thread, if a thread can't be started the others take up its share
+    for(int t = 1; t < workers; t++) {
+        running[t] = (0 == thread_create(&tid[t], batch_worker, &w[t]));
+    }
+    batch_worker(&w[0]);
+    for(int t = 1; t < workers; t++) {
+        if(running[t]) thread_join(tid[t]);
+    }
+    for(int t = 0; t < readers; t++) {
+        if(rrunning[t]) thread_join(rtid[t]);
+    }
+    double elapsed = timer_now() - start;
+    ioring_close(&ring);
+    for(int i = 0; i < b.nslots; i++) {
+        free_s(b.slots[i].buf.data);
+    }
+    free_s(b.slots);
+    cond_destroy(&b.freed);
+    cond_destroy(&b.ready);
+    mutex_destroy(&b.lock);
+    int done = nl->count - b.failed;
+    if(elapsed <= 0.0) elapsed = 1e-9;
+    fprintf(stderr, "Converted %d of %d files on %d workers in %.2f s, %.1f files/s\n",
+           done, nl->count, workers, elapsed, done / elapsed);
+    fprintf(stderr, "Read %.1f MB at %.1f MB/s, wrote %.1f MB at %.1f MB/s\n",
+           b.in_bytes / 1e6, b.in_bytes / 1e6 / elapsed, b.out_bytes / 1e6, b.out_bytes / 1e6 / elapsed);
+    if(b.failed) {
+        fprintf(stderr, "%d files failed\n", b.failed);
+    }
+    return b.failed;
+}
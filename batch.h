@@ -0,0 +1,37 @@
+/*
+ * batch.h
+ * converting many files in one run, spread over a pool of worker threads
+ *
+ * This code is offered without warranty under the MIT License. Use it as you will
+ * personally or commercially, just give credit if you do.
+ */
+#include <stddef.h>
+#include "memstream.h"
+
+#ifndef BATCH_H
+#define BATCH_H
+
+// the files to be converted
+typedef struct {
+    char        **names;     // the file names, each allocated
+    int         count;       // number of names in the list
+    int         cap;         // number of names there is room for
+} name_list_t;
+
+// converts a single file of the batch
+// ctx is the worker's own context, kept from one file to the next so its buffers can be reused
+// src holds the contents of the input file if it was read ahead, or is NULL for fn to read it itself
+// in_bytes and out_bytes are set to the size of the file read and the file written
+// returns 0 on success, otherwise an error code
+typedef int (*batch_fn)(void *ctx, const char *fi_name, memstream_buf_t *src, const char *fo_name, 
+                        size_t *in_bytes, size_t *out_bytes);
+
+int batch_add_name(name_list_t *nl, const char *name);
+int batch_add_path(name_list_t *nl, const char *path, const char *ext);
+int batch_add_list(name_list_t *nl, const char *list_name, const char *ext);
+void batch_free(name_list_t *nl);
+char *batch_out_name(const char *fi_name, const char *out_dir, const char *ext);
+int batch_run(const name_list_t *nl, const char *out_dir, const char *out_ext, int workers, int ahead,
+              batch_fn fn, void *ctxs, size_t ctx_size);
+
+#endif
@@ -0,0 +1,359 @@
+/*
+ * bench.c 
+ * measures the throughput of the codec on synthetic images
+ *  
+ * This code is offered without warranty under the MIT License. Use it as you will 
+ * personally or commercially, just give credit if you do.
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include "eaega.h"
+#include "util.h"
+#include "thread.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+#define TMPNAME "eaega_bench.tmp.bmp" // scratch file for the BMP file steps
+
+// the kinds of synthetic image
+typedef enum {
+    IMG_SOLID = 0,   // a single colour, all runs
+    IMG_NOISE,       // random pixels, no runs at all
+    IMG_DITHER,      // 2 colour checkerboard, every byte the same but never 3 pixels in a row
+    IMG_ART,         // bands of colour broken up by the odd stray pixel, like game art
+    IMG_KINDS
+} image_kind_t;
+
+static const char *kind_names[IMG_KINDS] = {"solid", "noise", "dither", "art"};
+
+static const struct {
+    uint16_t    width;
+    uint16_t    height;
+} sizes[] = {
+    {320, 200}, {640, 350}, {2048, 2048},
+};
+#define NUM_SIZES (sizeof(sizes) / sizeof(sizes[0]))
+
+// the buffers a benchmark step works on
+typedef struct {
+    memstream_buf_t pix;     // the source image, 1 byte per pixel
+    memstream_buf_t enc;     // the encoded image
+    memstream_buf_t img;     // the decoded image, packed
+    memstream_buf_t bmp;     // image loaded back from the BMP file
+    memstream_buf_t planes;  // the decoded image split in to its bit planes
+    uint16_t    width;       // width of the image in pixels
+    uint16_t    height;      // height of the image in pixels or lines
+} bench_t;
+
+typedef int (*step_fn)(bench_t *b);
+
+static double repeat_time = 0.2; // seconds to repeat each measurement for
+
+/// @brief fills an image with one of the synthetic patterns
+static void make_image(uint8_t *px, uint16_t width, uint16_t height, image_kind_t kind) {
+    uint32_t seed = 1;
+    for(int y = 0; y < height; y++) {
+        for(int x = 0; x < width; x++) {
+            seed = seed * 1103515245 + 12345;
+            uint8_t c = 0;
+            switch(kind) {
+                case IMG_SOLID:  c = 1; break;
+                case IMG_NOISE:  c = (seed >> 16) & 0x0f; break;
+                case IMG_DITHER: c = ((x ^ y) & 1) ? 9 : 1; break;
+                default:
+                    c = ((x / 37) + (y / 11)) & 0x0f;
+                    if(0 == ((seed >> 16) & 0x1f)) c = (seed >> 24) & 0x0f;
+                    break;
+            }
+            *px++ = c;
+        }
+    }
+}
+
+/// @brief peak memory use of the process so far
+/// @return size in bytes, or 0 if it can't be found
+static size_t peak_memory(void) {
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS pmc;
+    if(GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc))) return pmc.PeakWorkingSetSize;
+    return 0;
+#else
+    struct rusage ru;
+    if(getrusage(RUSAGE_SELF, &ru)) return 0;
+#ifdef __APPLE__
+    return ru.ru_maxrss;        // bytes on macOS
+#else
+    return ru.ru_maxrss * 1024; // kilobytes elsewhere
+#endif
+#endif
+}
+
+static int step_encode(bench_t *b) {
+    b->enc.pos = 0;
+    return ega_encode(&b->enc, &b->pix, b->width, b->height);
+}
+
+static int step_decode(bench_t *b) {
+    memstream_buf_t src = {b->enc.pos, EGA_HDR_SZ, b->enc.data};
+    return ega_decode_packed(&b->img, &src, b->width, b->height, EGA_LINE_BYTES(b->width));
+}
+
+static int step_find_run(bench_t *b) {
+    // walk each packed line the way the encoder does
+    size_t nbytes = EGA_LINE_BYTES(b->width);
+    int runs = 0;
+    for(int y = 0; y < b->height; y++) {
+        uint8_t *line = &b->img.data[y * nbytes];
+        for(size_t x = 0; x < nbytes;) {
+            int rpos = 0;
+            int len = find_run(&line[x], nbytes - x, &rpos);
+            x += rpos + len;
+            runs += (len > 0);
+        }
+    }
+    return (runs < 0);
+}
+
+static int step_pack(bench_t *b) {
+    size_t nbytes = EGA_LINE_BYTES(b->width);
+    for(int y = 0; y < b->height; y++) {
+        ega_pack_line(&b->img.data[y * nbytes], &b->pix.data[(size_t)y * b->width], b->width);
+    }
+    return 0;
+}
+
+static int step_unpack(bench_t *b) {
+    // the packed copy holds the same pixels, so unpacking it over the source changes nothing
+    size_t nbytes = EGA_LINE_BYTES(b->width);
+    for(int y = 0; y < b->height; y++) {
+        ega_unpack_line(&b->pix.data[(size_t)y * b->width], &b->img.data[y * nbytes], b->width);
+    }
+    return 0;
+}
+
+static int step_planar(bench_t *b) {
+    return ega_pack_planes(&b->planes, &b->img, b->width, b->height, EGA_LINE_BYTES(b->width));
+}
+
+static int step_save_bmp(bench_t *b) {
+    return save_bmp(TMPNAME, &b->pix, b->width, b->height, ega_pal);
+}
+
+static int step_load_bmp(bench_t *b) {
+    uint16_t w, h;
+    return load_bmp(&b->bmp, TMPNAME, &w, &h);
+}
+
+/// @brief runs a step over and over for repeat_time seconds
+/// @return average seconds per run, or a negative value if the step failed
+static double time_step(step_fn fn, bench_t *b) {
+    int n = 0;
+    double start = timer_now();
+    double elapsed;
+    do {
+        if(fn(b)) return -1.0;
+        n++;
+        elapsed = timer_now() - start;
+    } while(elapsed < repeat_time);
+    return elapsed / n;
+}
+
+/// @brief times a step and prints its throughput
+static void report(const char *name, const char *kernel, step_fn fn, bench_t *b) {
+    double t = time_step(fn, b);
+    if(t < 0) {
+        printf("  %-9s %-7s failed\n", name, kernel);
+        return;
+    }
+    double npix = (double)b->width * b->height;
+    printf("  %-9s %-7s %9.1f Mpx/s %9.1f MB/s\n", name, kernel, npix / t / 1e6, 
+           (npix / 2) / t / 1e6);
+}
+
+/// @brief times every step of the codec on one image
+/// @return 0 on success, otherwise an error code
+static int bench_image(uint16_t width, uint16_t height, image_kind_t kind) {
+    int rval = -1;
+    bench_t b = {{0, 0, NULL}, {0, 0, NULL}, {0, 0, NULL}, {0, 0, NULL}, {0, 0, NULL}, width, height};
+
+    b.pix.len = ega_decode_size(width, height);
+    b.enc.len = ega_encode_bound(width, height);
+    b.img.len = ega_decode_packed_size(EGA_LINE_BYTES(width), height);
+    b.planes.len = ega_planar_size(width, height);
+    if((NULL == (b.pix.data = malloc(b.pix.len))) ||
+       (NULL == (b.enc.data = malloc(b.enc.len))) ||
+       (NULL == (b.img.data = malloc(b.img.len))) ||
+       (NULL == (b.planes.data = malloc(b.planes.len)))) {
+        printf("Unable to allocate memory\n");
+        goto CLEANUP;
+    }
+    make_image(b.pix.data, width, height, kind);
+    if(step_encode(&b) || step_decode(&b)) {
+        printf("Unable to encode image\n");
+        goto CLEANUP;
+    }
+
+    printf("%s %d x %d, %zu bytes encoded, ratio %.1f%% of packed\n", kind_names[kind], width, height, 
+           b.enc.pos, 100.0 * b.enc.pos / b.img.len);
+
+    // the encoder and run search for each kernel this cpu has
+    for(ega_kernel_t k = EGA_KERNEL_SCALAR; k <= EGA_KERNEL_NEON; k++) {
+        if(ega_select_kernel(k)) continue;
+        report("encode", ega_kernel_name(), step_encode, &b);
+        report("find_run", ega_kernel_name(), step_find_run, &b);
+        report("pack", ega_kernel_name(), step_pack, &b);
+        report("unpack", ega_kernel_name(), step_unpack, &b);
+        report("planar", ega_kernel_name(), step_planar, &b);
+    }
+    ega_select_kernel(EGA_KERNEL_AUTO);
+    report("decode", "", step_decode, &b);
+    report("save_bmp", "", step_save_bmp, &b);
+    report("load_bmp", "", step_load_bmp, &b);
+    remove(TMPNAME);
+
+    rval = 0;
+CLEANUP:
+    free_s(b.pix.data);
+    free_s(b.enc.data);
+    free_s(b.img.data);
+    free_s(b.bmp.data);
+    free_s(b.planes.data);
+    return rval;
+}
+
+/// @brief times the threaded decoder with a given number of threads
+/// @param index true to include building the scanline index in the time
+/// @return megabytes of decoded (packed) image per second
+static double time_decode(memstream_buf_t *img, memstream_buf_t *src, uint16_t width, uint16_t height, 
+                          uint32_t *offsets, int threads, bool index) {
+    size_t stride = EGA_LINE_BYTES(width);
+    int n = 0;
+    double start = timer_now();
+    double elapsed;
+    do {
+        memstream_buf_t ms = *src;
+        if(index) {
+            ega_index_lines(&ms, width, height, offsets);
+            ms.pos = src->pos;
+        }
+        ega_decode_packed_mt(img, &ms, width, height, stride, offsets, threads);
+        n++;
+        elapsed = timer_now() - start;
+    } while(elapsed < repeat_time);
+    return (double)img->len * n / elapsed / 1e6;
+}
+
+/// @brief measures how the two pass decoder scales with the number of threads
+/// @return 0 on success, otherwise an error code
+static int bench_scaling(uint16_t width, uint16_t height) {
+    int rval = -1;
+    memstream_buf_t pix = {0, 0, NULL}; // source image, 1 byte per pixel
+    memstream_buf_t enc = {0, 0, NULL}; // encoded image
+    memstream_buf_t img = {0, 0, NULL}; // decoded image, packed
+    uint32_t *offsets = NULL;
+
+    printf("Decoder scaling, %d x %d image, %d cpus, %s kernels\n", width, height, cpu_count(), ega_kernel_name());
+
+    pix.len = ega_decode_size(width, height);
+    enc.len = ega_encode_bound(width, height);
+    img.len = ega_decode_packed_size(EGA_LINE_BYTES(width), height);
+    pix.data = malloc(pix.len);
+    enc.data = malloc(enc.len);
+    img.data = malloc(img.len);
+    offsets = malloc(height * sizeof(uint32_t));
+    if((NULL == pix.data) || (NULL == enc.data) || (NULL == img.data) || (NULL == offsets)) {
+        printf("Unable to allocate memory\n");
+        goto CLEANUP;
+    }
+
+    make_image(pix.data, width, height, IMG_ART);
+    if(ega_encode(&enc, &pix, width, height)) {
+        printf("Unable to encode image\n");
+        goto CLEANUP;
+    }
+    // from here on enc holds just the encoded file
+    enc.len = enc.pos;
+    enc.pos = 0;
+    ega_read_header(&enc, &width, &height);
+    memstream_buf_t ms = enc; // leave enc positioned at the start of the RLE data
+    ega_index_lines(&ms, width, height, offsets);
+    printf("Encoded size: %zu bytes (%.1f%% of packed)\n", enc.len, 100.0 * enc.len / img.len);
+
+    double base = time_decode(&img, &enc, width, height, offsets, 1, false);
+    printf("  %2d thread  %8.1f MB/s\n", 1, base);
+    for(int t = 2; (t <= cpu_count() * 2) && (t <= EGA_MAX_THREADS); t *= 2) {
+        double mbs = time_decode(&img, &enc, width, height, offsets, t, false);
+        printf("  %2d threads %8.1f MB/s  x%.2f\n", t, mbs, mbs / base);
+    }
+    double mbs = time_decode(&img, &enc, width, height, offsets, cpu_count(), true);
+    printf("  %2d threads %8.1f MB/s  x%.2f including the index pass\n", cpu_count(), mbs, mbs / base);
+
+    rval = 0;
+CLEANUP:
+    free_s(pix.data);
+    free_s(enc.data);
+    free_s(img.data);
+    free_s(offsets);
+    return rval;
+}
+
+/// @brief prints the command line help
+/// @param prog name of the program
+static void usage(char *prog) {
+    printf("USAGE: %s [options]\n", prog);
+    printf("options:\n");
+    printf("  --time S           seconds to repeat each measurement for (default %.1f)\n", repeat_time);
+    printf("  --quick            skip the largest image size\n");
+    printf("  --scaling [W H]    measure how the threaded decoder scales instead, on a W x H image\n");
+}
+
+int main(int argc, char *argv[]) {
+    bool quick = false;
+    bool scaling = false;
+    uint16_t width = 640;
+    uint16_t height = 8192;
+
+    char *prog = filename(argv[0]);
+    argv++; argc--; // consume the first arg (program name)
+
+    while(argc) {
+        if((0 == strcmp(argv[0], "--time")) && (argc > 1)) {
+            argv++; argc--; // consume the option, leaving its value
+            repeat_time = atof(argv[0]);
+        } else if(0 == strcmp(argv[0], "--quick")) {
+            quick = true;
+        } else if(0 == strcmp(argv[0], "--scaling")) {
+            scaling = true;
+            if((argc > 2) && ('-' != argv[1][0])) {
+                width = atoi(argv[1]);
+                height = atoi(argv[2]);
+                argv += 2; argc -= 2; // consume the size
+            }
+        } else {
+            usage(prog);
+            return -1;
+        }
+        argv++; argc--; // consume the option
+    }
+
+    if(scaling) return bench_scaling(width, height);
+
+    printf("Codec throughput, MB/s is of packed 4 bit pixels\n");
+    for(size_t s = 0; s < NUM_SIZES; s++) {
+        if(quick && (s == (NUM_SIZES - 1))) break;
+        for(image_kind_t k = IMG_SOLID; k < IMG_KINDS; k++) {
+            if(bench_image(sizes[s].width, sizes[s].height, k)) return -1;
+        }
+    }
+    printf("Peak memory: %.1f MB\n", peak_memory() / 1e6);
+    return 0;
+}
@@ -0,0 +1,587 @@
+/*
+ * bmp.c 
+ * reading and writing of 16 colour Windows BMP images
+ * 
+ * This code is offered without warranty under the MIT License. Use it as you will 
+ * personally or commercially, just give credit if you do.
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include "bmp.h"
+#include "util.h"
+#include "eaega.h"
+#include "thread.h"
+
+// size of the signature and both headers as they are stored in the file
+#define HDRBUFSZ (sizeof(bmp_signature_t) + sizeof(bmp_header_t))
+
+/// @brief builds the signature, headers and palette for a 16 colour BMP in memory
+/// @param dst pointer to where the header is built, BMP_HDR_SZ bytes
+/// @param width  width of the image in pixels
+/// @param height height of the image in pixels or lines
+/// @param pal pointer to 16 entry palette
+/// @param compression how the image data is stored, BMP_BI_RGB or BMP_BI_RLE4
+/// @param bmp_img_sz size of the image data in bytes
+static void make_header(uint8_t *dst, uint16_t width, uint16_t height, const bmp_palette_entry_t *pal, 
+                        uint32_t compression, uint32_t bmp_img_sz) {
+    // header buffer has 16 bit padding at the start to maintian 32 bit alignment
+    // after the 16 bit signature.
+    uint32_t hdrbuf[(HDRBUFSZ + 2 + 3) / 4] = {0};
+
+    // signature starts after padding to maintain 32bit alignment for the rest of the header
+    bmp_signature_t *sig = (bmp_signature_t *)&((uint8_t *)hdrbuf)[2];
+
+    // bmp header starts after signature
+    bmp_header_t *bmp = (bmp_header_t *)&((uint8_t *)hdrbuf)[2 + sizeof(bmp_signature_t)];
+
+    // setup the signature and DIB header fields
+    *sig = BMPFILESIG;
+    size_t palsz = sizeof(bmp_palette_entry_t) * 16;
+    bmp->dib.image_offset = HDRBUFSZ + palsz;
+    bmp->dib.file_size = bmp->dib.image_offset + bmp_img_sz;
+
+    // setup the bmi header fields
+    bmp->bmi.header_size = sizeof(bmi_header_t);
+    bmp->bmi.image_width = width;
+    bmp->bmi.image_height = height;
+    bmp->bmi.num_planes = 1;           // always 1
+    bmp->bmi.bits_per_pixel = 4;       // 16 colour image
+    bmp->bmi.compression = compression;
+    bmp->bmi.bitmap_size = bmp_img_sz;
+    bmp->bmi.horiz_res = BMP96DPI;
+    bmp->bmi.vert_res = BMP96DPI;
+    bmp->bmi.num_colors = 16;          // palette has 16 colours
+    bmp->bmi.important_colors = 0;     // all colours are important
+
+    // the header, then the palette straight after it. we're using our global 
+    // palette here, wich is already in BMP format
+    memcpy(dst, sig, HDRBUFSZ);
+    memcpy(&dst[HDRBUFSZ], pal, palsz);
+}
+
+/// @brief builds the signature, headers and palette for an uncompressed 16 colour BMP in memory
+/// @param dst pointer to where the header is built, BMP_HDR_SZ bytes
+/// @param width  width of the image in pixels
+/// @param height height of the image in pixels or lines
+/// @param pal pointer to 16 entry palette
+void make_bmp_header(uint8_t *dst, uint16_t width, uint16_t height, const bmp_palette_entry_t *pal) {
+    // stride is the bytes per line in the BMP file, which are padded
+    // out to 32 bit boundaries
+    make_header(dst, width, height, pal, BMP_BI_RGB, BMP4STRIDE(width) * height);
+}
+
+/// @brief builds the signature, headers and palette for a BI_RLE4 compressed 16 colour BMP in memory
+/// @param dst pointer to where the header is built, BMP_HDR_SZ bytes
+/// @param width  width of the image in pixels
+/// @param height height of the image in pixels or lines
+/// @param pal pointer to 16 entry palette
+/// @param len length of the compressed image data in bytes
+void make_bmp_rle4_header(uint8_t *dst, uint16_t width, uint16_t height, const bmp_palette_entry_t *pal, size_t len) {
+    make_header(dst, width, height, pal, BMP_BI_RLE4, len);
+}
+
+/// @brief writes the signature, headers and palette for a 16 colour BMP
+/// @param fp handle to the open output file
+/// @param width  width of the image in pixels
+/// @param height height of the image in pixels or lines
+/// @param pal pointer to 16 entry palette
+/// @return 0 on success, otherwise an error code
+int write_bmp_header(FILE *fp, uint16_t width, uint16_t height, const bmp_palette_entry_t *pal) {
+    uint8_t hdr[BMP_HDR_SZ];
+    make_bmp_header(hdr, width, height, pal);
+    if(1 != fwrite(hdr, BMP_HDR_SZ, 1, fp)) {
+        return -4;  // unable to write file
+    }
+    return 0;
+}
+
+/// @brief saves the image pointed to by src as a BMP, assumes 16 colour 1 byte per pixel image data.
+///        the whole file is built in memory and written with a single write
+/// @param fn name of the file to create and write to
+/// @param src memstream buffer pointer to the source image data
+/// @param width  width of the image in pixels
+/// @param height height of the image in pixels or lines
+/// @param pal pointe to 16 entry palette
+/// @return 0 on success, otherwise an error code
+int save_bmp(const char *fn, memstream_buf_t *src, uint16_t width, uint16_t height, const bmp_palette_entry_t *pal) {
+    int rval = 0;
+    uint8_t *buf = NULL; // file buffer
+
+    // do some basic error checking on the inputs
+    if((NULL == fn) || (NULL == src) || (NULL == src->data)) {
+        rval = -1;  // NULL pointer error
+        goto bmp_cleanup;
+    }
+
+    // stride is the bytes per line in the BMP file, which are padded
+    // out to 32 bit boundaries
+    uint32_t stride = BMP4STRIDE(width);
+    size_t fsz = BMP_HDR_SZ + (size_t)stride * height;
+
+    // allocate a buffer to hold the whole file, every byte of it is written 
+    // below so there's no need to have it zeroed
+    if(NULL == (buf = malloc(fsz))) {
+        rval = -3;  // unable to allocate mem
+        goto bmp_cleanup;
+    }
+    make_bmp_header(buf, width, height, pal);
+
+    // now we need to output the image scanlines. For maximum
+    // compatibility we do so in the natural order for BMP
+    // which is from bottom to top. For 16 colour/4 bit image
+    // the pixels are packed two per byte, left most pixel in
+    // the most significant nibble.
+    // start by pointing to start of last line of data
+    uint8_t *px = &src->data[src->len - width];
+    uint8_t *dp = &buf[BMP_HDR_SZ];
+    size_t nbytes = ((size_t)width + 1) / 2;
+    for(int y = 0; y < height; y++) {
+        ega_pack_line(dp, px, width);   // we are packing 2 pixels per byte
+        memset(&dp[nbytes], 0, stride - nbytes); // then pad out to the stride
+        dp += stride;
+        px -= width; // move back to start of previous line
+    }
+
+    rval = write_file(fn, buf, fsz);
+
+bmp_cleanup:
+    free_s(buf);
+    return rval;
+}
+
+/// @brief saves an image that is already in BMP pixel layout, packed 2 pixels per byte,
+///        BMP4STRIDE(width) bytes per line and bottom line first. the header and the image 
+///        are written together with a single write, without copying the image
+/// @param fn name of the file to create and write to
+/// @param src memstream buffer pointer to the packed image data
+/// @param width  width of the image in pixels
+/// @param height height of the image in pixels or lines
+/// @param pal pointer to 16 entry palette
+/// @return 0 on success, otherwise an error code
+int save_bmp_packed(const char *fn, memstream_buf_t *src, uint16_t width, uint16_t height, const bmp_palette_entry_t *pal) {
+    // do some basic error checking on the inputs
+    if((NULL == fn) || (NULL == src) || (NULL == src->data)) {
+        return -1;  // NULL pointer error
+    }
+    size_t bmp_img_sz = (size_t)BMP4STRIDE(width) * height;
+    if(src->len < bmp_img_sz) {
+        return -1;  // not enough image data
+    }
+
+    // the scanlines are already in order, padded and packed, so they go straight out after the header
+    uint8_t hdr[BMP_HDR_SZ];
+    make_bmp_header(hdr, width, height, pal);
+    io_chunk_t chunks[2] = {{hdr, BMP_HDR_SZ}, {src->data, bmp_img_sz}};
+    return write_chunks(fn, chunks, 2);
+}
+
+/// @brief saves an image that is already BI_RLE4 compressed, as from ega_transcode_rle4(). the 
+///        header and the image are written together with a single write
+/// @param fn name of the file to create and write to
+/// @param src memstream buffer pointer to the compressed image data, pos is its length
+/// @param width  width of the image in pixels
+/// @param height height of the image in pixels or lines
+/// @param pal pointer to 16 entry palette
+/// @return 0 on success, otherwise an error code
+int save_bmp_rle4(const char *fn, memstream_buf_t *src, uint16_t width, uint16_t height, const bmp_palette_entry_t *pal) {
+    // do some basic error checking on the inputs
+    if((NULL == fn) || (NULL == src) || (NULL == src->data) || (src->pos > src->len)) {
+        return -1;  // NULL pointer error
+    }
+
+    uint8_t hdr[BMP_HDR_SZ];
+    make_bmp_rle4_header(hdr, width, height, pal, src->pos);
+    io_chunk_t chunks[2] = {{hdr, BMP_HDR_SZ}, {src->data, src->pos}};
+    return write_chunks(fn, chunks, 2);
+}
+
+/// @brief reads and checks the headers of a 16 colour, 256 colour or 24 bit BMP in memory
+/// @param src memstream buffer holding the BMP file, positioned at the signature
+/// @param bmp receives a copy of the headers, image_height is made positive and 
+///        num_colors is filled in if it was left at 0
+/// @param flip set true if the lines are stored top to bottom
+/// @return 0 on success, otherwise an error code
+static int read_header(memstream_buf_t *src, bmp_header_t *bmp, bool *flip) {
+    if((NULL == src->data) || (src->len < src->pos) || ((src->len - src->pos) < HDRBUFSZ)) {
+        return -3;  // unable to read file
+    }
+    uint8_t *base = &src->data[src->pos];
+
+    bmp_signature_t sig = 0;
+    memcpy(&sig, base, sizeof(bmp_signature_t));
+    if(BMPFILESIG != sig) {
+        return -4; // not a BMP file
+    }
+
+    // the header is not aligned in the file, so take a copy of it
+    memcpy(bmp, &base[sizeof(bmp_signature_t)], sizeof(bmp_header_t));
+
+    // check some basic header vitals to make sure it's in a format we can work with
+    if((1 != bmp->bmi.num_planes) || 
+       (sizeof(bmi_header_t) != bmp->bmi.header_size) || 
+       (0 != bmp->dib.RES)) {
+        return -6;  // invalid header
+    }
+
+    // a palette size of 0 means the most the bit depth allows
+    if((0 == bmp->bmi.num_colors) && (bmp->bmi.bits_per_pixel <= 8)) {
+        bmp->bmi.num_colors = 1 << bmp->bmi.bits_per_pixel;
+    }
+    bool rgb = (BMP_BI_RGB == bmp->bmi.compression);
+    switch(bmp->bmi.bits_per_pixel) {
+        case 4:
+            if((16 != bmp->bmi.num_colors) || (!rgb && (BMP_BI_RLE4 != bmp->bmi.compression))) {
+                return -7;  // unsupported BMP format
+            }
+            break;
+        case 8:
+            if((bmp->bmi.num_colors > 256) || !rgb) {
+                return -7;  // unsupported BMP format
+            }
+            break;
+        case 24:
+            if(!rgb) {
+                return -7;  // unsupported BMP format
+            }
+            break;
+        default:
+            return -7;  // unsupported BMP format
+    }
+
+    // if height is negative, flip the render order
+    *flip = (bmp->bmi.image_height < 0); 
+    bmp->bmi.image_height = abs(bmp->bmi.image_height);
+    if((bmp->bmi.image_width > 0xffff) || (bmp->bmi.image_height > 0xffff)) {
+        return -7;  // unsupported BMP format
+    }
+
+    // 16 colour images are assumed to use the standard CGA/EGA/VGA palette, but 
+    // the palette of a 256 colour image is needed to map it down
+    size_t palofs = sizeof(bmp_signature_t) + sizeof(dib_header_t) + bmp->bmi.header_size;
+    if((bmp->dib.image_offset > (src->len - src->pos)) ||
+       ((8 == bmp->bmi.bits_per_pixel) && 
+        ((palofs + bmp->bmi.num_colors * sizeof(bmp_palette_entry_t)) > bmp->dib.image_offset))) {
+        return -3;  // unable to read file
+    }
+    return 0;
+}
+
+/// @brief finds the closest colour in the 16 colour palette, by distance in RGB space
+/// @return index of the palette entry
+static uint8_t nearest_colour(uint8_t r, uint8_t g, uint8_t b) {
+    uint8_t best = 0;
+    uint32_t best_d = UINT32_MAX;
+    for(int i = 0; i < 16; i++) {
+        int dr = r - ega_pal[i].r;
+        int dg = g - ega_pal[i].g;
+        int db = b - ega_pal[i].b;
+        uint32_t d = dr * dr + dg * dg + db * db;
+        if(d < best_d) {
+            best_d = d;
+            best = i;
+        }
+    }
+    return best;
+}
+
+// nearest 16 colour palette entry for every 15 bit RGB colour, indexed by RGB555_INDEX()
+#define RGB555_INDEX(R, G, B) ((((uint32_t)(R) >> 3) << 10) | (((uint32_t)(G) >> 3) << 5) | ((uint32_t)(B) >> 3))
+static uint8_t rgb555_lut[1 << 15];
+static once_t rgb555_once = ONCE_INIT;
+
+/// @brief fills in the 15 bit RGB to 16 colour table, run once by build_rgb555_lut()
+static void fill_rgb555_lut(void) {
+    for(uint32_t i = 0; i < (1 << 15); i++) {
+        // widen each 5 bit component back to 8 bits to match against the palette
+        uint8_t r = (i >> 10) & 0x1f;
+        uint8_t g = (i >> 5) & 0x1f;
+        uint8_t b = i & 0x1f;
+        rgb555_lut[i] = nearest_colour((r << 3) | (r >> 2), (g << 3) | (g >> 2), (b << 3) | (b >> 2));
+    }
+}
+
+/// @brief builds the 15 bit RGB to 16 colour table the first time a 24 bit image is loaded. 
+///        the workers of a batch or server can get here together, the first builds it and the 
+///        others wait for it, so none reads the table half built
+static void build_rgb555_lut(void) {
+    thread_once(&rgb555_once, fill_rgb555_lut);
+}
+
+/// @brief sets a single pixel in a line of packed pixels
+static inline void put_px(uint8_t *line, size_t x, uint8_t c) {
+    uint8_t *p = &line[x / 2];
+    *p = (x & 1) ? ((*p & 0xf0) | c) : ((*p & 0x0f) | (c << 4));
+}
+
+/// @brief notes a run of identical packed bytes for read_rle4_line(), joining it on to the 
+///        previous run if that ends where it starts and has the same value
+static void add_run(const uint8_t *line, bmp_run_t *runs, size_t *nruns, size_t pos, size_t len) {
+    if(0 == len) return;
+    if(*nruns) {
+        bmp_run_t *r = &runs[*nruns - 1];
+        if(((size_t)r->pos + r->len == pos) && (line[r->pos] == line[pos])) {
+            r->len += len;
+            return;
+        }
+    }
+    runs[*nruns].pos = pos;
+    runs[*nruns].len = len;
+    (*nruns)++;
+}
+
+/// @brief reads a single line of BI_RLE4 compressed data to packed pixels, 2 per byte with the 
+///        leftmost pixel in the high nibble. optionally the runs of identical bytes the codes
+///        describe are reported, so they can be passed on without having to be searched for
+/// @param line buffer for the packed line, (width + 1) / 2 bytes, pixels not covered by the codes are 0
+/// @param src memstream buffer positioned at the start of the line's codes, pos is left after them
+/// @param width width of the image in pixels
+/// @param runs receives the runs of identical bytes, in order, (width + 1) / 2 entries. may be NULL
+/// @param nruns receives the number of runs, may be NULL if runs is
+/// @return 0 on success, 1 if the line ended the image, otherwise an error code
+int read_rle4_line(uint8_t *line, memstream_buf_t *src, uint16_t width, bmp_run_t *runs, size_t *nruns) {
+    size_t x = 0;
+    memset(line, 0, (width + 1) / 2);
+    if(runs) *nruns = 0;
+
+    while(true) {
+        if((src->len - src->pos) < 2) return -3; // ran out of data
+        uint8_t n = src->data[src->pos++];
+        uint8_t v = src->data[src->pos++];
+        if(n) {
+            // encoded mode, n pixels alternating between the 2 nibbles of v. whatever the
+            // alignment, every byte the run covers completely holds the same value
+            if((x + n) > width) return -3; // code spans the end of the line
+            size_t end = x + n;
+            if(x & 1) {
+                put_px(line, x++, v >> 4);
+                v = (v << 4) | (v >> 4); // the rest of the run starts on the low nibble
+            }
+            size_t nb = (end - x) / 2;
+            memset(&line[x / 2], v, nb);
+            if(runs) add_run(line, runs, nruns, x / 2, nb);
+            x += nb * 2;
+            if(x < end) put_px(line, x++, v >> 4);
+        } else if(0 == v) {
+            return 0; // end of line
+        } else if(1 == v) {
+            return 1; // end of bitmap
+        } else if(2 == v) {
+            return -7;  // deltas skip between lines, which isn't supported
+        } else {
+            // absolute mode, v pixels packed as they are, padded out to 16 bits
+            size_t nb = (v + 1) / 2;
+            if((src->len - src->pos) < (nb + (nb & 1))) return -3; // ran out of data
+            if((x + v) > width) return -3; // code spans the end of the line
+            const uint8_t *sp = &src->data[src->pos];
+            if(x & 1) {
+                for(size_t i = 0; i < v; i++) {
+                    put_px(line, x + i, (i & 1) ? (sp[i / 2] & 0x0f) : (sp[i / 2] >> 4));
+                }
+            } else {
+                // the pad nibble of an odd count lands on the next pixel, which the next code overwrites
+                memcpy(&line[x / 2], sp, nb);
+                if(v & 1) line[(x + v) / 2] &= 0xf0;
+            }
+            x += v;
+            src->pos += nb + (nb & 1);
+        }
+    }
+}
+
+/// @brief finds the compressed image data in a BI_RLE4 16 colour BMP in memory, without decoding it
+/// @param src memstream buffer holding the BMP file, positioned at the signature
+/// @param rle receives a view of the compressed data within src, pos at its start
+/// @param width  pointer to width of the image in pixels set on return
+/// @param height pointer to height of the image in pixels or lines set on return
+/// @return 0 on success, -7 if the image is not BI_RLE4 compressed, otherwise an error code
+int find_bmp_rle4(memstream_buf_t *src, memstream_buf_t *rle, uint16_t *width, uint16_t *height) {
+    bmp_header_t bmp;
+    bool flip;
+
+    // do some basic error checking on the inputs
+    if((NULL == src) || (NULL == rle) || (NULL == width) || (NULL == height)) {
+        return -1;  // NULL pointer error
+    }
+    int rval = read_header(src, &bmp, &flip);
+    if(rval) return rval;
+    if((BMP_BI_RLE4 != bmp.bmi.compression) || flip) {
+        return -7;  // unsupported BMP format, compressed images are always bottom line first
+    }
+
+    rle->data = &src->data[src->pos];
+    rle->len = src->len - src->pos;
+    rle->pos = bmp.dib.image_offset;
+    *width = bmp.bmi.image_width;
+    *height = bmp.bmi.image_height;
+    return 0;
+}
+
+/// @brief reads the size of a BMP image in memory from its headers, without loading it. the same 
+///        images are accepted as load_bmp_mem()
+/// @param src memstream buffer holding the BMP file, positioned at the signature, left where it was
+/// @param width  pointer to width of the image in pixels set on return
+/// @param height pointer to height of the image in pixels or lines set on return
+/// @return  0 on success, otherwise an error code
+int read_bmp_size(const memstream_buf_t *src, uint16_t *width, uint16_t *height) {
+    bmp_header_t bmp;
+    bool flip;
+
+    // do some basic error checking on the inputs
+    if((NULL == src) || (NULL == width) || (NULL == height)) {
+        return -1;  // NULL pointer error
+    }
+    memstream_buf_t ms = *src;
+    int rval = read_header(&ms, &bmp, &flip);
+    if(rval) return rval;
+    *width = bmp.bmi.image_width;
+    *height = bmp.bmi.image_height;
+    return 0;
+}
+
+/// @brief loads the BMP image from memory. 16 colour images, uncompressed or BI_RLE4, have their palette
+///        ignored, assumed to follow CGA/EGA/VGA standard palette. 256 colour and 24 bit images are 
+///        mapped to the nearest colours of that palette
+/// @param dst pointer to a memstream buffer struct, empty or holding a buffer from an earlier load. load_bmp_mem will 
+///        allocate the buffer if needed, image will be stored as 1 byte per pixel, len is set to its size
+/// @param src memstream buffer holding the BMP file, positioned at the signature
+/// @param width  pointer to width of the image in pixels set on return
+/// @param height pointer to height of the image in pixels or lines set on return
+/// @return  0 on success, otherwise an error code
+int load_bmp_mem(memstream_buf_t *dst, memstream_buf_t *src, uint16_t *width, uint16_t *height) {
+    int rval = 0;
+    bmp_header_t bmp;
+    bool flip;
+    uint8_t *line = NULL; // line buffer for compressed images
+    uint8_t remap[256] = {0}; // 256 colour palette mapped to the 16 colour one
+
+    // do some basic error checking on the inputs
+    if((NULL == src) || (NULL == dst) || (NULL == width) || (NULL == height)) {
+        rval = -1;  // NULL pointer error
+        goto bmp_cleanup;
+    }
+    if(0 != (rval = read_header(src, &bmp, &flip))) {
+        goto bmp_cleanup;
+    }
+    uint8_t *base = &src->data[src->pos];
+
+    uint16_t lw = bmp.bmi.image_width;
+    uint16_t lh = bmp.bmi.image_height;
+    uint16_t bpp = bmp.bmi.bits_per_pixel;
+
+    // stride is the bytes per line in the BMP file, which are padded
+    // out to 32 bit boundaries
+    uint32_t stride = BMP4STRIDE(lw);
+    if(8 == bpp) stride = ((uint32_t)lw + 3) & ~3;
+    if(24 == bpp) stride = ((uint32_t)lw * 3 + 3) & ~3;
+    bool rle4 = (BMP_BI_RLE4 == bmp.bmi.compression);
+
+    size_t avail = src->len - src->pos;
+    if(!rle4 && ((avail - bmp.dib.image_offset) < (size_t)stride * lh)) {
+        rval = -3;  // unable to read file
+        goto bmp_cleanup;
+    }
+    uint8_t *buf = &base[bmp.dib.image_offset];
+
+    // colour mapping is a single lookup per pixel, the search for the nearest 
+    // colour is done once per palette entry, or once ever for 24 bit images
+    if(8 == bpp) {
+        const uint8_t *pal = &base[sizeof(bmp_signature_t) + sizeof(dib_header_t) + bmp.bmi.header_size];
+        for(uint32_t i = 0; i < bmp.bmi.num_colors; i++) {
+            remap[i] = nearest_colour(pal[i * 4 + 2], pal[i * 4 + 1], pal[i * 4]);
+        }
+    } else if(24 == bpp) {
+        build_rgb555_lut();
+    }
+
+    // a destination buffer that is already large enough is reused, so a caller loading 
+    // many images can keep the one buffer. otherwise it is replaced with one of the right size
+    if((NULL != dst->data) && (dst->len < (size_t)lw * lh)) {
+        free(dst->data);
+        dst->data = NULL;
+    }
+
+    // allocate our output buffer
+    if(((NULL == dst->data) && (NULL == (dst->data = malloc((size_t)lw * lh)))) ||
+       (rle4 && (NULL == (line = malloc((lw + 1) / 2))))) {
+        rval = -5;  // unable to allocate mem
+        goto bmp_cleanup;
+    }
+    dst->len = (size_t)lw * lh;
+    dst->pos = 0;
+
+    // the compressed data is read through its own memstream, from the start of the file
+    memstream_buf_t rle = {avail, bmp.dib.image_offset, base};
+    bool ended = false; // an end of bitmap code leaves the rest of the lines empty
+
+    // now we need to read the image scanlines. 
+    // start by pointing to start of last line of data
+    uint8_t *px = &dst->data[dst->len - lw]; 
+    if(flip) px = dst->data; // if flipped, start at beginning
+    // loop through the lines
+    for(int y = 0; y < lh; y++) {
+        if(rle4) {
+            if(ended) {
+                memset(line, 0, (lw + 1) / 2);
+            } else if(0 > (rval = read_rle4_line(line, &rle, lw, NULL, NULL))) {
+                goto bmp_cleanup;
+            } else {
+                ended = (1 == rval);
+                rval = 0;
+            }
+            ega_unpack_line(px, line, lw);
+        } else {
+            if(4 == bpp) {
+                ega_unpack_line(px, buf, lw); // we are unpacking 2 pixels per byte
+            } else if(8 == bpp) {
+                for(int x = 0; x < lw; x++) {
+                    px[x] = remap[buf[x]];
+                }
+            } else {
+                const uint8_t *sp = buf; // pixels are stored blue, green, red
+                for(int x = 0; x < lw; x++, sp += 3) {
+                    px[x] = rgb555_lut[RGB555_INDEX(sp[2], sp[1], sp[0])];
+                }
+            }
+            buf += stride; // next line in the file
+        }
+        if(flip) {
+            px += lw; // flipped, so walk forwards
+        } else {
+            px -= lw; // move back to start of previous line
+        }
+    }
+    src->pos += rle4 ? rle.pos : bmp.dib.image_offset + (size_t)stride * lh;
+
+    *width = lw;
+    *height = lh;
+
+bmp_cleanup:
+    free_s(line);
+    return rval;
+}
+
+/// @brief loads the BMP image from a file, as load_bmp_mem(). the file is memory mapped where possible so the image is read
+///        straight from the page cache
+/// @param dst pointer to a memstream buffer struct, as load_bmp_mem()
+/// @param fn name of file to load
+/// @param width  pointer to width of the image in pixels set on return
+/// @param height pointer to height of the image in pixels or lines set on return
+/// @return  0 on success, otherwise an error code
+int load_bmp(memstream_buf_t *dst, const char *fn, uint16_t *width, uint16_t *height) {
+    mapped_file_t mf;
+
+    // do some basic error checking on the inputs
+    if((NULL == fn) || (NULL == dst) || (NULL == width) || (NULL == height)) {
+        return -1;  // NULL pointer error
+    }
+
+    int rval = map_file(&mf, fn);
+    if(rval) return rval;
+    rval = load_bmp_mem(dst, &mf.buf, width, height);
+    unmap_file(&mf);
+    return rval;
+}
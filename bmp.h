@@ -6,6 +6,8 @@
  * personally or commercially, just give credit if you do.
  */
 #include <stdint.h>
+#include <stdio.h>
+#include "memstream.h"
 
 #ifndef IMG_BMP
 #define IMG_BMP
@@ -26,6 +28,8 @@ typedef struct {
 	uint32_t  image_offset;  // File offset to image raster data
 } dib_header_t;
 
+#define BMP_BI_RGB  (0) // uncompressed
+#define BMP_BI_RLE4 (2) // 4 bit run length encoded
 #define BMP72DPI (2835) // 72 DPI converted to PPM
 #define BMP96DPI (3780) // 96 DPI converted to PPM
 typedef struct {
@@ -34,7 +38,7 @@ typedef struct {
 	int32_t   image_height;      // bitmap height (can be -ive to flip scan order)
 	uint16_t  num_planes;        // Number of planes (must be 1)
 	uint16_t  bits_per_pixel;    // 1,4,8,18,24 (some versions support 2 and 32)
-	uint32_t  compression;       // 0 = uncompressed
+	uint32_t  compression;       // 0 = uncompressed, 2 = RLE4
 	uint32_t  bitmap_size;       // Size of image or can be left at 0
 	uint32_t  horiz_res;         // horizontal Pixels per meter (PPM)
 	uint32_t  vert_res;          // vertical pixels per meter (PPM)
@@ -47,4 +51,29 @@ typedef struct {
     bmi_header_t bmi;
 } bmp_header_t;
 
+// stride is the bytes per line in the BMP file, which are padded
+// out to 32 bit boundaries. we get 2 pixels per byte for being 16 colour
+#define BMP4STRIDE(W) ((((uint32_t)(W) + 3) & (~0x0003)) / 2)
+
+// a run of identical packed bytes, as described by the codes of a BI_RLE4 line
+typedef struct {
+    uint16_t    pos;         // offset of the first byte in the line
+    uint16_t    len;         // number of bytes
+} bmp_run_t;
+
+// size of the signature, headers and 16 colour palette at the start of the file
+#define BMP_HDR_SZ (sizeof(bmp_signature_t) + sizeof(bmp_header_t) + 16 * sizeof(bmp_palette_entry_t))
+
+void make_bmp_header(uint8_t *dst, uint16_t width, uint16_t height, const bmp_palette_entry_t *pal);
+void make_bmp_rle4_header(uint8_t *dst, uint16_t width, uint16_t height, const bmp_palette_entry_t *pal, size_t len);
+int write_bmp_header(FILE *fp, uint16_t width, uint16_t height, const bmp_palette_entry_t *pal);
+int save_bmp(const char *fn, memstream_buf_t *src, uint16_t width, uint16_t height, const bmp_palette_entry_t *pal);
+int save_bmp_packed(const char *fn, memstream_buf_t *src, uint16_t width, uint16_t height, const bmp_palette_entry_t *pal);
+int save_bmp_rle4(const char *fn, memstream_buf_t *src, uint16_t width, uint16_t height, const bmp_palette_entry_t *pal);
+int read_rle4_line(uint8_t *line, memstream_buf_t *src, uint16_t width, bmp_run_t *runs, size_t *nruns);
+int find_bmp_rle4(memstream_buf_t *src, memstream_buf_t *rle, uint16_t *width, uint16_t *height);
+int read_bmp_size(const memstream_buf_t *src, uint16_t *width, uint16_t *height);
+int load_bmp_mem(memstream_buf_t *dst, memstream_buf_t *src, uint16_t *width, uint16_t *height);
+int load_bmp(memstream_buf_t *dst, const char *fn, uint16_t *width, uint16_t *height);
+
 #endif
@@ -1,6 +1,6 @@
 /*
- * ega2bmp.c 
- * Converts a given EA-EGA image to a Windows BMP image
+ * bmp2ega.c 
+ * Converts a given Windows BMP image to an EA-EGA image
  *  
  * This code is offered without warranty under the MIT License. Use it as you will 
  * personally or commercially, just give credit if you do.
@@ -13,376 +13,598 @@
 #include <string.h>
 #include <ctype.h>
 #include "bmp.h"
+#include "eaega.h"
+#include "util.h"
+#include "thread.h"
+#include "batch.h"
+#include "cache.h"
+#include "stats.h"
+#include "archive.h"
+#include "server.h"
 
 #define OUTEXT ".EGA"
+#define INEXT ".BMP"
 
+// progress messages are left out in batch mode, where the files are converted side by side
+static bool quiet = false;
+#define INFO(...) do { if(!quiet) fprintf(stderr, __VA_ARGS__); } while(0)
+
+// settings from the command line
+typedef struct {
+    int         threads;     // number of threads to encode with
+    bool        index;       // also write a .EGX scanline index
+    bool        optimal;     // encode each scanline in the fewest bytes, rather than greedily
+    bool        verify;      // decode each image again and check it against the source, writing nothing
+    bool        batch;       // convert every file named on the command line
+    const char  *cache;      // name of the file caching encoded lines and files, NULL for none
+    stats_mode_t stats;      // print the timings and compression figures for each file
+    const char  *list;       // name of a file listing the files to convert in batch mode
+    const char  *out_dir;    // directory for the output files in batch mode
+    const char  *archive;    // archive to pack the output files in to in batch mode, NULL to write them
+    int         workers;     // number of files to convert at once in batch mode
+    int         ahead;       // number of files to read ahead of the workers, -1 for twice the workers
+    const char  *serve;      // socket to answer conversion requests on, NULL to convert the files given
+} options_t;
+
+// a conversion's buffers, kept from one file to the next in batch mode
 typedef struct {
-    size_t      len;         // length of buffer in bytes
-    size_t      pos;         // current byte position in buffer
-    uint8_t     *data;       // pointer to bytes in memory
-} memstream_buf_t;
-
-// default EGA/VGA 16 colour palette
-static bmp_palette_entry_t ega_pal[16] = { 
-  {0x00,0x00,0x00,0x00}, {0xaa,0x00,0x00,0x00}, {0x00,0xaa,0x00,0x00}, {0xaa,0xaa,0x00,0x00}, 
-  {0x00,0x00,0xaa,0x00}, {0xaa,0x00,0xaa,0x00}, {0x00,0x55,0xaa,0x00}, {0xaa,0xaa,0xaa,0x00},
-  {0x55,0x55,0x55,0x00}, {0xff,0x55,0x55,0x00}, {0x55,0xff,0x55,0x00}, {0xff,0xff,0x55,0x00}, 
-  {0x55,0x55,0xff,0x00}, {0xff,0x55,0xff,0x00}, {0x55,0xff,0xff,0x00}, {0xff,0xff,0xff,0x00},
-};
-
-size_t filesize(FILE *f);
-void drop_extension(char *fn);
-char *filename(char *path);
-#define fclose_s(A) if(A) fclose(A); A=NULL
-#define free_s(A) if(A) free(A); A=NULL
-int load_bmp(memstream_buf_t *dst, const char *fn, uint16_t *width, uint16_t *height);
-int find_run(uint8_t *buf, uint8_t len, int *pos);
+    const options_t *opt;    // settings from the command line
+    arena_t     arena;       // every buffer of a conversion is carved out of this
+    ega_cache_t *cache;      // shared by all the workers, NULL if there isn't one
+    egr_builder_t *archive;  // collects the output files, shared by all the workers, NULL to write them
+    size_t      in_bytes;    // size of the last file read
+    size_t      out_bytes;   // size of the last file written
+    serve_req_t *req;        // the server request whose image is being converted, NULL to write a file
+} work_t;
+
+/// @brief prints the command line help
+/// @param prog name of the program
+static void usage(char *prog) {
+    printf("USAGE: %s [options] [infile] <outfile>\n", prog);
+    printf("       %s [options] --batch [files or directories...]\n", prog);
+    printf("       %s [options] --serve SOCKET\n", prog);
+    printf("[infile] is the name of the input file\n");
+    printf("<outfile> is optional and the name of the output file\n");
+    printf("either can be '-' for the standard input or output, which outfile defaults to if infile is '-'\n");
+    printf("if omitted, outfile will be named the same as infile with a '%s' extension\n", OUTEXT);
+    printf("options:\n");
+    printf("  -j N     encode the scanlines on N threads, 0 for one per cpu\n");
+    printf("  --index  also write a '%s' scanline index next to the output file\n", EGX_EXT);
+    printf("  --optimal  encode each scanline in the fewest bytes possible, slower, single threaded\n");
+    printf("  --verify  write nothing, decode each image again in memory and check it matches the\n");
+    printf("               source pixels, reporting the first line that doesn't\n");
+    printf("               it can't be combined with --index or --archive, and a --cache is only read from\n");
+    printf("  --cache FILE  keep the encoded scanlines and files in FILE, lines that were encoded\n");
+    printf("               before are reused and files whose output is up to date are skipped\n");
+    printf("               it can't be combined with --optimal, and files aren't skipped with --index\n");
+    printf("  --stats[=json]  print how long each part of the conversion took, the sizes, and how\n");
+    printf("               often each length of run and literal was used, to stderr as text or JSON\n");
+    printf("  --batch  convert every file given, the '%s' files of any directory given\n", INEXT);
+    printf("  --list FILE  in batch mode, also convert the files named in FILE, one per line\n");
+    printf("  --out DIR    in batch mode, write the output files to DIR rather than next to the input\n");
+    printf("  --archive FILE  in batch mode, pack the output files in to the '%s' archive FILE rather\n", EGR_EXT);
+    printf("               than writing them, with --index their scanline indexes too\n");
+    printf("  --workers N  in batch mode, convert N files at once, 0 for one per cpu\n");
+    printf("  --ahead N    in batch mode, read N files ahead of the workers, 0 to read each as it's converted\n");
+    printf("  --serve SOCKET  answer conversion requests on the Unix domain socket SOCKET until\n");
+    printf("               interrupted, --workers N of them at once, with the other options as given\n");
+    printf("               it can't be combined with --index, --batch or --archive\n");
+}
 
-int main(int argc, char *argv[]) {
+// space write_index() needs in the arena
+#define INDEX_SIZE(H) (ARENA_SIZE((H) * sizeof(uint32_t)) + ARENA_SIZE(egx_size(H)))
+
+/// @brief writes the .EGX scanline index for a freshly encoded image
+/// @param fo_name name of the EGA file, the index is named after it
+/// @param enc memstream buffer holding the encoded file, pos is its length
+/// @param width  width of the image in pixels
+/// @param height height of the image in pixels or lines
+/// @param arena the index and offsets are carved out of this, it must have INDEX_SIZE(height) bytes left
+/// @return 0 on success, otherwise an error code
+static int write_index(const char *fo_name, memstream_buf_t *enc, uint16_t width, uint16_t height, arena_t *arena) {
     int rval = -1;
-    FILE *fo = NULL;
-    char *fi_name = NULL;
-    char *fo_name = NULL;
-    memstream_buf_t img = {0, 0, NULL}; // source image
-    memstream_buf_t dst = {0, 0, NULL}; // encoded image data
-    uint16_t width = 0;
-    uint16_t height = 0;
-
-    printf("BMP image to Electronic Arts EGA image format converter\n");
+    char *fx_name = NULL;
+    uint32_t *offsets = NULL;
+    memstream_buf_t egx = {0, 0, NULL};
+
+    if((NULL == (fx_name = change_extension(fo_name, EGX_EXT))) ||
+       (NULL == (offsets = arena_alloc(arena, height * sizeof(uint32_t)))) ||
+       arena_buf(arena, &egx, egx_size(height))) {
+        fprintf(stderr, "Unable to allocate memory\n");
+        goto CLEANUP;
+    }
 
-    if((argc < 2) || (argc > 3)) {
-        printf("USAGE: %s [infile] <outfile>\n", filename(argv[0]));
-        printf("[infile] is the name of the input file\n");
-        printf("<outfile> is optional and the name of the output file\n");
-        printf("if omitted, outfile will be named the same as infile with a '%s' extension\n", OUTEXT);
-        return -1;
+    // the codes were only just written, so walking them again is cheap
+    memstream_buf_t ms = {enc->pos, EGA_HDR_SZ, enc->data};
+    if(ega_index_lines(&ms, width, height, offsets) || 
+       egx_write(&egx, width, height, enc->pos, offsets)) {
+        fprintf(stderr, "Unable to index image\n");
+        goto CLEANUP;
     }
-    argv++; argc--; // consume the first arg (program name)
 
-    // get the filename strings from command line
-    int namelen = strlen(argv[0]);
-    if(NULL == (fi_name = calloc(1, namelen+1))) {
-        printf("Unable to allocate memory\n");
+    INFO("Creating index File: '%s'\n", fx_name);
+    if(write_file(fx_name, egx.data, egx.pos)) {
+        fprintf(stderr, "Error Unable write file\n");
         goto CLEANUP;
     }
-    strncpy(fi_name, argv[0], namelen);
-    argv++; argc--; // consume the arg (input file)
 
-    if(argc) { // output file name was provided
-        int namelen = strlen(argv[0]);
-        if(NULL == (fo_name = calloc(1, namelen+1))) {
-            printf("Unable to allocate memory\n");
-            goto CLEANUP;
-        }
-        strncpy(fo_name, argv[0], namelen);
-        argv++; argc--; // consume the arg (input file)
-    } else { // no name was provded, so make one
-        if(NULL == (fo_name = calloc(1, namelen+5))) {
-            printf("Unable to allocate memory\n");
-            goto CLEANUP;
-        }
-        strncpy(fo_name, fi_name, namelen);
-        drop_extension(fo_name); // remove exisiting extension
-        strncat(fo_name, OUTEXT, namelen+4); // add bmp extension
+    rval = 0;
+CLEANUP:
+    free_s(fx_name);
+    return rval;
+}
+
+// space verify() needs in the arena
+#define VERIFY_SIZE(W, H) (ARENA_SIZE(ega_decode_packed_size(EGA_LINE_BYTES(W), H)) + ARENA_SIZE(W))
+
+/// @brief decodes a freshly encoded image in memory, the way ega2bmp does, and checks it 
+///        against the source pixels, the first line that differs is reported
+/// @param fi_name name of the BMP file, for the report
+/// @param enc memstream buffer holding the encoded file, pos is its length
+/// @param pix the source image, 1 byte per pixel, top line first
+/// @param width  width of the image in pixels
+/// @param height height of the image in pixels or lines
+/// @param arena the decoded image is carved out of this, it must have VERIFY_SIZE() bytes left
+/// @return 0 if the image matches, otherwise an error code
+static int verify(const char *fi_name, const memstream_buf_t *enc, const uint8_t *pix, 
+                  uint16_t width, uint16_t height, arena_t *arena) {
+    memstream_buf_t dec = {0, 0, NULL};
+    uint8_t *line = NULL;
+    size_t nbytes = EGA_LINE_BYTES(width);
+    if(arena_buf(arena, &dec, ega_decode_packed_size(nbytes, height)) ||
+       (NULL == (line = arena_alloc(arena, width)))) {
+        fprintf(stderr, "Unable to allocate memory\n");
+        return -5;
     }
 
-    if(load_bmp(&img, fi_name, &width, &height)) {
-            printf("Unable to read BMP image\n");
-            goto CLEANUP;
+    uint16_t w, h;
+    memstream_buf_t ms = {enc->pos, 0, enc->data};
+    if(ega_read_header(&ms, &w, &h) || (w != width) || (h != height)) {
+        fprintf(stderr, "Error: '%s' was encoded with the wrong size\n", fi_name);
+        return -4;
+    }
+    int err = ega_decode_packed(&dec, &ms, width, height, nbytes);
+    if(err) {
+        fprintf(stderr, "Error: '%s' doesn't decode (error %d)\n", fi_name, err);
+        return -4;
     }
+    if(ms.pos != enc->pos) {
+        fprintf(stderr, "Error: '%s' has %zu bytes left over after its last line\n", fi_name, enc->pos - ms.pos);
+        return -4;
+    }
+
+    // the decoded lines are bottom line first, the source top line first
+    for(int i = 0; i < height; i++) {
+        int y = height - 1 - i;
+        const uint8_t *sp = &pix[(size_t)y * width];
+        ega_unpack_line(line, &dec.data[i * nbytes], width);
+        if(memcmp(line, sp, width)) {
+            int x = 0;
+            while(line[x] == sp[x]) x++;
+            fprintf(stderr, "Error: '%s' doesn't round trip, line %d (from the top) first differs at pixel %d, "
+                    "%d decoded where the source has %d\n", fi_name, y, x, line[x], sp[x]);
+            return -4;
+        }
+    }
+    return 0;
+}
 
-    // Allocate a destination buffer, use same size as image, it should never be bigger
-    // espcially since the data is packed 2 to a byte
-    dst.len = width * height;
-    if(NULL == (dst.data = calloc(dst.len, 1))) {
-        printf("Unable to allocate memory\n");
+/// @brief converts a BMP file to an EGA file
+/// @param ctx the work_t for the conversion, buffers and settings
+/// @param fi_name name of the BMP file to read
+/// @param fi_data contents of the BMP file if the batch read it ahead, otherwise NULL
+/// @param fo_name name of the EGA file to create
+/// @param in_bytes set to the size of the file read
+/// @param out_bytes set to the size of the file written
+/// @return 0 on success, otherwise an error code
+static int convert(void *ctx, const char *fi_name, memstream_buf_t *fi_data, const char *fo_name, 
+                   size_t *in_bytes, size_t *out_bytes) {
+    int rval = -1;
+    work_t *work = ctx;
+    const options_t *opt = work->opt;
+    mapped_file_t mf = {{0, 0, NULL}, false};
+    memstream_buf_t img = {0, 0, NULL}; // source image, or the runs of a BI_RLE4 line
+    memstream_buf_t rle = {0, 0, NULL}; // BI_RLE4 data of the source image, if it has it
+    memstream_buf_t dst = {0, 0, NULL}; // encoded image data
+    uint16_t width = 0;
+    uint16_t height = 0;
+    conv_stats_t st;
+    *in_bytes = 0;
+    *out_bytes = 0;
+    stats_start(&st, fi_name);
+
+    // a file the batch has already read in is used as it is, otherwise it is mapped
+    if(NULL != fi_data) {
+        mf.buf = *fi_data;
+    } else if(map_file(&mf, fi_name)) {
+        fprintf(stderr, "Unable to read BMP image\n");
         goto CLEANUP;
     }
 
-    // line based RLE compression here, but stored bottom to top
-    // first add our image size prefix to the output stream
-    int16_t *par = (int16_t *)dst.data;
-    *par++ = (width - 1);
-    *par = (height - 1);
-    dst.pos += 2 * sizeof(int16_t);
-
-    // pack the source pixels
-    uint8_t *sp, *dp;
-    sp = img.data;
-    dp = img.data;
-    for(size_t i = 0; i < img.len; i+=2) {
-        uint8_t px = *sp++;
-        px <<= 4;
-        px |= ((*sp++) & 0x0f);
-        *dp++ = px;
-    }
-    // our width is 1/2 because we are packed 2 pixels per byte now
-    width /= 2; 
-
-    // image is stored from bottom scanline to top
-    // so start by pointing to the beginning of the last line.
-    uint8_t *src = &img.data[(height-1) * width];
-
-    for(int y = 0; y < height; y++) {
-        for(int x = 0; x < width;) {
-            int rpos = 0;
-            int len = find_run(src, width - x, &rpos);
-
-            if(rpos) { // we have bytes to copy before the found run (or we have no run)
-                int clen = rpos;
-                while(clen > 128) { // we have a run longer than the maximal encode length
-                    dst.data[dst.pos++] = 127;     // max copy length (encoded as len-1)
-                    for(int i = 0; i < 128; i++) { // copy the data
-                        dst.data[dst.pos++] = *src++;
-                    }
-                    clen -= 128;
-                }
-                dst.data[dst.pos++] = clen - 1; // copy length (encoded as len-1)
-                for(int i = 0; i < clen; i++) { // copy the data
-                    dst.data[dst.pos++] = *src++;
-                }
-                x += rpos; // adjust our position in the line
-            }
-            if(len) { // we found a run-length to encode
-                int rlen = len;
-                while(rlen > 130) {
-                    dst.data[dst.pos++] = 127 + 0x80; // max run length (encoded as len-3) + flag
-                    dst.data[dst.pos++] = *src;       // value of byte to be replicated
-                    rlen -= 130;
-                }
-                dst.data[dst.pos++] = (rlen - 3) + 0x80; // run length (encoded as len-3) + flag
-                dst.data[dst.pos++] = *src;              // value of byte to be replicated
-                x += len;   // adjust our position in the line
-                src += len; // advance our pointer as well
-            }
+    // a file that was converted to the same output before, which hasn't been touched since, is skipped
+    uint64_t key = 0;
+    bool cache_file = work->cache && !is_stdio(fo_name) && !opt->index && !work->archive && !opt->verify;
+    if(cache_file) {
+        key = cache_file_key(&mf.buf, fo_name);
+        if(cache_file_unchanged(work->cache, key, fo_name)) {
+            INFO("Unchanged EGA File: '%s'\n", fo_name);
+            *in_bytes = mf.buf.len;
+            rval = 0;
+            goto CLEANUP;
         }
-        src -= (2 * width); // advance to the start of the previous scanline
+    }
+    stats_phase(&st, PHASE_READ);
+
+    // a BI_RLE4 image already has its runs marked out, so they can be passed
+    // straight through rather than the image being decoded and searched
+    // the optimal encoder picks its own code boundaries, and the cache works on whole lines, 
+    // so both always work from the decoded image
+    int err = (opt->optimal || work->cache) ? -7 : find_bmp_rle4(&mf.buf, &rle, &width, &height);
+    bool rle4 = (0 == err);
+    if(-7 == err) {
+        err = read_bmp_size(&mf.buf, &width, &height);
+    }
+    if(err) {
+        fprintf(stderr, "Unable to read BMP image\n");
+        goto CLEANUP;
     }
 
-    // create/open the output file
-    printf("Creating EGA File: '%s'\n", fo_name);
-    if(NULL == (fo = fopen(fo_name,"wb"))) {
-        printf("Error: Unable to open output file\n");
+    // the header gives the size of everything, so the buffers are all carved out of the one 
+    // block, which is only reallocated when a larger image comes along
+    size_t dst_sz = ega_encode_bound(width, height);
+    size_t img_sz = rle4 ? EGA_LINE_BYTES(width) * sizeof(bmp_run_t) : (size_t)width * height;
+    size_t scratch_sz = opt->optimal ? ega_optimal_scratch_size(width) : 0;
+    size_t pix_sz = (opt->verify && rle4) ? (size_t)width * height : 0; // the source pixels, to verify against
+    size_t need = ARENA_SIZE(dst_sz) + ARENA_SIZE(img_sz) + ARENA_SIZE(scratch_sz) + (opt->index ? INDEX_SIZE(height) : 0) +
+                  (opt->verify ? VERIFY_SIZE(width, height) + ARENA_SIZE(pix_sz) : 0);
+    void *scratch = NULL;
+    if(arena_reserve(&work->arena, need) ||
+       arena_buf(&work->arena, &dst, dst_sz) ||
+       arena_buf(&work->arena, &img, img_sz) ||
+       (opt->optimal && (NULL == (scratch = arena_alloc(&work->arena, scratch_sz))))) {
+        fprintf(stderr, "Unable to allocate memory\n");
         goto CLEANUP;
     }
-    int nw = fwrite(dst.data, dst.pos, 1, fo);
-    if(1 != nw) {
-        printf("Error Unable write file\n");
+
+    // the image buffer is already large enough, so the loader fills it in place
+    if(!rle4 && load_bmp_mem(&img, &mf.buf, &width, &height)) {
+        fprintf(stderr, "Unable to read BMP image\n");
         goto CLEANUP;
     }
+    stats_phase(&st, PHASE_LOAD);
+
+    if(rle4) {
+        err = ega_encode_rle4(&dst, &rle, width, height, (bmp_run_t *)img.data);
+    } else if(opt->optimal) {
+        err = ega_encode_optimal(&dst, &img, width, height, scratch);
+    } else if(work->cache) {
+        size_t hits = 0;
+        err = cache_encode(work->cache, &dst, &img, width, height, &hits);
+        INFO("Reused %zu of %d scanlines from the cache\n", hits, height);
+    } else {
+        err = ega_encode_mt(&dst, &img, width, height, opt->threads);
+    }
+    if(err) {
+        fprintf(stderr, "Unable to encode image\n");
+        goto CLEANUP;
+    }
+    stats_phase(&st, PHASE_CODE);
+
+    if(opt->verify) {
+        // the BI_RLE4 runs were passed straight through, so the pixels are loaded just to check against
+        memstream_buf_t pix = img;
+        if(rle4) {
+            memstream_buf_t bm = {mf.buf.len, 0, mf.buf.data};
+            if(arena_buf(&work->arena, &pix, pix_sz) || load_bmp_mem(&pix, &bm, &width, &height)) {
+                fprintf(stderr, "Unable to read BMP image\n");
+                goto CLEANUP;
+            }
+        }
+        if(verify(fi_name, &dst, pix.data, width, height, &work->arena)) {
+            goto CLEANUP;
+        }
+        INFO("Verified '%s', all %d lines match\n", fi_name, height);
+    } else if(work->archive) {
+        // the archive holds its own copy, and works out the index itself
+        if(egr_add(work->archive, egr_base_name(fo_name), dst.data, dst.pos, opt->index)) {
+            fprintf(stderr, "Unable to add image to the archive\n");
+            goto CLEANUP;
+        }
+    } else {
+        // create the output file
+        // or, for a server request that carried its image, send it back to the client
+        INFO("Creating EGA File: '%s'\n", fo_name);
+        io_chunk_t chunk = {dst.data, dst.pos};
+        if(work->req ? serve_reply(work->req, &chunk, 1) : write_chunks(fo_name, &chunk, 1)) {
+            fprintf(stderr, "Error Unable write file\n");
+            goto CLEANUP;
+        }
 
-    printf("Done\n");
-    rval = 0; // clean exit
+        if(opt->index && write_index(fo_name, &dst, width, height, &work->arena)) {
+            goto CLEANUP;
+        }
+    }
+    stats_phase(&st, PHASE_WRITE);
+    if(cache_file) {
+        cache_add_file(work->cache, key, &dst);
+    }
+    *in_bytes = mf.buf.len;
+    *out_bytes = opt->verify ? 0 : dst.pos;
+
+    rval = 0;
 CLEANUP:
-    fclose_s(fo);
-    free_s(fi_name);
-    free_s(fo_name);
-    free_s(img.data);
-    free_s(dst.data);
+    if((0 == rval) && opt->stats) {
+        st.width = width;
+        st.height = height;
+        st.in_bytes = *in_bytes;
+        st.out_bytes = *out_bytes;
+        memstream_buf_t enc = {dst.pos, 0, dst.data};
+        if(dst.pos) stats_count_codes(&st, &enc);
+        stats_print(stderr, &st, opt->stats);
+    }
+    if(NULL == fi_data) unmap_file(&mf);
     return rval;
 }
 
-/// @brief determins the size of the file
-/// @param f handle to an open file
-/// @return returns the size of the file
-size_t filesize(FILE *f) {
-    size_t szll, cp;
-    cp = ftell(f);           // save current position
-    fseek(f, 0, SEEK_END);   // find the end
-    szll = ftell(f);         // get positon of the end
-    fseek(f, cp, SEEK_SET);  // restore the file position
-    return szll;             // return position of the end as size
+/// @brief loads the cache file named on the command line, a missing or unreadable one is
+///        started over, so the conversion can always go ahead. under --verify it is only
+///        read from, so checking a set of images leaves the cache file as it was
+/// @param cache the cache to set up
+/// @param opt settings from the command line, naming the cache file
+static void open_cache(ega_cache_t *cache, const options_t *opt) {
+    if(cache_load(cache, opt->cache)) {
+        fprintf(stderr, "Note: Cache file '%s' isn't usable, starting it over\n", opt->cache);
+    }
+    cache->read_only = opt->verify;
 }
 
-/// @brief removes the extension from a filename
-/// @param fn sting pointer to the filename
-void drop_extension(char *fn) {
-    char *extension = strrchr(fn, '.');
-    if(NULL != extension) *extension = 0; // strip out the existing extension
+/// @brief saves and releases the cache
+/// @param cache the cache
+/// @param fn name of the cache file
+/// @return 0 on success, otherwise an error code
+static int close_cache(ega_cache_t *cache, const char *fn) {
+    int rval = cache_save(cache, fn);
+    if(rval) {
+        fprintf(stderr, "Error: Unable to write cache file '%s'\n", fn);
+    }
+    cache_free(cache);
+    return rval;
 }
 
-/// @brief Returns the filename portion of a path
-/// @param path filepath string
-/// @return a pointer to the filename portion of the path string
-char *filename(char *path) {
-	int i;
-
-	if(path == NULL || path[0] == '\0')
-		return "";
-	for(i = strlen(path) - 1; i >= 0 && path[i] != '/'; i--);
-	if(i == -1)
-		return "";
-	return &path[i+1];
+/// @brief answers a single server request, converting the image it carried or the file it named
+/// @param ctx the work_t of the worker answering it
+/// @param req the request
+/// @return 0 on success, otherwise an error code
+static int serve_request(void *ctx, serve_req_t *req) {
+    work_t *work = ctx;
+    size_t in_bytes, out_bytes;
+    if(req->fi_name) {
+        return convert(work, req->fi_name, NULL, req->fo_name, &in_bytes, &out_bytes);
+    }
+    // the image is converted from the request's buffer, and the EGA file goes back the same way
+    work->req = req;
+    int rval = convert(work, STDIO_NAME, &req->data, STDIO_NAME, &in_bytes, &out_bytes);
+    work->req = NULL;
+    return rval;
 }
 
-/// @brief find the next run in the buffer passed in
-/// @param buf pointer to the data
-/// @param len length of the data
-/// @param rpos index of the beginning of the run in the data
-/// @return  length of the run found
-int find_run(uint8_t *buf, uint8_t len, int *rpos) {
-    uint8_t lc = *buf++; // last char to compare to
-    int lp = 0;          // position of "last char"
-    int count = 1;       // lenght of run
-    int pos = 1;         // current position in buffer
-    while(pos < len) {
-        uint8_t cc = *buf++; // current char for comparison
-        // run has ended (or hasn't started yet)
-        if(lc != cc) {
-            // valid runs are >= 3
-            if(3 <= count) {
-                *rpos = lp;   // return the start position of the run
-                return count; // return the length of the run
-            }
-            // wasn't a valid run, so restart from current position
-            lp = pos;
-            count = 1;
-            lc = cc;
-        } else { // in a run
-            count++; // count it
-        }
-        pos++; // advance
+/// @brief answers conversion requests on a Unix domain socket until the server is interrupted,
+///        then saves the cache if there is one
+/// @param opt settings from the command line, applied to every request
+/// @return 0 once the server has shut down, otherwise an error code
+static int serve_files(const options_t *opt) {
+    int rval = -1;
+    int workers = opt->workers;
+    work_t *work = NULL;
+    ega_cache_t cache;
+
+    // each worker keeps its own arena from one request to the next, like a batch
+    if(NULL == (work = calloc(workers, sizeof(work_t)))) {
+        fprintf(stderr, "Unable to allocate memory\n");
+        goto CLEANUP;
     }
-    // return our stop position if we didn't find any runs >= 3
-    if(3 > count) {
-        *rpos = pos; // return our end position
-        return 0;    // return a length of 0 as we don't have a valid run
+    if(opt->cache) open_cache(&cache, opt);
+    for(int i = 0; i < workers; i++) {
+        work[i].opt = opt;
+        work[i].cache = opt->cache ? &cache : NULL;
+    }
+
+    // pick the kernels before the workers start, rather than have them race to on their first call
+    ega_select_kernel(EGA_KERNEL_AUTO);
+    quiet = true;
+    rval = serve_run(opt->serve, workers, serve_request, work, sizeof(work_t));
+    if(opt->cache && close_cache(&cache, opt->cache)) {
+        rval = -1;
+    }
+
+CLEANUP:
+    if(work) {
+        for(int i = 0; i < workers; i++) {
+            arena_free(&work[i].arena);
+        }
     }
-    // return last start position
-    *rpos = lp;   // return the start position of the run
-    return count; // return the length of the run
+    free_s(work);
+    return rval;
 }
 
+/// @brief converts all the files named on the command line, and in the list file if there is one
+/// @param argc number of names left on the command line
+/// @param argv the names, files or directories
+/// @param opt settings from the command line
+/// @return 0 if every file was converted, otherwise an error code
+static int convert_batch(int argc, char *argv[], const options_t *opt) {
+    int rval = -1;
+    name_list_t nl = {NULL, 0, 0};
+    int workers = opt->workers;
+    work_t *work = NULL;
+    ega_cache_t cache;
+    egr_builder_t archive;
+    egr_builder_init(&archive);
+
+    for(int i = 0; i < argc; i++) {
+        if(batch_add_path(&nl, argv[i], INEXT)) {
+            fprintf(stderr, "Error: Unable to read directory '%s'\n", argv[i]);
+            goto CLEANUP;
+        }
+    }
+    if(opt->list && batch_add_list(&nl, opt->list, INEXT)) {
+        fprintf(stderr, "Error: Unable to read list file '%s'\n", opt->list);
+        goto CLEANUP;
+    }
 
+    // each worker keeps its own arena, so it is only reallocated when a larger image comes along
+    if(NULL == (work = calloc(workers, sizeof(work_t)))) {
+        fprintf(stderr, "Unable to allocate memory\n");
+        goto CLEANUP;
+    }
+    if(opt->cache) open_cache(&cache, opt);
+    for(int i = 0; i < workers; i++) {
+        work[i].opt = opt;
+        work[i].cache = opt->cache ? &cache : NULL;
+        work[i].archive = opt->archive ? &archive : NULL;
+    }
 
-/// @brief loads the BMP image from a file, assumes 16 colour image. palette is ignored, assumed to follow 
-///        CGA/EGA/VGA standard palette
-/// @param dst pointer to a empty memstream buffer struct. load_bmp will allocate the buffer, image will be stored as 1 byte per pixel
-/// @param fn name of file to load
-/// @param width  pointer to width of the image in pixels set on return
-/// @param height pointer to height of the image in pixels or lines set on return
-/// @return  0 on success, otherwise an error code
-int load_bmp(memstream_buf_t *dst, const char *fn, uint16_t *width, uint16_t *height) {
-    int rval = 0;
-    FILE *fp = NULL;
-    uint8_t *buf = NULL; // line buffer
-    bmp_header_t *bmp = NULL;
-
-    // do some basic error checking on the inputs
-    if((NULL == fn) || (NULL == dst) || (NULL == width) || (NULL == height)) {
-        rval = -1;  // NULL pointer error
-        goto bmp_cleanup;
-    }
-
-    // try to open input file
-    if(NULL == (fp = fopen(fn,"rb"))) {
-        rval = -2;  // can't open input file
-        goto bmp_cleanup;
-    }
-
-    bmp_signature_t sig = 0;
-    int nr = fread(&sig, sizeof(bmp_signature_t), 1, fp);
-    if(1 != nr) {
-        rval = -3;  // unable to read file
-        goto bmp_cleanup;
-    }
-    if(BMPFILESIG != sig) {
-        rval = -4; // not a BMP file
-        goto bmp_cleanup;
-    }
-
-    // allocate a buffer to hold the header 
-    if(NULL == (bmp = calloc(1, sizeof(bmp_header_t)))) {
-        rval = -5;  // unable to allocate mem
-        goto bmp_cleanup;
-    }
-    nr = fread(bmp, sizeof(bmp_header_t), 1, fp);
-    if(1 != nr) {
-        rval = -3;  // unable to read file
-        goto bmp_cleanup;
-    }
-
-    // check some basic header vitals to make sure it's in a format we can work with
-    if((1 != bmp->bmi.num_planes) || 
-       (sizeof(bmi_header_t) != bmp->bmi.header_size) || 
-       (0 != bmp->dib.RES)) {
-        rval = -6;  // invalid header
-        goto bmp_cleanup;
-    }
-    if((4 != bmp->bmi.bits_per_pixel) || 
-       (16 != bmp->bmi.num_colors) || 
-       (0 != bmp->bmi.compression)) {
-        rval = -7;  // unsupported BMP format
-        goto bmp_cleanup;
-    }
-    
-    // seek to the start of the image data, as we don't use the palette data
-    // we assume the standard CGA/EGA/VGA 16 colour palette
-    fseek(fp, bmp->dib.image_offset, SEEK_SET);
-
-    // check if the destination buffer is null, if not, free it
-    // we will allocate it ourselves momentarily
-    if(NULL != dst->data) {
-        free(dst->data);
-        dst->data = NULL;
-    }
-
-    // if height is negative, flip the render order
-    bool flip = (bmp->bmi.image_height < 0); 
-    bmp->bmi.image_height = abs(bmp->bmi.image_height);
-
-    uint16_t lw = bmp->bmi.image_width;
-    uint16_t lh = bmp->bmi.image_height;
-
-    // stride is the bytes per line in the BMP file, which are padded
-    // we get 2 pixels per byte for being 16 colour
-    uint32_t stride = ((lw + 3) & (~0x0003)) / 2; 
-
-    // allocate our line and output buffers
-    if(NULL == (dst->data = calloc(1, lw * lh))) {
-        rval = -5;  // unable to allocate mem
-        goto bmp_cleanup;
-    }
-    dst->len = lw * lh;
-    dst->pos = 0;
-
-    if(NULL == (buf = calloc(1, stride))) {
-        rval = -5;  // unable to allocate mem
-        goto bmp_cleanup;
-    }
-
-    // now we need to read the image scanlines. 
-    // start by pointing to start of last line of data
-    uint8_t *px = &dst->data[dst->len - lw]; 
-    if(flip) px = dst->data; // if flipped, start at beginning
-    // loop through the lines
-    for(int y = 0; y < lh; y++) {
-        nr = fread(buf, stride, 1, fp); // read a line
-        if(1 != nr) {
-            rval = -3;  // unable to read file
-            goto bmp_cleanup;
+    // pick the kernels before the workers start, rather than have them race to on their first call
+    ega_select_kernel(EGA_KERNEL_AUTO);
+    quiet = true;
+    int ahead = (opt->ahead < 0) ? workers * 2 : opt->ahead;
+    if(0 == batch_run(&nl, opt->out_dir, OUTEXT, workers, ahead, convert, work, sizeof(work_t))) {
+        rval = 0;
+    }
+    if(opt->cache && close_cache(&cache, opt->cache)) {
+        rval = -1;
+    }
+    // a batch with failures still writes out what it could convert, as it would the files
+    if(opt->archive) {
+        if(egr_save(&archive, opt->archive)) {
+            fprintf(stderr, "Error: Unable to write archive '%s'\n", opt->archive);
+            rval = -1;
+        } else {
+            fprintf(stderr, "Packed %zu files in to '%s'\n", archive.count, opt->archive);
         }
+    }
 
-        // loop through all the pixels for a line
-        // we are packing 2 pixels per byte, so width is half
-        for(int x = 0; x < ((lw + 1) / 2); x++) {
-            uint8_t sp = buf[x];      // get the pixel pair
-            *px++ = (sp >> 4) & 0x0f; // write the 1st pixel
-            if((x * 2 + 1) < lw) {    // test for odd pixel end
-                *px++ = sp & 0x0f;    // write the 2nd pixel
-            }
+CLEANUP:
+    if(work) {
+        for(int i = 0; i < workers; i++) {
+            arena_free(&work[i].arena);
         }
-        if(!flip) { // if not flipped, wehave to walk backwards
-            px -= (lw * 2); // move back to start of previous line
+    }
+    free_s(work);
+    egr_builder_free(&archive);
+    batch_free(&nl);
+    return rval;
+}
+
+int main(int argc, char *argv[]) {
+    int rval = -1;
+    const char *fi_name = NULL;
+    const char *fo_name = NULL;
+    char *made_name = NULL; // output name made from the input name, if it wasn't given
+    options_t opt = {1, false, false, false, false, NULL, STATS_NONE, NULL, NULL, NULL, 1, -1, NULL};
+
+    fprintf(stderr, "BMP image to Electronic Arts EGA image format converter\n");
+
+    char *prog = filename(argv[0]);
+    argv++; argc--; // consume the first arg (program name)
+
+    // options come ahead of the file names
+    while(argc && ('-' == argv[0][0]) && !is_stdio(argv[0])) { // a lone '-' is a file name
+        if((0 == strcmp(argv[0], "-j")) && (argc > 1)) {
+            argv++; argc--; // consume the option, leaving its value
+            opt.threads = atoi(argv[0]);
+            if(opt.threads <= 0) opt.threads = cpu_count();
+        } else if(0 == strcmp(argv[0], "--index")) {
+            opt.index = true;
+        } else if(0 == strcmp(argv[0], "--optimal")) {
+            opt.optimal = true;
+        } else if(0 == strcmp(argv[0], "--verify")) {
+            opt.verify = true;
+        } else if((0 == strcmp(argv[0], "--cache")) && (argc > 1)) {
+            argv++; argc--; // consume the option, leaving its value
+            opt.cache = argv[0];
+        } else if(0 == strcmp(argv[0], "--stats")) {
+            opt.stats = STATS_TEXT;
+        } else if(0 == strcmp(argv[0], "--stats=json")) {
+            opt.stats = STATS_JSON;
+        } else if(0 == strcmp(argv[0], "--batch")) {
+            opt.batch = true;
+        } else if((0 == strcmp(argv[0], "--list")) && (argc > 1)) {
+            argv++; argc--; // consume the option, leaving its value
+            opt.list = argv[0];
+        } else if((0 == strcmp(argv[0], "--out")) && (argc > 1)) {
+            argv++; argc--; // consume the option, leaving its value
+            opt.out_dir = argv[0];
+        } else if((0 == strcmp(argv[0], "--archive")) && (argc > 1)) {
+            argv++; argc--; // consume the option, leaving its value
+            opt.archive = argv[0];
+        } else if((0 == strcmp(argv[0], "--serve")) && (argc > 1)) {
+            argv++; argc--; // consume the option, leaving its value
+            opt.serve = argv[0];
+        } else if((0 == strcmp(argv[0], "--workers")) && (argc > 1)) {
+            argv++; argc--; // consume the option, leaving its value
+            opt.workers = atoi(argv[0]);
+            if(opt.workers <= 0) opt.workers = cpu_count();
+        } else if((0 == strcmp(argv[0], "--ahead")) && (argc > 1)) {
+            argv++; argc--; // consume the option, leaving its value
+            opt.ahead = atoi(argv[0]);
+        } else {
+            usage(prog);
+            return -1;
         }
+        argv++; argc--; // consume the option
     }
 
-    *width = lw;
-    *height = lh;
+    if((opt.optimal && opt.cache) || (opt.archive && !opt.batch) || (opt.verify && (opt.index || opt.archive))) {
+        usage(prog);
+        return -1;
+    }
+    if(opt.serve) {
+        if(opt.index || opt.batch || (argc > 0)) {
+            usage(prog);
+            return -1;
+        }
+        return serve_files(&opt);
+    }
+    if(opt.batch ? ((argc < 1) && (NULL == opt.list)) : ((argc < 1) || (argc > 2))) {
+        usage(prog);
+        return -1;
+    }
+
+    if(opt.batch) {
+        return convert_batch(argc, argv, &opt);
+    }
+
+    // the input name is used as given, the output name is made from it if there isn't one
+    // "-" reads from the standard input, and unless another name is given, writes to the standard output
+    fi_name = argv[0];
+    argv++; argc--; // consume the arg (input file)
+    if(argc) { // output file name was provided
+        fo_name = argv[0];
+        argv++; argc--; // consume the arg (output file)
+    } else if(is_stdio(fi_name)) {
+        fo_name = STDIO_NAME;
+    } else if(NULL == (fo_name = made_name = change_extension(fi_name, OUTEXT))) {
+        fprintf(stderr, "Unable to allocate memory\n");
+        goto CLEANUP;
+    }
+    if(opt.index && is_stdio(fo_name)) {
+        fprintf(stderr, "Error: --index needs a named output file, the index is named after it\n");
+        goto CLEANUP;
+    }
 
-bmp_cleanup:
-    fclose_s(fp);
-    free_s(buf);
-    free_s(bmp);
+    ega_cache_t cache;
+    work_t work = {&opt, {NULL, 0, 0}, opt.cache ? &cache : NULL, NULL, 0, 0, NULL};
+    if(opt.cache) open_cache(&cache, &opt);
+    size_t in_bytes, out_bytes;
+    int err = convert(&work, fi_name, NULL, fo_name, &in_bytes, &out_bytes);
+    arena_free(&work.arena);
+    if(opt.cache && close_cache(&cache, opt.cache)) err = -1;
+    if(err) goto CLEANUP;
+
+    fprintf(stderr, "Done\n");
+    rval = 0; // clean exit
+CLEANUP:
+    free_s(made_name);
     return rval;
 }
@@ -0,0 +1,460 @@
+/*
+ * cache.c
+ * an on disk cache of encoded scanlines and whole files, so re-encoding a set of
+ * images only does the work for what has changed since the last run
+ *
+ * This code is offered without warranty under the MIT License. Use it as you will
+ * personally or commercially, just give credit if you do.
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include "cache.h"
+#include "eaega.h"
+#include "util.h"
+
+// the cache file is a header, then the file records, the line records and the codes
+// signature, version, file count, line count and code bytes, all 32 bit little endian
+#define CACHE_HDR_SZ (20)
+#define CACHE_FILE_SZ (20)           // key, hash of the output and its length
+#define CACHE_LINE_SZ (16)           // key, offset and length of the codes
+#define CACHE_MIN_SLOTS (1024)       // slots in a table to start with
+
+static inline uint32_t get_le32(const uint8_t *p) { return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24); }
+static inline uint64_t get_le64(const uint8_t *p) { return get_le32(p) | ((uint64_t)get_le32(&p[4]) << 32); }
+static inline void put_le32(uint8_t *p, uint32_t v) { p[0] = v & 0xff; p[1] = (v >> 8) & 0xff; p[2] = (v >> 16) & 0xff; p[3] = v >> 24; }
+static inline void put_le64(uint8_t *p, uint64_t v) { put_le32(p, v & 0xffffffff); put_le32(&p[4], v >> 32); }
+
+/// @brief finds the slot a line belongs in, the one holding it or the empty one it would go in
+/// @param c pointer to the cache, the line table must have at least one empty slot
+/// @param key hash of the line
+/// @return pointer to the slot
+static cache_line_t *line_slot(ega_cache_t *c, uint64_t key) {
+    size_t mask = c->line_cap - 1;
+    size_t i = key & mask;
+    while(c->lines[i].key && (c->lines[i].key != key)) i = (i + 1) & mask;
+    return &c->lines[i];
+}
+
+/// @brief works out the key a packed line is cached under
+/// @param line the packed line
+/// @param nbytes length of the line in bytes
+/// @return the key, never 0
+static uint64_t line_key(const uint8_t *line, size_t nbytes) {
+    uint64_t key = hash64(line, nbytes, nbytes); // the codes depend on the line length too
+    return key ? key : 1;
+}
+
+/// @brief finds the slot a file belongs in, as line_slot()
+static cache_file_t *file_slot(ega_cache_t *c, uint64_t key) {
+    size_t mask = c->file_cap - 1;
+    size_t i = key & mask;
+    while(c->files[i].key && (c->files[i].key != key)) i = (i + 1) & mask;
+    return &c->files[i];
+}
+
+/// @brief doubles the number of slots in the line table, the table is kept at most half full
+/// @param c pointer to the cache
+/// @return 0 on success, otherwise an error code
+static int grow_lines(ega_cache_t *c) {
+    cache_line_t *old = c->lines;
+    size_t old_cap = c->line_cap;
+    size_t cap = old_cap ? old_cap * 2 : CACHE_MIN_SLOTS;
+    if(NULL == (c->lines = calloc(cap, sizeof(cache_line_t)))) {
+        c->lines = old;
+        return -5; // unable to allocate
+    }
+    c->line_cap = cap;
+    for(size_t i = 0; i < old_cap; i++) {
+        if(old[i].key) *line_slot(c, old[i].key) = old[i];
+    }
+    free_s(old);
+    return 0;
+}
+
+/// @brief doubles the number of slots in the file table, as grow_lines()
+static int grow_files(ega_cache_t *c) {
+    cache_file_t *old = c->files;
+    size_t old_cap = c->file_cap;
+    size_t cap = old_cap ? old_cap * 2 : CACHE_MIN_SLOTS;
+    if(NULL == (c->files = calloc(cap, sizeof(cache_file_t)))) {
+        c->files = old;
+        return -5; // unable to allocate
+    }
+    c->file_cap = cap;
+    for(size_t i = 0; i < old_cap; i++) {
+        if(old[i].key) *file_slot(c, old[i].key) = old[i];
+    }
+    free_s(old);
+    return 0;
+}
+
+/// @brief adds the codes of a line to the cache, replacing any with the same key
+/// @param c pointer to the cache, the caller holds the lock
+/// @param key hash of the line
+/// @param codes the line's codes
+/// @param len length of the codes in bytes
+/// @return 0 on success, otherwise an error code
+static int add_line(ega_cache_t *c, uint64_t key, const uint8_t *codes, size_t len) {
+    if(((c->line_count + 1) * 2 > c->line_cap) && grow_lines(c)) {
+        return -5; // unable to allocate
+    }
+    if((c->codes_cap - c->codes_len) < len) {
+        size_t cap = c->codes_cap ? c->codes_cap : 64 * 1024;
+        while((cap - c->codes_len) < len) cap *= 2;
+        if(cap > UINT32_MAX) return -5;  // offsets are stored as 32 bits
+        uint8_t *p = realloc(c->codes, cap);
+        if(NULL == p) return -5;         // unable to allocate
+        c->codes = p;
+        c->codes_cap = cap;
+    }
+    cache_line_t *slot = line_slot(c, key);
+    if(0 == slot->key) c->line_count++;
+    *slot = (cache_line_t){key, c->codes_len, len, true};
+    memcpy(&c->codes[c->codes_len], codes, len);
+    c->codes_len += len;
+    c->dirty = true;
+    return 0;
+}
+
+/// @brief adds a file to the cache, replacing any with the same key
+/// @param c pointer to the cache, the caller holds the lock
+/// @param rec the file's record, used is set if it was added this run
+/// @return 0 on success, otherwise an error code
+static int add_file(ega_cache_t *c, const cache_file_t *rec) {
+    if(((c->file_count + 1) * 2 > c->file_cap) && grow_files(c)) {
+        return -5; // unable to allocate
+    }
+    cache_file_t *slot = file_slot(c, rec->key);
+    if(0 == slot->key) c->file_count++;
+    *slot = *rec;
+    c->dirty = true;
+    return 0;
+}
+
+/// @brief sets up a cache and reads in what was saved to the cache file by an earlier run.
+///        a cache file that doesn't exist yet leaves the cache empty
+/// @param c pointer to the cache to set up
+/// @param fn name of the cache file
+/// @return 0 on success, -4 if the file isn't a valid cache, the cache is then left empty
+///         but usable, otherwise an error code
+int cache_load(ega_cache_t *c, const char *fn) {
+    if((NULL == c) || (NULL == fn)) {
+        return -1; // NULL pointer error
+    }
+    memset(c, 0, sizeof(ega_cache_t));
+    mutex_init(&c->lock);
+
+    mapped_file_t mf = {{0, 0, NULL}, false};
+    if(map_file(&mf, fn)) {
+        return 0; // nothing cached yet
+    }
+    int rval = -4;
+    const uint8_t *p = mf.buf.data;
+    if((mf.buf.len < CACHE_HDR_SZ) || memcmp(p, CACHE_SIG, 4) || (CACHE_VERSION != get_le32(&p[4]))) {
+        goto CLEANUP; // not a cache file, or one from another version
+    }
+    size_t nfiles = get_le32(&p[8]);
+    size_t nlines = get_le32(&p[12]);
+    size_t ncodes = get_le32(&p[16]);
+    if(mf.buf.len != (CACHE_HDR_SZ + nfiles * CACHE_FILE_SZ + nlines * CACHE_LINE_SZ + ncodes)) {
+        goto CLEANUP; // truncated
+    }
+    const uint8_t *fp = &p[CACHE_HDR_SZ];
+    const uint8_t *lp = &fp[nfiles * CACHE_FILE_SZ];
+    const uint8_t *cp = &lp[nlines * CACHE_LINE_SZ];
+
+    // the codes are taken as a block, then the tables are built over them
+    if(ncodes) {
+        if(NULL == (c->codes = malloc(ncodes))) {
+            rval = -5; // unable to allocate
+            goto CLEANUP;
+        }
+        memcpy(c->codes, cp, ncodes);
+        c->codes_len = c->codes_cap = ncodes;
+    }
+    for(size_t i = 0; i < nfiles; i++, fp += CACHE_FILE_SZ) {
+        cache_file_t rec = {get_le64(fp), get_le64(&fp[8]), get_le32(&fp[16]), false};
+        if(rec.key && add_file(c, &rec)) {
+            rval = -5; // unable to allocate
+            goto CLEANUP;
+        }
+    }
+    for(size_t i = 0; i < nlines; i++, lp += CACHE_LINE_SZ) {
+        cache_line_t rec = {get_le64(lp), get_le32(&lp[8]), get_le32(&lp[12]), false};
+        if((0 == rec.key) || (rec.off > ncodes) || ((ncodes - rec.off) < rec.len)) continue;
+        if(((c->line_count + 1) * 2 > c->line_cap) && grow_lines(c)) {
+            rval = -5; // unable to allocate
+            goto CLEANUP;
+        }
+        cache_line_t *slot = line_slot(c, rec.key);
+        if(0 == slot->key) c->line_count++;
+        *slot = rec;
+    }
+    c->dirty = false;
+    rval = 0;
+
+CLEANUP:
+    unmap_file(&mf);
+    if(rval) {
+        // start over with an empty cache rather than trust any of it
+        free_s(c->lines);
+        free_s(c->files);
+        free_s(c->codes);
+        c->line_cap = c->line_count = c->codes_len = c->codes_cap = 0;
+        c->file_cap = c->file_count = 0;
+    }
+    return rval;
+}
+
+/// @brief writes the cache out to the cache file, keeping only the lines and files this run
+///        used, if anything was added or is to be dropped. it is written to a temporary file
+///        first then renamed over the old one, so a run that is stopped part way through never
+///        leaves a half written cache. a read only cache is never written
+/// @param c pointer to the cache
+/// @param fn name of the cache file
+/// @return 0 on success, otherwise an error code
+int cache_save(ega_cache_t *c, const char *fn) {
+    if((NULL == c) || (NULL == fn)) {
+        return -1; // NULL pointer error
+    }
+    if(c->read_only) {
+        return 0; // left as it was
+    }
+    // only what this run looked up or added is kept, so the file doesn't fill up with the lines
+    // and files of images that have since changed, and the codes are packed up end to end
+    size_t nfiles = 0, nlines = 0, ncodes = 0;
+    for(size_t i = 0; i < c->file_cap; i++) {
+        if(c->files[i].key && c->files[i].used) nfiles++;
+    }
+    for(size_t i = 0; i < c->line_cap; i++) {
+        if(c->lines[i].key && c->lines[i].used) {
+            nlines++;
+            ncodes += c->lines[i].len;
+        }
+    }
+    if(!c->dirty && (nfiles == c->file_count) && (nlines == c->line_count) && (ncodes == c->codes_len)) {
+        return 0; // nothing was added and nothing is to be dropped
+    }
+
+    int rval = -5;
+    size_t len = CACHE_HDR_SZ + nfiles * CACHE_FILE_SZ + nlines * CACHE_LINE_SZ + ncodes;
+    uint8_t *buf = malloc(len);
+    char *tmp_name = malloc(strlen(fn) + 5);
+    if((NULL == buf) || (NULL == tmp_name)) goto CLEANUP;
+
+    uint8_t *p = buf;
+    memcpy(p, CACHE_SIG, 4);
+    put_le32(&p[4], CACHE_VERSION);
+    put_le32(&p[8], nfiles);
+    put_le32(&p[12], nlines);
+    put_le32(&p[16], ncodes);
+    p += CACHE_HDR_SZ;
+    for(size_t i = 0; i < c->file_cap; i++) {
+        const cache_file_t *rec = &c->files[i];
+        if((0 == rec->key) || !rec->used) continue;
+        put_le64(&p[0], rec->key);
+        put_le64(&p[8], rec->out_hash);
+        put_le32(&p[16], rec->out_len);
+        p += CACHE_FILE_SZ;
+    }
+    uint8_t *cp = &p[nlines * CACHE_LINE_SZ];
+    uint32_t off = 0;
+    for(size_t i = 0; i < c->line_cap; i++) {
+        const cache_line_t *rec = &c->lines[i];
+        if((0 == rec->key) || !rec->used) continue;
+        put_le64(&p[0], rec->key);
+        put_le32(&p[8], off);
+        put_le32(&p[12], rec->len);
+        p += CACHE_LINE_SZ;
+        memcpy(&cp[off], &c->codes[rec->off], rec->len);
+        off += rec->len;
+    }
+
+    sprintf(tmp_name, "%s.tmp", fn);
+    rval = -4;
+    if(write_file(tmp_name, buf, len)) goto CLEANUP;
+#ifdef _WIN32
+    remove(fn); // rename won't replace a file that exists
+#endif
+    if(rename(tmp_name, fn)) {
+        remove(tmp_name);
+        goto CLEANUP;
+    }
+    c->dirty = false;
+    rval = 0;
+
+CLEANUP:
+    free_s(buf);
+    free_s(tmp_name);
+    return rval;
+}
+
+/// @brief releases everything held by a cache
+/// @param c pointer to the cache
+void cache_free(ega_cache_t *c) {
+    if(NULL == c) return;
+    free_s(c->lines);
+    free_s(c->files);
+    free_s(c->codes);
+    mutex_destroy(&c->lock);
+}
+
+/// @brief works out the key a conversion is cached under, from the contents of the input
+///        file and the name of the output file
+/// @param src the contents of the input file
+/// @param fo_name name of the output file
+/// @return the key, never 0
+uint64_t cache_file_key(const memstream_buf_t *src, const char *fo_name) {
+    uint64_t key = hash64(fo_name, strlen(fo_name), hash64(src->data, src->len, 0));
+    return key ? key : 1;
+}
+
+/// @brief marks the lines of an EGA file as used, so a file that is skipped as unchanged keeps
+///        them for when it does change. each line is decoded again to find its key
+/// @param c pointer to the cache
+/// @param ega the EGA file
+static void keep_lines(ega_cache_t *c, const memstream_buf_t *ega) {
+    memstream_buf_t ms = *ega;
+    ms.pos = 0;
+    uint16_t width, height;
+    if(ega_read_header(&ms, &width, &height)) return;
+    size_t nbytes = EGA_LINE_BYTES(width);
+    uint8_t line[EGA_MAX_LINE_BYTES];
+    for(int i = 0; i < height; i++) {
+        if(ega_decode_line(line, &ms, width)) return;
+        uint64_t key = line_key(line, nbytes);
+        mutex_lock(&c->lock);
+        if(c->line_cap) {
+            cache_line_t *slot = line_slot(c, key);
+            if(slot->key == key) slot->used = true;
+        }
+        mutex_unlock(&c->lock);
+    }
+}
+
+/// @brief checks whether a conversion can be skipped, because the same input was converted to
+///        the same output name before and the output file is still what was written then
+/// @param c pointer to the cache
+/// @param key the conversion's key, from cache_file_key()
+/// @param fo_name name of the output file
+/// @return true if the output file is up to date, its record and lines are then kept
+bool cache_file_unchanged(ega_cache_t *c, uint64_t key, const char *fo_name) {
+    if((NULL == c) || (NULL == fo_name) || is_stdio(fo_name)) {
+        return false;
+    }
+    mutex_lock(&c->lock);
+    cache_file_t rec = {0, 0, 0, false};
+    if(c->file_cap) {
+        cache_file_t *slot = file_slot(c, key);
+        if(slot->key == key) slot->used = true;
+        rec = *slot;
+    }
+    mutex_unlock(&c->lock);
+    if(rec.key != key) return false;
+
+    // reading the output back is much cheaper than writing it again
+    mapped_file_t mf = {{0, 0, NULL}, false};
+    if(map_file(&mf, fo_name)) return false;
+    bool same = (mf.buf.len == rec.out_len) && (hash64(mf.buf.data, mf.buf.len, 0) == rec.out_hash);
+    if(same) keep_lines(c, &mf.buf);
+    unmap_file(&mf);
+    return same;
+}
+
+/// @brief records an output file that was just written, so it can be skipped next time,
+///        nothing is recorded in a read only cache
+/// @param c pointer to the cache
+/// @param key the conversion's key, from cache_file_key()
+/// @param out the contents of the output file, pos is its length
+/// @return 0 on success, otherwise an error code
+int cache_add_file(ega_cache_t *c, uint64_t key, const memstream_buf_t *out) {
+    if((NULL == c) || (NULL == out) || (NULL == out->data)) {
+        return -1; // NULL pointer error
+    }
+    if(out->pos > UINT32_MAX) {
+        return -2; // too large to be recorded
+    }
+    if(c->read_only) {
+        return 0; // nothing is recorded
+    }
+    cache_file_t rec = {key, hash64(out->data, out->pos, 0), out->pos, true};
+    mutex_lock(&c->lock);
+    int rval = add_file(c, &rec);
+    mutex_unlock(&c->lock);
+    return rval;
+}
+
+/// @brief encodes an image like ega_encode(), taking the codes of any scanline that has been
+///        encoded before from the cache, only the lines that aren't there are searched for runs.
+///        the codes taken are decoded again and checked against the line, so a hash that
+///        happens to match a different line is never trusted. the output is the same as ega_encode()
+/// @param c pointer to the cache, new lines are added to it unless it is read only
+/// @param dst memstream buffer for the encoded file, must be at least ega_encode_bound() bytes
+/// @param src memstream buffer holding the image at 1 byte per pixel, top line first
+/// @param width  width of the image in pixels
+/// @param height height of the image in pixels or lines
+/// @param hits set to the number of lines taken from the cache
+/// @return 0 on success, otherwise an error code
+int cache_encode(ega_cache_t *c, memstream_buf_t *dst, memstream_buf_t *src, uint16_t width, uint16_t height,
+                 size_t *hits) {
+    if((NULL == c) || (NULL == dst) || (NULL == dst->data) || (NULL == src) || (NULL == src->data) ||
+       (NULL == hits)) {
+        return -1; // NULL pointer error
+    }
+    if(src->len < ega_decode_size(width, height)) {
+        return -3; // not enough source data for the image size
+    }
+    if((dst->len < dst->pos) || ((dst->len - dst->pos) < ega_encode_bound(width, height))) {
+        return -2; // destination buffer is too small
+    }
+    int rval = ega_write_header(dst, width, height);
+    if(rval) return rval;
+
+    size_t nbytes = EGA_LINE_BYTES(width);
+    size_t lbound = ega_line_bound(width);
+    uint8_t line[EGA_MAX_LINE_BYTES];
+    uint8_t check[EGA_MAX_LINE_BYTES];
+    *hits = 0;
+    for(int i = 0; i < height; i++) {
+        // stored bottom to top, like ega_encode()
+        ega_pack_line(line, &src->data[(size_t)(height - 1 - i) * width], width);
+        uint64_t key = line_key(line, nbytes);
+        size_t start = dst->pos;
+
+        // the codes are copied out while the lock is held, another worker may grow the store
+        bool found = false;
+        mutex_lock(&c->lock);
+        if(c->line_cap) {
+            cache_line_t *slot = line_slot(c, key);
+            if(slot->key == key) slot->used = true;
+            cache_line_t rec = *slot;
+            if((rec.key == key) && (rec.len <= lbound)) {
+                memcpy(&dst->data[start], &c->codes[rec.off], rec.len);
+                dst->pos += rec.len;
+                found = true;
+            }
+        }
+        mutex_unlock(&c->lock);
+        if(found) {
+            memstream_buf_t ms = {dst->pos, start, dst->data};
+            if((0 == ega_decode_line(check, &ms, width)) && (ms.pos == dst->pos) && (0 == memcmp(check, line, nbytes))) {
+                (*hits)++;
+                continue;
+            }
+            dst->pos = start; // not the same line after all
+        }
+
+        if(0 != (rval = ega_encode_line(dst, line, width))) return rval;
+
+        // a line that there isn't room to cache is still encoded, it is just done again next time
+        if(c->read_only) continue;
+        mutex_lock(&c->lock);
+        add_line(c, key, &dst->data[start], dst->pos - start);
+        mutex_unlock(&c->lock);
+    }
+    return 0;
+}
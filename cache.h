@@ -0,0 +1,64 @@
+/*
+ * cache.h
+ * an on disk cache of encoded scanlines and whole files, so re-encoding a set of
+ * images only does the work for what has changed since the last run
+ *
+ * This code is offered without warranty under the MIT License. Use it as you will
+ * personally or commercially, just give credit if you do.
+ */
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "memstream.h"
+#include "thread.h"
+
+#ifndef CACHE_H
+#define CACHE_H
+
+// cache file signature and layout version, a file that doesn't match is started over
+#define CACHE_SIG "EGAC"
+#define CACHE_VERSION (1)
+
+// the codes a scanline was encoded to, keyed by a hash of its packed pixels
+typedef struct {
+    uint64_t    key;         // hash of the packed line, 0 for an empty slot
+    uint32_t    off;         // where its codes start in the code store
+    uint32_t    len;         // length of its codes in bytes
+    bool        used;        // looked up or added this run, only these are saved
+} cache_line_t;
+
+// an EGA file written from a given BMP file, keyed by a hash of the BMP and the output name
+typedef struct {
+    uint64_t    key;         // hash of the input file and output name, 0 for an empty slot
+    uint64_t    out_hash;    // hash of the EGA file that was written
+    uint32_t    out_len;     // length of the EGA file in bytes
+    bool        used;        // looked up or added this run, only these are saved
+} cache_file_t;
+
+// both tables are open addressed with a power of 2 number of slots, and shared by all
+// the workers of a batch through the lock
+typedef struct {
+    cache_line_t *lines;     // the line table
+    size_t      line_cap;    // slots in the line table
+    size_t      line_count;  // slots in use
+    uint8_t     *codes;      // the encoded lines, end to end
+    size_t      codes_len;   // bytes of codes held
+    size_t      codes_cap;   // bytes there is room for
+    cache_file_t *files;     // the file table
+    size_t      file_cap;    // slots in the file table
+    size_t      file_count;  // slots in use
+    bool        dirty;       // something was added since it was loaded
+    bool        read_only;   // only looked in, nothing is added or saved, for --verify
+    mutex_t     lock;        // guards all of the above
+} ega_cache_t;
+
+int cache_load(ega_cache_t *c, const char *fn);
+int cache_save(ega_cache_t *c, const char *fn);
+void cache_free(ega_cache_t *c);
+uint64_t cache_file_key(const memstream_buf_t *src, const char *fo_name);
+bool cache_file_unchanged(ega_cache_t *c, uint64_t key, const char *fo_name);
+int cache_add_file(ega_cache_t *c, uint64_t key, const memstream_buf_t *out);
+int cache_encode(ega_cache_t *c, memstream_buf_t *dst, memstream_buf_t *src, uint16_t width, uint16_t height,
+                 size_t *hits);
+
+#endif
@@ -0,0 +1,1453 @@
+/*
+ * eaega.c 
+ * encoder and decoder for the Electronic Arts EGA image format
+ * 
+ * none of the functions here allocate memory, all buffers are owned by the caller,
+ * use ega_decode_size() and ega_encode_bound() to size them ahead of time
+ *  
+ * This code is offered without warranty under the MIT License. Use it as you will 
+ * personally or commercially, just give credit if you do.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include "eaega.h"
+#include "thread.h"
+
+// trace output goes to stderr, levels above EAEGA_TRACE are removed at compile time
+#if EAEGA_TRACE
+static int trace_level = 0;
+#define TRACE(L, ...) do { if(((L) <= EAEGA_TRACE) && ((L) <= trace_level)) fprintf(stderr, __VA_ARGS__); } while(0)
+#else
+#define TRACE(L, ...) do { } while(0)
+#endif
+
+static size_t line_bound(uint16_t width);
+
+static inline uint16_t get_le16(const uint8_t *p) { return p[0] | (p[1] << 8); }
+static inline uint32_t get_le32(const uint8_t *p) { return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24); }
+static inline void put_le16(uint8_t *p, uint16_t v) { p[0] = v & 0xff; p[1] = v >> 8; }
+static inline void put_le32(uint8_t *p, uint32_t v) { put_le16(p, v & 0xffff); put_le16(&p[2], v >> 16); }
+
+// default EGA/VGA 16 colour palette
+const bmp_palette_entry_t ega_pal[16] = { 
+  {0x00,0x00,0x00,0x00}, {0xaa,0x00,0x00,0x00}, {0x00,0xaa,0x00,0x00}, {0xaa,0xaa,0x00,0x00}, 
+  {0x00,0x00,0xaa,0x00}, {0xaa,0x00,0xaa,0x00}, {0x00,0x55,0xaa,0x00}, {0xaa,0xaa,0xaa,0x00},
+  {0x55,0x55,0x55,0x00}, {0xff,0x55,0x55,0x00}, {0x55,0xff,0x55,0x00}, {0xff,0xff,0x55,0x00}, 
+  {0x55,0x55,0xff,0x00}, {0xff,0x55,0xff,0x00}, {0x55,0xff,0xff,0x00}, {0xff,0xff,0xff,0x00},
+};
+
+/// @brief sets the runtime trace level, limited to what was compiled in with EAEGA_TRACE
+/// @param level 0 for none, 1 for scanlines, 2 for RLE codes
+/// @return the trace level that is in effect
+int ega_set_trace(int level) {
+    if(level < 0) level = 0;
+    if(level > EAEGA_TRACE) level = EAEGA_TRACE;
+#if EAEGA_TRACE
+    trace_level = level;
+#endif
+    return level;
+}
+
+/// @brief reads the image size prefix from the start of an EGA stream
+/// @param src memstream buffer holding the EGA file, pos is advanced past the header
+/// @param width  pointer to width of the image in pixels set on return
+/// @param height pointer to height of the image in pixels or lines set on return
+/// @return 0 on success, otherwise an error code
+int ega_read_header(memstream_buf_t *src, uint16_t *width, uint16_t *height) {
+    if((NULL == src) || (NULL == src->data) || (NULL == width) || (NULL == height)) {
+        return -1; // NULL pointer error
+    }
+    if((src->len < src->pos) || ((src->len - src->pos) < EGA_HDR_SZ)) {
+        return -3; // not enough data for the header
+    }
+
+    // both values are stored little endian as the size - 1
+    uint8_t *p = &src->data[src->pos];
+    *width = get_le16(&p[0]) + 1;
+    *height = get_le16(&p[2]) + 1;
+    src->pos += EGA_HDR_SZ;
+    return 0;
+}
+
+/// @brief writes the EGA image header, the width and height
+/// @param dst memstream buffer to write the header to, pos is moved past it
+/// @param width  width of the image in pixels
+/// @param height height of the image in pixels or lines
+/// @return 0 on success, otherwise an error code
+int ega_write_header(memstream_buf_t *dst, uint16_t width, uint16_t height) {
+    if((NULL == dst) || (NULL == dst->data)) {
+        return -1; // NULL pointer error
+    }
+    if((dst->len < dst->pos) || ((dst->len - dst->pos) < EGA_HDR_SZ)) {
+        return -2; // destination buffer is too small
+    }
+
+    // both values are stored little endian as the size - 1
+    uint8_t *p = &dst->data[dst->pos];
+    put_le16(&p[0], width - 1);
+    put_le16(&p[2], height - 1);
+    dst->pos += EGA_HDR_SZ;
+    return 0;
+}
+
+/// @brief size of the buffer needed to hold a decoded image at 1 byte per pixel
+/// @param width  width of the image in pixels
+/// @param height height of the image in pixels or lines
+/// @return size in bytes
+size_t ega_decode_size(uint16_t width, uint16_t height) {
+    return (size_t)width * height;
+}
+
+/// @brief worst case size of an encoded image, including the header. this is when
+///        an image has no runs at all and each line is stored as a set of literal strings
+/// @param width  width of the image in pixels
+/// @param height height of the image in pixels or lines
+/// @return size in bytes
+size_t ega_encode_bound(uint16_t width, uint16_t height) {
+    return EGA_HDR_SZ + line_bound(width) * height;
+}
+
+/// @brief decodes the start of a scanline of RLE data to packed pixels, 2 per byte
+/// @param dp pointer to the start of the line in the output, must have room for the whole line
+/// @param src memstream buffer positioned at the start of the line's RLE data
+/// @param nbytes length of the packed line in bytes
+/// @param want decoding stops once at least this many bytes of the line have been decoded
+/// @return 0 on success, otherwise an error code
+static int decode_line_part(uint8_t *dp, memstream_buf_t *src, size_t nbytes, size_t want) {
+    size_t x = 0;
+
+    // fortunately the image data is compressed on a per line
+    // basis, so we don't need to worry about the runs spanning
+    // a line boundary
+    while(x < want) {
+        if(src->pos >= src->len) return -3; // ran out of data
+        uint8_t tc = src->data[src->pos++];
+        if(tc >= 128) {
+            tc = (tc & 0x7f) + 3;
+            if(src->pos >= src->len) return -3; // ran out of data
+            if((x + tc) > nbytes) return -4;    // code spans the end of the line
+            uint8_t tv = src->data[src->pos++];
+            TRACE(2, "%d [%02x]\n", tc, tv);
+            // the value is a pair of packed pixels, so a run is a plain fill
+            memset(dp, tv, tc);
+        } else {
+            tc += 1;
+            if((src->len - src->pos) < tc) return -3; // ran out of data
+            if((x + tc) > nbytes) return -4;          // code spans the end of the line
+            TRACE(2, "%d [", tc);
+            for(int i = 0; i < tc; i++) {
+                TRACE(2, " %02x", src->data[src->pos + i]);
+            }
+            TRACE(2, " ]\n");
+            memcpy(dp, &src->data[src->pos], tc);
+            src->pos += tc;
+        }
+        dp += tc;
+        x += tc;
+    }
+    return 0;
+}
+
+/// @brief decodes a single scanline of RLE data to packed pixels, 2 per byte
+/// @param dp pointer to the start of the line in the output
+/// @param src memstream buffer positioned at the start of the line's RLE data
+/// @param nbytes length of the packed line in bytes
+/// @return 0 on success, otherwise an error code
+static inline int decode_line(uint8_t *dp, memstream_buf_t *src, size_t nbytes) {
+    return decode_line_part(dp, src, nbytes, nbytes);
+}
+
+// the fast line decoder may write this far past the end of a line, a run that overruns the 
+// line plus the 16 byte blocks it is filled in
+#define FAST_SLACK (EGA_MAX_RUN + 16)
+// bytes of RLE data the fast decoder needs to be able to read for a line of N bytes, for the 
+// worst case of a malformed line and the 16 byte blocks literals are copied in
+#define FAST_SRC_NEED(N) (2 * ((size_t)(N) + EGA_MAX_RUN) + 16)
+
+/// @brief decodes a single scanline of RLE data to packed pixels like decode_line(), for the 
+///        standard EGA widths. with nbytes a constant the loop has no checks per code, runs and 
+///        literals are filled and copied 16 bytes at a time, past their end, and the line is 
+///        only checked once at its end. so the caller must have checked that src holds at least 
+///        FAST_SRC_NEED(nbytes) more bytes, and that dp has FAST_SLACK bytes of room past the line
+/// @param dp pointer to the start of the line in the output
+/// @param src memstream buffer positioned at the start of the line's RLE data
+/// @param nbytes length of the packed line in bytes
+/// @return 0 on success, otherwise an error code
+static inline int decode_line_fast(uint8_t *dp, memstream_buf_t *src, const size_t nbytes) {
+    const uint8_t *sp = &src->data[src->pos];
+    uint8_t *end = dp + nbytes;
+    while(dp < end) {
+        size_t tc = *sp++;
+        if(tc >= 128) {
+            tc = (tc & 0x7f) + 3;
+            uint8_t tv = *sp++;
+            for(size_t i = 0; i < tc; i += 16) memset(&dp[i], tv, 16);
+        } else {
+            tc += 1;
+            for(size_t i = 0; i < tc; i += 16) memcpy(&dp[i], &sp[i], 16);
+            sp += tc;
+        }
+        dp += tc;
+    }
+    if(dp != end) return -4; // a code spans the end of the line
+    src->pos = sp - src->data;
+    return 0;
+}
+
+/// @brief decodes a single scanline with the decoder best suited to it. the lines of the 
+///        standard EGA widths, 320 and 640 pixels, go to decode_line_fast() when it is safe to,
+///        everything else to the general decode_line()
+/// @param dp pointer to the start of the line in the output
+/// @param src memstream buffer positioned at the start of the line's RLE data
+/// @param nbytes length of the packed line in bytes
+/// @param room dp has FAST_SLACK bytes that may be written to past the end of the line
+/// @return 0 on success, otherwise an error code
+static inline int decode_line_any(uint8_t *dp, memstream_buf_t *src, size_t nbytes, bool room) {
+#if EAEGA_TRACE >= 2
+    if(trace_level >= 2) return decode_line(dp, src, nbytes); // only it traces each code
+#endif
+    if(room && ((src->len - src->pos) >= FAST_SRC_NEED(nbytes))) {
+        if(160 == nbytes) return decode_line_fast(dp, src, 160); // 320 pixel modes
+        if(320 == nbytes) return decode_line_fast(dp, src, 320); // 640 pixel modes
+    }
+    return decode_line(dp, src, nbytes);
+}
+
+/// @brief decodes a single scanline of RLE data to packed pixels, for callers that keep
+///        lines apart from their image
+/// @param line buffer for the packed line, at least EGA_LINE_BYTES(width) bytes
+/// @param src memstream buffer positioned at the start of the line's RLE data, pos is left 
+///        at the start of the next line
+/// @param width width of the image in pixels
+/// @return 0 on success, otherwise an error code
+int ega_decode_line(uint8_t *line, memstream_buf_t *src, uint16_t width) {
+    if((NULL == line) || (NULL == src) || (NULL == src->data)) {
+        return -1; // NULL pointer error
+    }
+    return decode_line(line, src, EGA_LINE_BYTES(width));
+}
+
+/// @brief decodes the RLE data of an EGA image to 1 byte per pixel, top line first
+/// @param dst memstream buffer for the image, must be at least ega_decode_size() bytes
+/// @param src memstream buffer positioned at the start of the RLE data (after the header)
+/// @param width  width of the image in pixels
+/// @param height height of the image in pixels or lines
+/// @return 0 on success, otherwise an error code
+int ega_decode(memstream_buf_t *dst, memstream_buf_t *src, uint16_t width, uint16_t height) {
+    if((NULL == dst) || (NULL == dst->data) || (NULL == src) || (NULL == src->data)) {
+        return -1; // NULL pointer error
+    }
+    if(dst->len < ega_decode_size(width, height)) {
+        return -2; // destination buffer is too small
+    }
+
+    // image is stored from bottom scanline to top
+    // so start by pointing to the beginning of the last line.
+    uint8_t line[EGA_MAX_LINE_BYTES + FAST_SLACK];
+    for(int y = height - 1; y >= 0; y--) {
+        TRACE(1, "line %d @ %zu\n", y, src->pos);
+        int rval = decode_line_any(line, src, EGA_LINE_BYTES(width), true);
+        if(rval) return rval;
+        ega_unpack_line(&dst->data[(size_t)y * width], line, width);
+    }
+    dst->pos = ega_decode_size(width, height);
+    return 0;
+}
+
+/// @brief size of the buffer needed to hold a decoded image as 4 bit planes
+/// @param width  width of the image in pixels
+/// @param height height of the image in pixels or lines
+/// @return size in bytes
+size_t ega_planar_size(uint16_t width, uint16_t height) {
+    return 4 * EGA_PLANE_BYTES(width) * height;
+}
+
+/// @brief decodes the RLE data of an EGA image to its 4 bit planes, the layout of EGA video 
+///        memory. each plane is EGA_PLANE_BYTES(width) * height bytes, top line first, 8 pixels 
+///        per byte with the leftmost in the high bit, and plane 0 (the blue bit) comes first
+/// @param dst memstream buffer for the planes, must be at least ega_planar_size() bytes
+/// @param src memstream buffer positioned at the start of the RLE data (after the header)
+/// @param width  width of the image in pixels
+/// @param height height of the image in pixels or lines
+/// @return 0 on success, otherwise an error code
+int ega_decode_planar(memstream_buf_t *dst, memstream_buf_t *src, uint16_t width, uint16_t height) {
+    if((NULL == dst) || (NULL == dst->data) || (NULL == src) || (NULL == src->data)) {
+        return -1; // NULL pointer error
+    }
+    if(dst->len < ega_planar_size(width, height)) {
+        return -2; // destination buffer is too small
+    }
+
+    size_t pb = EGA_PLANE_BYTES(width);
+    size_t plane_size = pb * height;
+    uint8_t line[EGA_MAX_LINE_BYTES + FAST_SLACK];
+    for(int y = height - 1; y >= 0; y--) {
+        TRACE(1, "line %d @ %zu\n", y, src->pos);
+        int rval = decode_line_any(line, src, EGA_LINE_BYTES(width), true);
+        if(rval) return rval;
+        ega_planar_line(&dst->data[(size_t)y * pb], plane_size, line, width);
+    }
+    dst->pos = ega_planar_size(width, height);
+    return 0;
+}
+
+/// @brief splits an image of packed scanlines, as the packed decoders write them, in to its 
+///        4 bit planes, laid out as by ega_decode_planar()
+/// @param dst memstream buffer for the planes, must be at least ega_planar_size() bytes
+/// @param src the packed scanlines, bottom line first
+/// @param width  width of the image in pixels
+/// @param height height of the image in pixels or lines
+/// @param stride bytes per scanline in src
+/// @return 0 on success, otherwise an error code
+int ega_pack_planes(memstream_buf_t *dst, const memstream_buf_t *src, uint16_t width, uint16_t height, size_t stride) {
+    if((NULL == dst) || (NULL == dst->data) || (NULL == src) || (NULL == src->data)) {
+        return -1; // NULL pointer error
+    }
+    if((stride < EGA_LINE_BYTES(width)) || (src->len < ega_decode_packed_size(stride, height))) {
+        return -3; // source is too small
+    }
+    if(dst->len < ega_planar_size(width, height)) {
+        return -2; // destination buffer is too small
+    }
+
+    size_t pb = EGA_PLANE_BYTES(width);
+    size_t plane_size = pb * height;
+    for(int i = 0; i < height; i++) {
+        ega_planar_line(&dst->data[(size_t)(height - 1 - i) * pb], plane_size, &src->data[i * stride], width);
+    }
+    dst->pos = ega_planar_size(width, height);
+    return 0;
+}
+
+/// @brief size of the buffer needed to hold a decoded image as packed scanlines
+/// @param stride bytes per scanline in the output, at least EGA_LINE_BYTES(width)
+/// @param height height of the image in pixels or lines
+/// @return size in bytes
+size_t ega_decode_packed_size(size_t stride, uint16_t height) {
+    return stride * height;
+}
+
+/// @brief decodes a range of scanlines to packed pixels, in file order (bottom line first)
+/// @param dp pointer to where the first line of the range is written
+/// @param src memstream buffer positioned at the start of the first line's RLE data
+/// @param width  width of the image in pixels
+/// @param height height of the image in pixels or lines
+/// @param stride bytes per scanline in the output, any padding is zeroed
+/// @param first index of the first line, counting up from the bottom line
+/// @param count number of lines to decode
+/// @return 0 on success, otherwise an error code
+static int decode_packed_lines(uint8_t *dp, memstream_buf_t *src, uint16_t width, uint16_t height, size_t stride, int first, int count) {
+    (void)height; // only traced
+    size_t nbytes = EGA_LINE_BYTES(width);
+    for(int i = first; i < (first + count); i++) {
+        TRACE(1, "line %d @ %zu\n", height - 1 - i, src->pos);
+        // a line may run over in to the next, which is decoded over it straight after. the last 
+        // line of the range has nothing after it that is ours to write to, it may be another thread's
+        bool room = ((i + 1) < (first + count)) && ((nbytes + FAST_SLACK) <= (2 * stride));
+        int rval = decode_line_any(dp, src, nbytes, room);
+        if(rval) return rval;
+        memset(&dp[nbytes], 0, stride - nbytes); // clear out the padding
+        dp += stride;
+    }
+    return 0;
+}
+
+/// @brief decodes the RLE data of an EGA image straight to packed 4 bit per pixel 
+///        scanlines, bottom line first. this is the same layout as the pixel data 
+///        of a 16 colour BMP, so no intermediate image is needed
+/// @param dst memstream buffer for the image, must be at least ega_decode_packed_size() bytes
+/// @param src memstream buffer positioned at the start of the RLE data (after the header)
+/// @param width  width of the image in pixels
+/// @param height height of the image in pixels or lines
+/// @param stride bytes per scanline in the output, any padding is zeroed
+/// @return 0 on success, otherwise an error code
+int ega_decode_packed(memstream_buf_t *dst, memstream_buf_t *src, uint16_t width, uint16_t height, size_t stride) {
+    if((NULL == dst) || (NULL == dst->data) || (NULL == src) || (NULL == src->data)) {
+        return -1; // NULL pointer error
+    }
+    size_t nbytes = EGA_LINE_BYTES(width);
+    if((stride < nbytes) || (dst->len < ega_decode_packed_size(stride, height))) {
+        return -2; // destination buffer is too small
+    }
+
+    // both formats store the lines bottom to top, so lines are written in order
+    int rval = decode_packed_lines(dst->data, src, width, height, stride, 0, height);
+    if(rval) return rval;
+    dst->pos = ega_decode_packed_size(stride, height);
+    return 0;
+}
+
+/// @brief moves past a scanline of RLE data by reading only its code bytes, the pixel 
+///        data is skipped over
+/// @param src memstream buffer positioned at the start of the line's RLE data
+/// @param nbytes length of the packed line in bytes
+/// @return 0 on success, otherwise an error code
+static int skip_line(memstream_buf_t *src, size_t nbytes) {
+    size_t x = 0;
+    while(x < nbytes) {
+        if(src->pos >= src->len) return -3;   // ran out of data
+        uint8_t tc = src->data[src->pos++];
+        size_t skip;
+        if(tc >= 128) {
+            tc = (tc & 0x7f) + 3;
+            skip = 1; // just the value to be repeated
+        } else {
+            tc += 1;
+            skip = tc; // the literal string
+        }
+        if((x + tc) > nbytes) return -4;      // code spans the end of the line
+        if((src->len - src->pos) < skip) return -3; // ran out of data
+        src->pos += skip;
+        x += tc;
+    }
+    return 0;
+}
+
+/// @brief builds an index of where each scanline starts in the RLE data. only the code bytes
+///        are read, the pixel data is skipped over, so this is much faster than decoding
+/// @param src memstream buffer positioned at the start of the RLE data (after the header),
+///        pos is left at the end of the image data
+/// @param width  width of the image in pixels
+/// @param height height of the image in pixels or lines
+/// @param offsets receives the offset into src of each line, in file order (bottom line first),
+///        must hold height entries
+/// @return 0 on success, otherwise an error code
+int ega_index_lines(memstream_buf_t *src, uint16_t width, uint16_t height, uint32_t *offsets) {
+    if((NULL == src) || (NULL == src->data) || (NULL == offsets)) {
+        return -1; // NULL pointer error
+    }
+    size_t nbytes = EGA_LINE_BYTES(width);
+    for(int i = 0; i < height; i++) {
+        offsets[i] = src->pos;
+        int rval = skip_line(src, nbytes);
+        if(rval) return rval;
+    }
+    return 0;
+}
+
+/// @brief counts how often each length of run and literal string appears in an image, by 
+///        reading only the code bytes. the counts are added to, so they can be summed over a set 
+///        of images, and show how often the longest codes the format allows are used
+/// @param src memstream buffer positioned at the start of the RLE data (after the header),
+///        pos is left at the end of the image data
+/// @param width  width of the image in pixels
+/// @param height height of the image in pixels or lines
+/// @param hist the counts to add to
+/// @return 0 on success, otherwise an error code
+int ega_count_codes(memstream_buf_t *src, uint16_t width, uint16_t height, ega_code_hist_t *hist) {
+    if((NULL == src) || (NULL == src->data) || (NULL == hist)) {
+        return -1; // NULL pointer error
+    }
+    size_t nbytes = EGA_LINE_BYTES(width);
+    for(int i = 0; i < height; i++) {
+        size_t x = 0;
+        while(x < nbytes) {
+            if(src->pos >= src->len) return -3;   // ran out of data
+            uint8_t tc = src->data[src->pos++];
+            size_t skip;
+            if(tc >= 128) {
+                tc = (tc & 0x7f) + 3;
+                skip = 1; // just the value to be repeated
+                hist->runs[tc]++;
+            } else {
+                tc += 1;
+                skip = tc; // the literal string
+                hist->copies[tc]++;
+            }
+            if((x + tc) > nbytes) return -4;      // code spans the end of the line
+            if((src->len - src->pos) < skip) return -3; // ran out of data
+            src->pos += skip;
+            x += tc;
+        }
+    }
+    return 0;
+}
+
+/// @brief decodes a thumbnail of an image, 1 in every scale lines and 1 in every scale pixels
+///        of those, the top left pixel is always kept. the other lines are skipped over by their 
+///        code bytes as ega_index_lines() does, so only the lines kept are ever expanded. the 
+///        thumbnail is packed 4 bits per pixel, bottom line first, like ega_decode_packed()
+/// @param dst memstream buffer for the thumbnail, must be at least 
+///        ega_decode_packed_size(stride, EGA_SCALED(height, scale))
+/// @param src memstream buffer positioned at the start of the RLE data (after the header)
+/// @param width  width of the image in pixels
+/// @param height height of the image in pixels or lines
+/// @param scale how many times smaller the thumbnail is each way, 1 or more
+/// @param stride bytes per scanline in the output, any padding is zeroed
+/// @return 0 on success, otherwise an error code
+int ega_decode_thumb(memstream_buf_t *dst, memstream_buf_t *src, uint16_t width, uint16_t height, 
+                     int scale, size_t stride) {
+    if((NULL == dst) || (NULL == dst->data) || (NULL == src) || (NULL == src->data)) {
+        return -1; // NULL pointer error
+    }
+    if(scale < 1) {
+        return -5; // no such scale
+    }
+    uint16_t tw = EGA_SCALED(width, scale);
+    uint16_t th = EGA_SCALED(height, scale);
+    size_t obytes = EGA_LINE_BYTES(tw);
+    if((stride < obytes) || (dst->len < ega_decode_packed_size(stride, th))) {
+        return -2; // destination buffer is too small
+    }
+
+    size_t nbytes = EGA_LINE_BYTES(width);
+    uint8_t line[EGA_MAX_LINE_BYTES];
+    uint8_t *dp = dst->data;
+    for(int i = 0; i < height; i++) {
+        // lines are kept counting down from the top, which is the last line in the file
+        int y = height - 1 - i;
+        if(y % scale) {
+            int rval = skip_line(src, nbytes);
+            if(rval) return rval;
+            continue;
+        }
+        TRACE(1, "line %d @ %zu\n", y, src->pos);
+        int rval = decode_line(line, src, nbytes);
+        if(rval) return rval;
+
+        // pick out every scale'th pixel and pack them in pairs, leftmost in the high nibble
+        memset(dp, 0, stride);
+        for(size_t x = 0; x < tw; x++) {
+            size_t sx = x * scale;
+            uint8_t px = (sx & 1) ? (line[sx / 2] & 0x0f) : (line[sx / 2] >> 4);
+            dp[x / 2] |= (x & 1) ? px : (px << 4);
+        }
+        dp += stride;
+    }
+    dst->pos = ega_decode_packed_size(stride, th);
+    return 0;
+}
+
+/// @brief decodes a rectangle out of an image to packed pixels, bottom line first like 
+///        ega_decode_packed(). using the scanline index only the lines in the rectangle are
+///        read, and each of those only as far as the right edge of the rectangle
+/// @param dst memstream buffer for the region, must be at least ega_decode_packed_size(stride, rect->height)
+/// @param src memstream buffer holding the RLE data the index was built from
+/// @param width  width of the image in pixels
+/// @param height height of the image in pixels or lines
+/// @param offsets the scanline index from ega_index_lines() or egx_read()
+/// @param rect the rectangle to decode, y counts down from the top of the image
+/// @param stride bytes per scanline in the output, any padding is zeroed
+/// @return 0 on success, otherwise an error code
+int ega_decode_region(memstream_buf_t *dst, memstream_buf_t *src, uint16_t width, uint16_t height, 
+                      const uint32_t *offsets, const ega_rect_t *rect, size_t stride) {
+    if((NULL == dst) || (NULL == dst->data) || (NULL == src) || (NULL == src->data) || 
+       (NULL == offsets) || (NULL == rect)) {
+        return -1; // NULL pointer error
+    }
+    if(((rect->x + rect->width) > width) || ((rect->y + rect->height) > height) ||
+       (0 == rect->width) || (0 == rect->height)) {
+        return -5; // rectangle is outside the image
+    }
+    size_t obytes = EGA_LINE_BYTES(rect->width);
+    if((stride < obytes) || (dst->len < ega_decode_packed_size(stride, rect->height))) {
+        return -2; // destination buffer is too small
+    }
+
+    size_t nbytes = EGA_LINE_BYTES(width);
+    size_t skip = rect->x / 2;                                     // bytes left of the rectangle
+    size_t want = EGA_LINE_BYTES(rect->x + rect->width);           // bytes up to its right edge
+    bool shift = (rect->x & 1);                                    // starts on a low nibble
+    uint8_t line[EGA_MAX_LINE_BYTES];
+    uint8_t *dp = dst->data;
+
+    // the bottom line of the rectangle comes first in the file
+    int first = height - (rect->y + rect->height);
+    for(int i = first; i < (first + rect->height); i++) {
+        memstream_buf_t ms = *src;
+        ms.pos = offsets[i];
+        TRACE(1, "line %d @ %zu\n", height - 1 - i, ms.pos);
+        int rval = decode_line_part(line, &ms, nbytes, want);
+        if(rval) return rval;
+        if(shift) {
+            // move every pixel left by a nibble
+            for(size_t x = 0; x < obytes; x++) {
+                size_t sx = skip + x;
+                uint8_t lo = ((sx + 1) < want) ? line[sx + 1] : 0;
+                dp[x] = (line[sx] << 4) | (lo >> 4);
+            }
+        } else {
+            memcpy(dp, &line[skip], obytes);
+            if(rect->width & 1) dp[obytes - 1] &= 0xf0; // the pixel right of the rectangle
+        }
+        memset(&dp[obytes], 0, stride - obytes); // clear out the padding
+        dp += stride;
+    }
+    dst->pos = ega_decode_packed_size(stride, rect->height);
+    return 0;
+}
+
+// most pixels in one BI_RLE4 code, kept even so every code starts on the high nibble of a pixel pair
+#define RLE4_MAX_PX 254
+
+/// @brief size of the buffer needed to hold an image transcoded to BI_RLE4
+/// @param width  width of the image in pixels
+/// @param height height of the image in pixels or lines
+/// @return size in bytes
+size_t ega_rle4_bound(uint16_t width, uint16_t height) {
+    // at worst each packed byte costs 2 (a 1 byte literal becomes a 2 pixel run), 
+    // plus the end of line code for each line and the end of bitmap code
+    return ((size_t)EGA_LINE_BYTES(width) * 2 + 2) * height + 2;
+}
+
+/// @brief transcodes a single scanline of RLE data to BI_RLE4 codes, without expanding it
+/// @param dst memstream buffer for the BI_RLE4 data, pos is advanced past the line
+/// @param src memstream buffer positioned at the start of the line's RLE data
+/// @param width width of the image in pixels
+/// @return 0 on success, otherwise an error code
+static int rle4_line(memstream_buf_t *dst, memstream_buf_t *src, uint16_t width) {
+    size_t nbytes = EGA_LINE_BYTES(width);
+    size_t x = 0;
+    uint8_t *dp = &dst->data[dst->pos];
+
+    // both formats code runs of pixel pairs and strings of packed bytes, so each code maps
+    // across directly. the only difference is that BI_RLE4 counts pixels, so the pad
+    // nibble of an odd width line is dropped from the last code
+    while(x < nbytes) {
+        if(src->pos >= src->len) return -3; // ran out of data
+        uint8_t tc = src->data[src->pos++];
+        bool run = (tc >= 128);
+        tc = run ? (tc & 0x7f) + 3 : tc + 1;
+        if((x + tc) > nbytes) return -4;    // code spans the end of the line
+        if((src->len - src->pos) < (run ? 1u : tc)) return -3; // ran out of data
+        const uint8_t *sp = &src->data[src->pos];
+        src->pos += run ? 1 : tc;
+
+        size_t end = (x + tc) * 2;
+        size_t px = ((end > width) ? width : end) - (x * 2); // pixels covered by the code
+        while(px) {
+            size_t n = (px > RLE4_MAX_PX) ? RLE4_MAX_PX : px;
+            if(run || (n < 3)) {
+                // encoded mode, alternates between the 2 nibbles of the value. a single 
+                // byte literal is too short for absolute mode, but a pair is a run of 2
+                *dp++ = n;
+                *dp++ = *sp;
+            } else {
+                // absolute mode, the packed bytes as they are, padded out to 16 bits
+                size_t nb = (n + 1) / 2;
+                *dp++ = 0;
+                *dp++ = n;
+                memcpy(dp, sp, nb);
+                dp += nb;
+                if(nb & 1) *dp++ = 0;
+                sp += nb;
+            }
+            px -= n;
+        }
+        x += tc;
+    }
+    *dp++ = 0; // end of line
+    *dp++ = 0;
+    dst->pos = dp - dst->data;
+    return 0;
+}
+
+/// @brief transcodes the RLE data of an EGA image to the BI_RLE4 compression of a 16 colour BMP.
+///        both formats store the lines bottom to top, so the codes are rewritten in order with 
+///        the pixels never being expanded
+/// @param dst memstream buffer for the BI_RLE4 data, must be at least ega_rle4_bound() bytes.
+///        pos is set to the length of the data on return
+/// @param src memstream buffer positioned at the start of the RLE data (after the header)
+/// @param width  width of the image in pixels
+/// @param height height of the image in pixels or lines
+/// @return 0 on success, otherwise an error code
+int ega_transcode_rle4(memstream_buf_t *dst, memstream_buf_t *src, uint16_t width, uint16_t height) {
+    if((NULL == dst) || (NULL == dst->data) || (NULL == src) || (NULL == src->data)) {
+        return -1; // NULL pointer error
+    }
+    if(dst->len < ega_rle4_bound(width, height)) {
+        return -2; // destination buffer is too small
+    }
+
+    dst->pos = 0;
+    for(int i = 0; i < height; i++) {
+        TRACE(1, "line %d @ %zu\n", height - 1 - i, src->pos);
+        int rval = rle4_line(dst, src, width);
+        if(rval) return rval;
+    }
+    dst->data[dst->pos++] = 0; // end of bitmap
+    dst->data[dst->pos++] = 1;
+    return 0;
+}
+
+/// @brief size of a .EGX scanline index sidecar file
+/// @param height height of the image in pixels or lines
+/// @return size in bytes
+size_t egx_size(uint16_t height) {
+    return EGX_HDR_SZ + (size_t)height * sizeof(uint32_t);
+}
+
+/// @brief writes a scanline index as a .EGX sidecar file. the size of the EGA file is 
+///        stored with it so a stale index can be detected
+/// @param dst memstream buffer for the sidecar, must be at least egx_size() bytes
+/// @param width  width of the image in pixels
+/// @param height height of the image in pixels or lines
+/// @param ega_len size of the EGA file the index was built from
+/// @param offsets the scanline index from ega_index_lines()
+/// @return 0 on success, otherwise an error code
+int egx_write(memstream_buf_t *dst, uint16_t width, uint16_t height, uint32_t ega_len, const uint32_t *offsets) {
+    if((NULL == dst) || (NULL == dst->data) || (NULL == offsets)) {
+        return -1; // NULL pointer error
+    }
+    if((dst->len < dst->pos) || ((dst->len - dst->pos) < egx_size(height))) {
+        return -2; // destination buffer is too small
+    }
+    uint8_t *p = &dst->data[dst->pos];
+    memcpy(p, EGX_MAGIC, 4);
+    put_le16(&p[4], width - 1);  // stored the same way as the EGA header
+    put_le16(&p[6], height - 1);
+    put_le32(&p[8], ega_len);
+    p += EGX_HDR_SZ;
+    for(int i = 0; i < height; i++) {
+        put_le32(p, offsets[i]);
+        p += sizeof(uint32_t);
+    }
+    dst->pos += egx_size(height);
+    return 0;
+}
+
+/// @brief reads the scanline index from a .EGX sidecar file, checking it belongs to the EGA file
+/// @param src memstream buffer holding the sidecar
+/// @param width  width of the EGA image in pixels
+/// @param height height of the EGA image in pixels or lines
+/// @param ega_len size of the EGA file
+/// @param offsets receives the scanline index, must hold height entries
+/// @return 0 on success, otherwise an error code
+int egx_read(memstream_buf_t *src, uint16_t width, uint16_t height, uint32_t ega_len, uint32_t *offsets) {
+    if((NULL == src) || (NULL == src->data) || (NULL == offsets)) {
+        return -1; // NULL pointer error
+    }
+    if((src->len < src->pos) || ((src->len - src->pos) < egx_size(height))) {
+        return -3; // not enough data
+    }
+    uint8_t *p = &src->data[src->pos];
+    if(memcmp(p, EGX_MAGIC, 4) || 
+       ((uint16_t)(get_le16(&p[4]) + 1) != width) || 
+       ((uint16_t)(get_le16(&p[6]) + 1) != height) || 
+       (get_le32(&p[8]) != ega_len)) {
+        return -5; // not an index for this file
+    }
+    p += EGX_HDR_SZ;
+    for(int i = 0; i < height; i++) {
+        offsets[i] = get_le32(p);
+        if(offsets[i] >= ega_len) return -4; // corrupt index
+        p += sizeof(uint32_t);
+    }
+    src->pos += egx_size(height);
+    return 0;
+}
+
+// a range of scanlines decoded by one thread of ega_decode_packed_mt()
+typedef struct {
+    memstream_buf_t src;     // the RLE data, positioned at the first line of the range
+    uint8_t     *dp;         // where the first line of the range is written
+    uint16_t    width;       // width of the image in pixels
+    uint16_t    height;      // height of the image in pixels or lines
+    size_t      stride;      // bytes per scanline in the output
+    int         first;       // first line to decode, counting up from the bottom
+    int         count;       // number of lines to decode
+    int         rval;        // result of the decode
+} decode_job_t;
+
+static THREAD_FUNC(decode_thread, arg) {
+    decode_job_t *job = arg;
+    job->rval = decode_packed_lines(job->dp, &job->src, job->width, job->height, job->stride, 
+                                    job->first, job->count);
+    THREAD_RETURN;
+}
+
+/// @brief decodes like ega_decode_packed(), splitting the scanlines between threads. the start
+///        of each range of lines comes from an index built by ega_index_lines()
+/// @param dst memstream buffer for the image, must be at least ega_decode_packed_size() bytes
+/// @param src memstream buffer holding the RLE data the index was built from
+/// @param width  width of the image in pixels
+/// @param height height of the image in pixels or lines
+/// @param stride bytes per scanline in the output, any padding is zeroed
+/// @param offsets the scanline index from ega_index_lines()
+/// @param threads number of threads to use, limited to EGA_MAX_THREADS
+/// @return 0 on success, otherwise an error code
+int ega_decode_packed_mt(memstream_buf_t *dst, memstream_buf_t *src, uint16_t width, uint16_t height, 
+                         size_t stride, const uint32_t *offsets, int threads) {
+    if((NULL == dst) || (NULL == dst->data) || (NULL == src) || (NULL == src->data) || (NULL == offsets)) {
+        return -1; // NULL pointer error
+    }
+    if((stride < EGA_LINE_BYTES(width)) || (dst->len < ega_decode_packed_size(stride, height))) {
+        return -2; // destination buffer is too small
+    }
+    if(threads > EGA_MAX_THREADS) threads = EGA_MAX_THREADS;
+    if(threads > height) threads = height;
+    if(threads < 1) threads = 1;
+
+    decode_job_t jobs[EGA_MAX_THREADS];
+    thread_t tid[EGA_MAX_THREADS];
+    bool running[EGA_MAX_THREADS] = {false};
+    int first = 0;
+    for(int t = 0; t < threads; t++) {
+        decode_job_t *job = &jobs[t];
+        job->src = *src;
+        job->src.pos = offsets[first];
+        job->width = width;
+        job->height = height;
+        job->stride = stride;
+        job->first = first;
+        job->count = (height - first) / (threads - t);
+        job->dp = &dst->data[first * stride];
+        first += job->count;
+        if(t) running[t] = (0 == thread_create(&tid[t], decode_thread, job));
+    }
+    // this thread takes the first range once the others are under way, and any whose thread failed to start
+    for(int t = 0; t < threads; t++) {
+        if(!running[t]) decode_thread(&jobs[t]);
+    }
+
+    int rval = 0;
+    for(int t = 0; t < threads; t++) {
+        if(running[t]) thread_join(tid[t]);
+        if(!rval) rval = jobs[t].rval;
+    }
+    if(rval) return rval;
+
+    src->pos = jobs[threads - 1].src.pos;
+    dst->pos = ega_decode_packed_size(stride, height);
+    return 0;
+}
+
+/// @brief starts decoding an EGA file a scanline at a time by reading the header
+/// @param es pointer to the stream state to set up
+/// @param fp handle to the EGA file, positioned at the start of the header
+/// @return 0 on success, otherwise an error code
+int ega_stream_open(ega_stream_t *es, FILE *fp) {
+    if((NULL == es) || (NULL == fp)) {
+        return -1; // NULL pointer error
+    }
+    uint8_t hdr[EGA_HDR_SZ];
+    if(1 != fread(hdr, EGA_HDR_SZ, 1, fp)) {
+        return -3; // not enough data for the header
+    }
+    memstream_buf_t ms = {EGA_HDR_SZ, 0, hdr};
+    es->fp = fp;
+    es->lines = 0;
+    return ega_read_header(&ms, &es->width, &es->height);
+}
+
+/// @brief decodes the next scanline of the stream, only the one line is read from the file
+/// @param es pointer to the stream state
+/// @param line buffer for the packed line, at least EGA_LINE_BYTES(width) bytes
+/// @return 0 on success, 1 when all lines have been read, otherwise an error code
+int ega_stream_read_line(ega_stream_t *es, uint8_t *line) {
+    if((NULL == es) || (NULL == es->fp) || (NULL == line)) {
+        return -1; // NULL pointer error
+    }
+    if(es->lines >= es->height) {
+        return 1; // end of image
+    }
+
+    size_t nbytes = EGA_LINE_BYTES(es->width);
+    size_t x = 0;
+    TRACE(1, "line %d\n", es->height - 1 - es->lines);
+    while(x < nbytes) {
+        int tc = getc(es->fp);
+        if(EOF == tc) return -3; // ran out of data
+        if(tc >= 128) {
+            tc = (tc & 0x7f) + 3;
+            if((x + tc) > nbytes) return -4; // code spans the end of the line
+            int tv = getc(es->fp);
+            if(EOF == tv) return -3; // ran out of data
+            TRACE(2, "%d [%02x]\n", tc, tv);
+            memset(&line[x], tv, tc);
+        } else {
+            tc += 1;
+            if((x + tc) > nbytes) return -4; // code spans the end of the line
+            if(1 != fread(&line[x], tc, 1, es->fp)) return -3; // ran out of data
+            TRACE(2, "%d [", tc);
+            for(int i = 0; i < tc; i++) {
+                TRACE(2, " %02x", line[x + i]);
+            }
+            TRACE(2, " ]\n");
+        }
+        x += tc;
+    }
+    es->lines++;
+    return 0;
+}
+
+/// @brief decodes the rest of the stream, handing each scanline to a callback as it is decoded.
+///        memory use is a single line no matter the size of the image
+/// @param es pointer to the stream state, from ega_stream_open()
+/// @param line buffer for the packed line, at least EGA_LINE_BYTES(width) bytes
+/// @param fn callback that receives each line, bottom line first
+/// @param ctx passed through to the callback
+/// @return 0 on success, otherwise an error code, or the callback's non zero return
+int ega_decode_stream(ega_stream_t *es, uint8_t *line, ega_line_fn fn, void *ctx) {
+    if((NULL == es) || (NULL == fn)) {
+        return -1; // NULL pointer error
+    }
+    int rval;
+    while(0 == (rval = ega_stream_read_line(es, line))) {
+        if(0 != (rval = fn(ctx, line, EGA_LINE_BYTES(es->width)))) {
+            return rval;
+        }
+    }
+    return (1 == rval) ? 0 : rval;
+}
+
+/// @brief finds the size of an EGA image from its header alone, for cataloguing files 
+///        without decoding them. with check set the code bytes are walked as well, to make sure 
+///        they make up a whole image and to find where it ends, but no pixels are expanded
+/// @param fp handle to the EGA file, positioned at the start of the header
+/// @param info receives the size of the image, both are left 0 if the header can't be read
+/// @param check also walk the codes of every scanline
+/// @return 0 on success, otherwise an error code
+int ega_probe(FILE *fp, ega_info_t *info, bool check) {
+    if((NULL == fp) || (NULL == info)) {
+        return -1; // NULL pointer error
+    }
+    *info = (ega_info_t){0, 0, 0};
+    ega_stream_t es;
+    int rval = ega_stream_open(&es, fp);
+    if(rval) return rval;
+    info->width = es.width;
+    info->height = es.height;
+    if(!check) return 0;
+
+    // literal strings are read through rather than seeked over, a seek would throw away 
+    // the FILE's buffer and the file may be a pipe
+    size_t nbytes = EGA_LINE_BYTES(es.width);
+    size_t len = EGA_HDR_SZ;
+    uint8_t skip[EGA_MAX_COPY];
+    for(int i = 0; i < es.height; i++) {
+        size_t x = 0;
+        while(x < nbytes) {
+            int tc = getc(fp);
+            if(EOF == tc) return -3;                     // ran out of data
+            size_t n, count;
+            if(tc >= 128) {
+                count = (tc & 0x7f) + 3;
+                n = 1; // just the value to be repeated
+            } else {
+                count = tc + 1;
+                n = count; // the literal string
+            }
+            if((x + count) > nbytes) return -4;          // code spans the end of the line
+            if(1 != fread(skip, n, 1, fp)) return -3;    // ran out of data
+            len += 1 + n;
+            x += count;
+        }
+    }
+    info->data_len = len;
+    return 0;
+}
+
+/// @brief writes a string of bytes as copy codes
+/// @param dst memstream buffer to append the codes to
+/// @param src pointer to the bytes to copy
+/// @param clen number of bytes, at least 1
+static void encode_copy(memstream_buf_t *dst, const uint8_t *src, size_t clen) {
+    while(clen > EGA_MAX_COPY) { // we have a run longer than the maximal encode length
+        dst->data[dst->pos++] = EGA_MAX_COPY - 1; // max copy length (encoded as len-1)
+        memcpy(&dst->data[dst->pos], src, EGA_MAX_COPY);
+        dst->pos += EGA_MAX_COPY;
+        src += EGA_MAX_COPY;
+        clen -= EGA_MAX_COPY;
+    }
+    dst->data[dst->pos++] = clen - 1; // copy length (encoded as len-1)
+    memcpy(&dst->data[dst->pos], src, clen);
+    dst->pos += clen;
+}
+
+/// @brief writes a run of a single byte value as run codes
+/// @param dst memstream buffer to append the codes to
+/// @param value the byte to be replicated
+/// @param rlen length of the run, at least EGA_MIN_RUN
+static void encode_run(memstream_buf_t *dst, uint8_t value, size_t rlen) {
+    while(rlen > EGA_MAX_RUN) {
+        size_t n = EGA_MAX_RUN;
+        // don't leave a tail too short to be encoded as a run
+        if((rlen - n) < EGA_MIN_RUN) n = rlen - EGA_MIN_RUN;
+        dst->data[dst->pos++] = (n - 3) + 0x80; // run length (encoded as len-3) + flag
+        dst->data[dst->pos++] = value;          // value of byte to be replicated
+        rlen -= n;
+    }
+    dst->data[dst->pos++] = (rlen - 3) + 0x80; // run length (encoded as len-3) + flag
+    dst->data[dst->pos++] = value;             // value of byte to be replicated
+}
+
+/// @brief encodes a single scanline of packed pixels
+/// @param dst memstream buffer to append the encoded data to
+/// @param src pointer to the packed pixels for the line
+/// @param nbytes length of the packed line in bytes
+static void encode_line(memstream_buf_t *dst, uint8_t *src, size_t nbytes) {
+    for(size_t x = 0; x < nbytes;) {
+        int rpos = 0;
+        int len = find_run(src, nbytes - x, &rpos);
+
+        if(rpos) { // we have bytes to copy before the found run (or we have no run)
+            encode_copy(dst, src, rpos);
+            src += rpos;
+            x += rpos; // adjust our position in the line
+        }
+        if(len) { // we found a run-length to encode
+            encode_run(dst, *src, len);
+            x += len;   // adjust our position in the line
+            src += len; // advance our pointer as well
+        }
+    }
+}
+
+/// @brief encodes a single scanline of packed pixels, for callers that keep lines apart 
+///        from their image. the output is what ega_encode() writes for the same line
+/// @param dst memstream buffer to append the codes to, must have ega_line_bound() bytes left
+/// @param line pointer to the packed pixels for the line
+/// @param width width of the image in pixels
+/// @return 0 on success, otherwise an error code
+int ega_encode_line(memstream_buf_t *dst, uint8_t *line, uint16_t width) {
+    if((NULL == dst) || (NULL == dst->data) || (NULL == line)) {
+        return -1; // NULL pointer error
+    }
+    if((dst->len < dst->pos) || ((dst->len - dst->pos) < line_bound(width))) {
+        return -2; // destination buffer is too small
+    }
+    encode_line(dst, line, EGA_LINE_BYTES(width));
+    return 0;
+}
+
+/// @brief worst case size of a single encoded scanline
+/// @param width width of the image in pixels
+/// @return size in bytes
+size_t ega_line_bound(uint16_t width) {
+    return line_bound(width);
+}
+
+/// @brief worst case size of a single encoded scanline
+/// @param width width of the image in pixels
+/// @return size in bytes
+static size_t line_bound(uint16_t width) {
+    size_t nbytes = EGA_LINE_BYTES(width);
+    return nbytes + (nbytes + EGA_MAX_COPY - 1) / EGA_MAX_COPY;
+}
+
+/// @brief packs and encodes a range of scanlines, in file order (bottom line first)
+/// @param dst memstream buffer to append the encoded data to
+/// @param src memstream buffer holding the image at 1 byte per pixel, top line first
+/// @param width  width of the image in pixels
+/// @param height height of the image in pixels or lines
+/// @param first index of the first line to encode, counting up from the bottom line
+/// @param count number of lines to encode
+static void encode_lines(memstream_buf_t *dst, memstream_buf_t *src, uint16_t width, uint16_t height, int first, int count) {
+    size_t nbytes = EGA_LINE_BYTES(width);
+    uint8_t line[EGA_MAX_LINE_BYTES];
+    for(int i = first; i < (first + count); i++) {
+        // pack the source pixels, 2 per byte, leftmost pixel in the high nibble
+        ega_pack_line(line, &src->data[(size_t)(height - 1 - i) * width], width);
+        encode_line(dst, line, nbytes);
+    }
+}
+
+/// @brief checks the buffers passed to the encoder and writes the image size prefix
+/// @return 0 on success, otherwise an error code
+static int encode_header(memstream_buf_t *dst, memstream_buf_t *src, uint16_t width, uint16_t height) {
+    if((NULL == dst) || (NULL == dst->data) || (NULL == src) || (NULL == src->data)) {
+        return -1; // NULL pointer error
+    }
+    if(src->len < ega_decode_size(width, height)) {
+        return -3; // not enough source data for the image size
+    }
+    if((dst->len < dst->pos) || ((dst->len - dst->pos) < ega_encode_bound(width, height))) {
+        return -2; // destination buffer is too small
+    }
+
+    // first add our image size prefix to the output stream
+    return ega_write_header(dst, width, height);
+}
+
+/// @brief encodes an image, header included, into the EGA format
+/// @param dst memstream buffer for the encoded file, must be at least ega_encode_bound() bytes
+/// @param src memstream buffer holding the image at 1 byte per pixel, top line first
+/// @param width  width of the image in pixels
+/// @param height height of the image in pixels or lines
+/// @return 0 on success, otherwise an error code
+int ega_encode(memstream_buf_t *dst, memstream_buf_t *src, uint16_t width, uint16_t height) {
+    int rval = encode_header(dst, src, width, height);
+    if(rval) return rval;
+
+    // line based RLE compression here, but stored bottom to top
+    encode_lines(dst, src, width, height, 0, height);
+    return 0;
+}
+
+/// @brief encodes a BI_RLE4 compressed BMP image, header included, into the EGA format without 
+///        decoding the whole image. each line is read in to a line buffer, the runs its codes
+///        describe become run codes directly, and only the bytes between them are searched
+/// @param dst memstream buffer for the encoded file, must be at least ega_encode_bound() bytes
+/// @param src memstream buffer holding the BI_RLE4 data, as from find_bmp_rle4()
+/// @param width  width of the image in pixels
+/// @param height height of the image in pixels or lines
+/// @param runs scratch space for the runs of a line, EGA_LINE_BYTES(width) entries
+/// @return 0 on success, otherwise an error code
+int ega_encode_rle4(memstream_buf_t *dst, memstream_buf_t *src, uint16_t width, uint16_t height, bmp_run_t *runs) {
+    if((NULL == dst) || (NULL == dst->data) || (NULL == src) || (NULL == src->data) || (NULL == runs)) {
+        return -1; // NULL pointer error
+    }
+    if((dst->len < dst->pos) || ((dst->len - dst->pos) < ega_encode_bound(width, height))) {
+        return -2; // destination buffer is too small
+    }
+
+    size_t nbytes = EGA_LINE_BYTES(width);
+    uint8_t line[EGA_MAX_LINE_BYTES];
+
+    uint8_t *p = &dst->data[dst->pos];
+    put_le16(&p[0], width - 1);
+    put_le16(&p[2], height - 1);
+    dst->pos += EGA_HDR_SZ;
+
+    // both formats store the lines bottom to top, so they are encoded in the order they are read
+    int rval = 0;
+    bool ended = false;
+    for(int i = 0; i < height; i++) {
+        size_t nruns = 0;
+        if(ended) { // an end of bitmap code leaves the rest of the lines empty
+            memset(line, 0, nbytes);
+            runs[0] = (bmp_run_t){0, nbytes};
+            nruns = 1;
+        } else if(0 > (rval = read_rle4_line(line, src, width, runs, &nruns))) {
+            break;
+        } else {
+            ended = (1 == rval);
+            rval = 0;
+        }
+
+        size_t x = 0;
+        for(size_t r = 0; r < nruns; r++) {
+            // a run may carry on in to the partly covered bytes either side of it
+            size_t pos = runs[r].pos;
+            size_t end = pos + runs[r].len;
+            if(pos < x) continue; // already taken in by the run before it
+            uint8_t v = line[pos];
+            while((pos > x) && (line[pos - 1] == v)) pos--;
+            while((end < nbytes) && (line[end] == v)) end++;
+            if((end - pos) < EGA_MIN_RUN) continue; // too short, it goes in with the bytes around it
+            if(pos > x) encode_line(dst, &line[x], pos - x);
+            encode_run(dst, v, end - pos);
+            x = end;
+        }
+        if(x < nbytes) encode_line(dst, &line[x], nbytes - x);
+    }
+    return rval;
+}
+
+// scratch space ega_encode_optimal() works a scanline in, carved out of the caller's buffer
+typedef struct {
+    uint32_t    *cost;       // fewest bytes the line can be encoded in from each byte to its end
+    uint8_t     *code;       // the code that starts the cheapest encoding from each byte
+    uint16_t    *litq;       // where a literal string from the current byte could end, cheapest first
+    uint16_t    *runq;       // where a run from the current byte could end, cheapest first
+} optimal_t;
+
+/// @brief size of the scratch space needed by ega_encode_optimal()
+/// @param width width of the image in pixels
+/// @return size in bytes
+size_t ega_optimal_scratch_size(uint16_t width) {
+    size_t n = EGA_LINE_BYTES(width) + 1;
+    return n * (sizeof(uint32_t) + sizeof(uint8_t) + 2 * sizeof(uint16_t));
+}
+
+/// @brief encodes a single scanline of packed pixels in the fewest bytes possible. working back 
+///        from the end of the line, the cheapest encoding from each byte is the cheaper of a literal 
+///        string or a run, plus the cheapest encoding from where it ends. both are a minimum over a 
+///        sliding window of end points, held in a queue each, so a line takes linear time
+/// @param dst memstream buffer to append the encoded data to
+/// @param src pointer to the packed pixels for the line
+/// @param nbytes length of the packed line in bytes
+/// @param op the scratch space
+static void encode_line_optimal(memstream_buf_t *dst, const uint8_t *src, size_t nbytes, optimal_t *op) {
+    uint32_t *cost = op->cost;
+    uint16_t *litq = op->litq;
+    uint16_t *runq = op->runq;
+    size_t lh = 0, lt = 0; // the queues are filled towards the back, ends are expired from the front
+    size_t rh = 0, rt = 0;
+    size_t rlen = 0;       // length of the run of equal bytes starting at the current byte
+
+    cost[nbytes] = 0;
+    for(size_t i = nbytes; i-- > 0;) {
+        // a literal string from i can end anywhere in i+1 to i+EGA_MAX_COPY, and costs 1 byte 
+        // plus its length, so the end with the least (end + cost[end]) is the cheapest
+        size_t j = i + 1;
+        while((lt > lh) && ((litq[lt - 1] + cost[litq[lt - 1]]) > (j + cost[j]))) lt--;
+        litq[lt++] = j;
+        while(litq[lh] > (i + EGA_MAX_COPY)) lh++;
+        uint32_t best = 1 + (litq[lh] - i) + cost[litq[lh]];
+        uint8_t code = (litq[lh] - i) - 1;
+
+        // a run from i can end anywhere in i+EGA_MIN_RUN up to the end of the equal bytes, 
+        // at most i+EGA_MAX_RUN, and always costs 2 bytes
+        rlen = ((i + 1) < nbytes) && (src[i] == src[i + 1]) ? rlen + 1 : 1;
+        if(1 == rlen) rh = rt = 0; // a new value, the ends of the last one can't be reached
+        if(rlen >= EGA_MIN_RUN) {
+            j = i + EGA_MIN_RUN;
+            while((rt > rh) && (cost[runq[rt - 1]] > cost[j])) rt--;
+            runq[rt++] = j;
+            while(runq[rh] > (i + EGA_MAX_RUN)) rh++;
+            // on a tie the run wins, it's the quicker of the 2 to decode
+            if((2 + cost[runq[rh]]) <= best) {
+                best = 2 + cost[runq[rh]];
+                code = (runq[rh] - i - EGA_MIN_RUN) + 0x80;
+            }
+        }
+        cost[i] = best;
+        op->code[i] = code;
+    }
+
+    // then follow the cheapest codes forward from the start of the line
+    uint8_t *dp = &dst->data[dst->pos];
+    for(size_t i = 0; i < nbytes;) {
+        uint8_t code = op->code[i];
+        *dp++ = code;
+        if(code & 0x80) {
+            *dp++ = src[i];
+            i += (code & 0x7f) + EGA_MIN_RUN;
+        } else {
+            memcpy(dp, &src[i], code + 1);
+            dp += code + 1;
+            i += code + 1;
+        }
+    }
+    dst->pos = dp - dst->data;
+}
+
+/// @brief encodes an image, header included, into the EGA format like ega_encode(), but picks 
+///        where each code starts and ends so every scanline is as small as it can be, rather 
+///        than taking each run as it is found. slower, for images that are encoded once and 
+///        loaded many times
+/// @param dst memstream buffer for the encoded file, must be at least ega_encode_bound() bytes
+/// @param src memstream buffer holding the image at 1 byte per pixel, top line first
+/// @param width  width of the image in pixels
+/// @param height height of the image in pixels or lines
+/// @param scratch scratch space, ega_optimal_scratch_size() bytes, aligned for a uint32_t
+/// @return 0 on success, otherwise an error code
+int ega_encode_optimal(memstream_buf_t *dst, memstream_buf_t *src, uint16_t width, uint16_t height, void *scratch) {
+    if(NULL == scratch) {
+        return -1; // NULL pointer error
+    }
+    int rval = encode_header(dst, src, width, height);
+    if(rval) return rval;
+
+    size_t nbytes = EGA_LINE_BYTES(width);
+    optimal_t op;
+    op.cost = scratch;
+    op.litq = (uint16_t *)&op.cost[nbytes + 1];
+    op.runq = &op.litq[nbytes + 1];
+    op.code = (uint8_t *)&op.runq[nbytes + 1];
+
+    uint8_t line[EGA_MAX_LINE_BYTES];
+    for(int i = 0; i < height; i++) {
+        // stored bottom to top, like ega_encode()
+        ega_pack_line(line, &src->data[(size_t)(height - 1 - i) * width], width);
+        encode_line_optimal(dst, line, nbytes, &op);
+    }
+    return 0;
+}
+
+// a range of scanlines encoded by one thread of ega_encode_mt()
+typedef struct {
+    memstream_buf_t *src;    // the source image
+    memstream_buf_t out;     // this thread's slice of the destination buffer
+    uint16_t    width;       // width of the image in pixels
+    uint16_t    height;      // height of the image in pixels or lines
+    int         first;       // first line to encode, counting up from the bottom
+    int         count;       // number of lines to encode
+} encode_job_t;
+
+static THREAD_FUNC(encode_thread, arg) {
+    encode_job_t *job = arg;
+    encode_lines(&job->out, job->src, job->width, job->height, job->first, job->count);
+    THREAD_RETURN;
+}
+
+/// @brief encodes an image like ega_encode(), splitting the scanlines between threads. since
+///        no RLE code crosses a scanline the output is identical to ega_encode(). each thread
+///        encodes into its own worst case sized slice of dst, which are then joined up in order,
+///        so no extra memory is needed
+/// @param dst memstream buffer for the encoded file, must be at least ega_encode_bound() bytes
+/// @param src memstream buffer holding the image at 1 byte per pixel, top line first
+/// @param width  width of the image in pixels
+/// @param height height of the image in pixels or lines
+/// @param threads number of threads to use, limited to EGA_MAX_THREADS
+/// @return 0 on success, otherwise an error code
+int ega_encode_mt(memstream_buf_t *dst, memstream_buf_t *src, uint16_t width, uint16_t height, int threads) {
+    if(threads > EGA_MAX_THREADS) threads = EGA_MAX_THREADS;
+    if(threads > height) threads = height;
+    if(threads <= 1) return ega_encode(dst, src, width, height);
+
+    int rval = encode_header(dst, src, width, height);
+    if(rval) return rval;
+
+    // make sure the kernels have been picked before the threads start using them
+    ega_kernel_name();
+
+    encode_job_t jobs[EGA_MAX_THREADS];
+    thread_t tid[EGA_MAX_THREADS];
+    bool running[EGA_MAX_THREADS] = {false};
+    size_t lbound = line_bound(width);
+    int first = 0;
+    for(int t = 0; t < threads; t++) {
+        encode_job_t *job = &jobs[t];
+        job->src = src;
+        job->width = width;
+        job->height = height;
+        job->first = first;
+        job->count = (height - first) / (threads - t);
+        job->out.data = &dst->data[dst->pos + first * lbound];
+        job->out.len = job->count * lbound;
+        job->out.pos = 0;
+        first += job->count;
+        if(t) running[t] = (0 == thread_create(&tid[t], encode_thread, job));
+    }
+    // this thread takes the first range once the others are under way, and any whose thread failed to start
+    for(int t = 0; t < threads; t++) {
+        if(!running[t]) encode_thread(&jobs[t]);
+    }
+    for(int t = 1; t < threads; t++) {
+        if(running[t]) thread_join(tid[t]);
+    }
+
+    // join the slices up, bottom line first as they were split
+    for(int t = 0; t < threads; t++) {
+        memmove(&dst->data[dst->pos], jobs[t].out.data, jobs[t].out.pos);
+        dst->pos += jobs[t].out.pos;
+    }
+    return 0;
+}
+
+/// @brief find the next run in the buffer passed in. this is the reference implementation
+///        the vectorized versions in simd.c must give the same results as
+/// @param buf pointer to the data
+/// @param len length of the data
+/// @param rpos index of the beginning of the run in the data
+/// @return  length of the run found
+int find_run_scalar(uint8_t *buf, size_t len, int *rpos) {
+    uint8_t lc = *buf++; // last char to compare to
+    int lp = 0;          // position of "last char"
+    int count = 1;       // lenght of run
+    size_t pos = 1;      // current position in buffer
+    while(pos < len) {
+        uint8_t cc = *buf++; // current char for comparison
+        // run has ended (or hasn't started yet)
+        if(lc != cc) {
+            // valid runs are >= 3
+            if(3 <= count) {
+                *rpos = lp;   // return the start position of the run
+                return count; // return the length of the run
+            }
+            // wasn't a valid run, so restart from current position
+            lp = pos;
+            count = 1;
+            lc = cc;
+        } else { // in a run
+            count++; // count it
+        }
+        pos++; // advance
+    }
+    // return our stop position if we didn't find any runs >= 3
+    if(3 > count) {
+        *rpos = pos; // return our end position
+        return 0;    // return a length of 0 as we don't have a valid run
+    }
+    // return last start position
+    *rpos = lp;   // return the start position of the run
+    return count; // return the length of the run
+}
+
+// each byte split in to its 2 pixels, high nibble first. kept as byte pairs rather 
+// than 16 bit values so a single 2 byte copy writes them in order on any cpu
+#define UNPACK1(B) {(B) >> 4, (B) & 0x0f}
+#define UNPACK4(B) UNPACK1(B), UNPACK1((B) + 1), UNPACK1((B) + 2), UNPACK1((B) + 3)
+#define UNPACK16(B) UNPACK4(B), UNPACK4((B) + 4), UNPACK4((B) + 8), UNPACK4((B) + 12)
+#define UNPACK64(B) UNPACK16(B), UNPACK16((B) + 16), UNPACK16((B) + 32), UNPACK16((B) + 48)
+const uint8_t ega_unpack_lut[256][2] = { UNPACK64(0), UNPACK64(64), UNPACK64(128), UNPACK64(192) };
+
+/// @brief unpacks a line of packed pixels to 1 byte per pixel, the reference implementation
+/// @param dp pointer to the output pixels, width bytes
+/// @param sp pointer to the packed pixels, EGA_LINE_BYTES(width) bytes
+/// @param width width of the line in pixels
+void ega_unpack_line_scalar(uint8_t *dp, const uint8_t *sp, uint16_t width) {
+    for(size_t x = 0; x < (width / 2); x++) {
+        memcpy(dp, ega_unpack_lut[*sp++], 2);
+        dp += 2;
+    }
+    if(width & 1) { // odd pixel end, only the high nibble is used
+        *dp = *sp >> 4;
+    }
+}
+
+/// @brief packs a line of 1 byte per pixel to 2 pixels per byte, leftmost pixel in the 
+///        high nibble, the reference implementation
+/// @param dp pointer to the output packed pixels, EGA_LINE_BYTES(width) bytes
+/// @param sp pointer to the pixels, width bytes
+/// @param width width of the line in pixels
+void ega_pack_line_scalar(uint8_t *dp, const uint8_t *sp, uint16_t width) {
+    for(size_t x = 0; x < (width / 2); x++) {
+        *dp++ = (sp[0] << 4) | (sp[1] & 0x0f);
+        sp += 2;
+    }
+    if(width & 1) { // odd pixel end, the low nibble is left empty
+        *dp = *sp << 4;
+    }
+}
+
+// swaps the bits of x picked out by mask with the bits s places above them
+static inline uint64_t delta_swap(uint64_t x, uint64_t mask, int s) {
+    uint64_t t = ((x >> s) ^ x) & mask;
+    return x ^ t ^ (t << s);
+}
+
+/// @brief transposes two groups of 8 packed pixels, read as a little endian 64 bit value, to 
+///        their bit planes. in each 32 bit half, bit b of pixel k starts at bit 8(k/2) + 4 + b 
+///        for an even k, 8(k/2) + b for an odd one, and ends at 8b + 7 - k, so byte b of the 
+///        half is plane b of the group with its leftmost pixel in the high bit. that moves each 
+///        of the 5 bits of the bit's position to another, some inverted, which is 4 delta swaps
+static inline uint64_t planes16(uint64_t x) {
+    x = delta_swap(x, 0x00000f0f00000f0fULL, 20);
+    x = delta_swap(x, 0x0000cccc0000ccccULL, 14);
+    x = delta_swap(x, 0x0033003300330033ULL, 10);
+    x = delta_swap(x, 0x00aa00aa00aa00aaULL, 7);
+    return x;
+}
+
+static inline uint64_t get_le64(const uint8_t *p) {
+    uint64_t v = 0;
+    for(int i = 7; i >= 0; i--) v = (v << 8) | p[i];
+    return v;
+}
+
+/// @brief splits a line of packed pixels in to its 4 bit planes, 8 pixels per byte with the 
+///        leftmost in the high bit, the reference implementation. bits past the end of the 
+///        line are left 0
+/// @param dp pointer to the line in plane 0, EGA_PLANE_BYTES(width) bytes
+/// @param plane_size bytes from each plane to the next
+/// @param sp pointer to the packed pixels, EGA_LINE_BYTES(width) bytes
+/// @param width width of the line in pixels
+void ega_planar_line_scalar(uint8_t *dp, size_t plane_size, const uint8_t *sp, uint16_t width) {
+    size_t n = EGA_LINE_BYTES(width);
+    size_t x = 0;
+    for(; (x + 8) <= (width / 2); x += 8) { // 16 pixels, 2 bytes of each plane
+        uint64_t v = planes16(get_le64(&sp[x]));
+        for(int p = 0; p < 4; p++) {
+            dp[p * plane_size + x / 4] = (uint8_t)(v >> (8 * p));
+            dp[p * plane_size + x / 4 + 1] = (uint8_t)(v >> (32 + 8 * p));
+        }
+    }
+    if(x < n) { // the tail, padded out with pixels of 0
+        uint8_t tail[8] = {0};
+        memcpy(tail, &sp[x], n - x);
+        if(width & 1) tail[n - x - 1] &= 0xf0; // odd pixel end, the low nibble isn't part of the line
+        uint64_t v = planes16(get_le64(tail));
+        bool two = (x / 4 + 1) < EGA_PLANE_BYTES(width);
+        for(int p = 0; p < 4; p++) {
+            dp[p * plane_size + x / 4] = (uint8_t)(v >> (8 * p));
+            if(two) dp[p * plane_size + x / 4 + 1] = (uint8_t)(v >> (32 + 8 * p));
+        }
+    }
+}
@@ -0,0 +1,143 @@
+/*
+ * eaega.h 
+ * encoder and decoder for the Electronic Arts EGA image format
+ * 
+ * This code is offered without warranty under the MIT License. Use it as you will 
+ * personally or commercially, just give credit if you do.
+ */
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include "memstream.h"
+#include "bmp.h"
+
+#ifndef EAEGA_H
+#define EAEGA_H
+
+#define EGA_HDR_SZ (2 * sizeof(uint16_t)) // width-1 and height-1 prefix
+#define EGA_MAX_COPY (128)                // longest literal string a token can hold
+#define EGA_MAX_RUN (130)                 // longest run a token can hold
+#define EGA_MIN_RUN (3)                   // shortest run a token can hold
+
+// bytes per scanline of packed 4 bit per pixel data
+#define EGA_LINE_BYTES(W) (((size_t)(W) + 1) / 2)
+// width is stored as a 16 bit value, so a packed line is never larger than this
+#define EGA_MAX_LINE_BYTES EGA_LINE_BYTES(0xffff)
+// bytes per scanline of one of the 4 bit planes, 8 pixels per byte
+#define EGA_PLANE_BYTES(W) (((size_t)(W) + 7) / 8)
+// lines or pixels left when N is scaled down by S, the first is always kept
+#define EGA_SCALED(N, S) ((uint16_t)(((size_t)(N) + (S) - 1) / (S)))
+
+// .EGX scanline index sidecar, a 4 byte signature, width-1 and height-1 as 16 bit values,
+// the size of the EGA file as 32 bits, then the 32 bit offset of each line in the EGA file, 
+// bottom line first. all values are little endian
+#define EGX_MAGIC "EGX\x1a"
+#define EGX_HDR_SZ (12)
+#define EGX_EXT ".EGX"
+
+// most threads the multithreaded encoder and decoder will use
+#define EGA_MAX_THREADS (64)
+
+// highest trace level compiled into the codec, 0 removes all trace output.
+// 1 traces each scanline, 2 also traces each RLE code
+#ifndef EAEGA_TRACE
+#define EAEGA_TRACE 0
+#endif
+
+// state for decoding an EGA file one scanline at a time
+typedef struct {
+    FILE        *fp;         // handle to the open EGA file
+    uint16_t    width;       // width of the image in pixels
+    uint16_t    height;      // height of the image in pixels or lines
+    uint16_t    lines;       // number of scanlines decoded so far
+} ega_stream_t;
+
+// what ega_probe() can tell about an EGA file without decoding it
+typedef struct {
+    uint16_t    width;       // width of the image in pixels
+    uint16_t    height;      // height of the image in pixels or lines
+    size_t      data_len;    // bytes of image data, header included, 0 unless the codes were checked
+} ega_info_t;
+
+// how often each length of code appears in an image, from ega_count_codes()
+typedef struct {
+    uint32_t    runs[EGA_MAX_RUN + 1];    // runs of each length, from EGA_MIN_RUN up
+    uint32_t    copies[EGA_MAX_COPY + 1]; // literal strings of each length, from 1 up
+} ega_code_hist_t;
+
+// a rectangle within an image, y counts down from the top line
+typedef struct {
+    uint16_t    x;
+    uint16_t    y;
+    uint16_t    width;
+    uint16_t    height;
+} ega_rect_t;
+
+// receives each decoded scanline, packed 2 pixels per byte, bottom line first.
+// returning non zero stops the decode
+typedef int (*ega_line_fn)(void *ctx, const uint8_t *line, size_t nbytes);
+
+// implementations of the inner loop kernels, EGA_KERNEL_AUTO picks the best one the cpu supports
+typedef enum {
+    EGA_KERNEL_AUTO = 0,
+    EGA_KERNEL_SCALAR,
+    EGA_KERNEL_SSE2,
+    EGA_KERNEL_AVX2,
+    EGA_KERNEL_NEON,
+} ega_kernel_t;
+
+// each packed byte split in to its 2 pixels, high nibble first
+extern const uint8_t ega_unpack_lut[256][2];
+
+// default EGA/VGA 16 colour palette
+extern const bmp_palette_entry_t ega_pal[16];
+
+int ega_set_trace(int level);
+int ega_read_header(memstream_buf_t *src, uint16_t *width, uint16_t *height);
+int ega_write_header(memstream_buf_t *dst, uint16_t width, uint16_t height);
+size_t ega_decode_size(uint16_t width, uint16_t height);
+size_t ega_encode_bound(uint16_t width, uint16_t height);
+int ega_decode(memstream_buf_t *dst, memstream_buf_t *src, uint16_t width, uint16_t height);
+size_t ega_decode_packed_size(size_t stride, uint16_t height);
+int ega_decode_packed(memstream_buf_t *dst, memstream_buf_t *src, uint16_t width, uint16_t height, size_t stride);
+size_t ega_planar_size(uint16_t width, uint16_t height);
+int ega_decode_planar(memstream_buf_t *dst, memstream_buf_t *src, uint16_t width, uint16_t height);
+int ega_pack_planes(memstream_buf_t *dst, const memstream_buf_t *src, uint16_t width, uint16_t height, size_t stride);
+int ega_index_lines(memstream_buf_t *src, uint16_t width, uint16_t height, uint32_t *offsets);
+int ega_decode_packed_mt(memstream_buf_t *dst, memstream_buf_t *src, uint16_t width, uint16_t height, 
+                         size_t stride, const uint32_t *offsets, int threads);
+int ega_encode(memstream_buf_t *dst, memstream_buf_t *src, uint16_t width, uint16_t height);
+size_t ega_line_bound(uint16_t width);
+int ega_encode_line(memstream_buf_t *dst, uint8_t *line, uint16_t width);
+int ega_decode_line(uint8_t *line, memstream_buf_t *src, uint16_t width);
+int ega_encode_mt(memstream_buf_t *dst, memstream_buf_t *src, uint16_t width, uint16_t height, int threads);
+size_t ega_optimal_scratch_size(uint16_t width);
+int ega_encode_optimal(memstream_buf_t *dst, memstream_buf_t *src, uint16_t width, uint16_t height, void *scratch);
+int ega_encode_rle4(memstream_buf_t *dst, memstream_buf_t *src, uint16_t width, uint16_t height, bmp_run_t *runs);
+int ega_count_codes(memstream_buf_t *src, uint16_t width, uint16_t height, ega_code_hist_t *hist);
+int ega_decode_thumb(memstream_buf_t *dst, memstream_buf_t *src, uint16_t width, uint16_t height, 
+                     int scale, size_t stride);
+int ega_decode_region(memstream_buf_t *dst, memstream_buf_t *src, uint16_t width, uint16_t height, 
+                      const uint32_t *offsets, const ega_rect_t *rect, size_t stride);
+size_t ega_rle4_bound(uint16_t width, uint16_t height);
+int ega_transcode_rle4(memstream_buf_t *dst, memstream_buf_t *src, uint16_t width, uint16_t height);
+size_t egx_size(uint16_t height);
+int egx_write(memstream_buf_t *dst, uint16_t width, uint16_t height, uint32_t ega_len, const uint32_t *offsets);
+int egx_read(memstream_buf_t *src, uint16_t width, uint16_t height, uint32_t ega_len, uint32_t *offsets);
+int ega_stream_open(ega_stream_t *es, FILE *fp);
+int ega_stream_read_line(ega_stream_t *es, uint8_t *line);
+int ega_decode_stream(ega_stream_t *es, uint8_t *line, ega_line_fn fn, void *ctx);
+int ega_probe(FILE *fp, ega_info_t *info, bool check);
+int ega_select_kernel(ega_kernel_t kernel);
+const char *ega_kernel_name(void);
+int find_run(uint8_t *buf, size_t len, int *rpos);
+int find_run_scalar(uint8_t *buf, size_t len, int *rpos);
+void ega_unpack_line(uint8_t *dp, const uint8_t *sp, uint16_t width);
+void ega_unpack_line_scalar(uint8_t *dp, const uint8_t *sp, uint16_t width);
+void ega_pack_line(uint8_t *dp, const uint8_t *sp, uint16_t width);
+void ega_pack_line_scalar(uint8_t *dp, const uint8_t *sp, uint16_t width);
+void ega_planar_line(uint8_t *dp, size_t plane_size, const uint8_t *sp, uint16_t width);
+void ega_planar_line_scalar(uint8_t *dp, size_t plane_size, const uint8_t *sp, uint16_t width);
+
+#endif
@@ -13,317 +13,920 @@
 #include <string.h>
 #include <ctype.h>
 #include "bmp.h"
+#include "eaega.h"
+#include "util.h"
+#include "thread.h"
+#include "batch.h"
+#include "stats.h"
+#include "archive.h"
+#include "server.h"
 
 #define OUTEXT ".BMP"
+#define PLNEXT ".PLN"
+#define INEXT ".EGA"
 
+// progress messages are left out in batch mode, where the files are converted side by side
+static bool quiet = false;
+#define INFO(...) do { if(!quiet) fprintf(stderr, __VA_ARGS__); } while(0)
+
+// settings from the command line
+typedef struct {
+    bool        stream;      // decode a scanline at a time
+    int         threads;     // number of threads to decode with
+    bool        index;       // write a .EGX scanline index instead of converting
+    bool        crop;        // only decode the rectangle in rect
+    ega_rect_t  rect;        // the part of the image to decode
+    bool        rle4;        // write a BI_RLE4 compressed BMP
+    int         scale;       // write a thumbnail this many times smaller each way, 1 for full size
+    bool        planar;      // write the 4 bit planes as EGA video memory holds them, rather than a BMP
+    bool        batch;       // convert every file named on the command line
+    bool        info;        // print the size of each file named rather than converting
+    bool        check;       // with info, also walk the codes to check each image is whole
+    stats_mode_t stats;      // print the timings and compression figures for each file
+    const char  *archive;    // archive to take the images from, NULL to read files
+    const char  *pack;       // archive to pack the files given in to, rather than converting them
+    const char  *list;       // name of a file listing the files to convert in batch mode
+    const char  *out_dir;    // directory for the output files in batch mode
+    int         workers;     // number of files to convert at once in batch mode
+    int         ahead;       // number of files to read ahead of the workers, -1 for twice the workers
+    const char  *serve;      // socket to answer conversion requests on, NULL to convert the files given
+} options_t;
+
+// a conversion's buffers, kept from one file to the next in batch mode
 typedef struct {
-    size_t      len;         // length of buffer in bytes
-    size_t      pos;         // current byte position in buffer
-    uint8_t     *data;       // pointer to bytes in memory
-} memstream_buf_t;
-
-// default EGA/VGA 16 colour palette
-static bmp_palette_entry_t ega_pal[16] = { 
-  {0x00,0x00,0x00,0x00}, {0xaa,0x00,0x00,0x00}, {0x00,0xaa,0x00,0x00}, {0xaa,0xaa,0x00,0x00}, 
-  {0x00,0x00,0xaa,0x00}, {0xaa,0x00,0xaa,0x00}, {0x00,0x55,0xaa,0x00}, {0xaa,0xaa,0xaa,0x00},
-  {0x55,0x55,0x55,0x00}, {0xff,0x55,0x55,0x00}, {0x55,0xff,0x55,0x00}, {0xff,0xff,0x55,0x00}, 
-  {0x55,0x55,0xff,0x00}, {0xff,0x55,0xff,0x00}, {0x55,0xff,0xff,0x00}, {0xff,0xff,0xff,0x00},
-};
-
-size_t filesize(FILE *f);
-void drop_extension(char *fn);
-char *filename(char *path);
-#define fclose_s(A) if(A) fclose(A); A=NULL
-#define free_s(A) if(A) free(A); A=NULL
-int save_bmp(const char *fn, memstream_buf_t *src, uint16_t width, uint16_t height, bmp_palette_entry_t *pal);
+    const options_t *opt;    // settings from the command line
+    arena_t     arena;       // every buffer of a conversion is carved out of this
+    size_t      in_bytes;    // size of the last file read
+    size_t      out_bytes;   // size of the last file written
+    conv_stats_t stats;      // timings and figures for the last file
+    const egr_t *arc;        // the archive the images are in, NULL for files
+    serve_req_t *req;        // the server request whose image is being converted, NULL to write a file
+} work_t;
+
+/// @brief prints the command line help
+/// @param prog name of the program
+static void usage(char *prog) {
+    printf("USAGE: %s [options] [infile] <outfile>\n", prog);
+    printf("       %s [options] --batch [files or directories...]\n", prog);
+    printf("       %s [--check] --info [files or directories...]\n", prog);
+    printf("       %s [--index] --pack ARCHIVE [files or directories...]\n", prog);
+    printf("       %s [options] --serve SOCKET\n", prog);
+    printf("[infile] is the name of the input file\n");
+    printf("<outfile> is optional and the name of the output file\n");
+    printf("either can be '-' for the standard input or output, which outfile defaults to if infile is '-'\n");
+    printf("if omitted, outfile will be named the same as infile with a '%s' extension\n", OUTEXT);
+    printf("options:\n");
+    printf("  --stream     decode a scanline at a time, memory use is a single line\n");
+    printf("  --threads N  decode the scanlines on N threads, 0 for one per cpu\n");
+    printf("  --index      write a '%s' scanline index for infile, rather than converting it\n", EGX_EXT);
+    printf("  --crop X,Y,W,H  only decode the given rectangle, Y counts down from the top\n");
+    printf("               the lines above and below it are skipped using the '%s' index if there is one\n", EGX_EXT);
+    printf("  --rle4       write a BI_RLE4 compressed BMP, transcoded straight from the EGA codes\n");
+    printf("               it can't be combined with --stream or --crop\n");
+    printf("  --scale N    write a thumbnail N times smaller each way, keeping every Nth line and pixel\n");
+    printf("               only the lines kept are decoded, it can't be combined with the three above\n");
+    printf("  --planar     write the 4 bit planes rather than a BMP, plane 0 first, each top line first\n");
+    printf("               and 8 pixels per byte, as EGA video memory holds them, with a '%s' extension\n", PLNEXT);
+    printf("               it can't be combined with --stream or --rle4\n");
+    printf("  --batch      convert every file given, the '%s' files of any directory given\n", INEXT);
+    printf("  --list FILE  in batch mode, also convert the files named in FILE, one per line\n");
+    printf("  --out DIR    in batch mode, write the output files to DIR rather than next to the input\n");
+    printf("  --workers N  in batch mode, convert N files at once, 0 for one per cpu\n");
+    printf("  --ahead N    in batch mode, read N files ahead of the workers, 0 to read each as it's converted\n");
+    printf("  --info       print the size of every file given, tab separated, reading only its header\n");
+    printf("               the columns are name, width, height, data bytes and status\n");
+    printf("  --check      with --info, also walk the codes of each file to check it is whole\n");
+    printf("  --pack FILE  pack every file given in to the '%s' archive FILE, with --index their\n", EGR_EXT);
+    printf("               scanline indexes too, rather than converting them\n");
+    printf("  --archive FILE  take the images from the '%s' archive FILE, the names given are of\n", EGR_EXT);
+    printf("               images in it, with --batch or --info and none given it is all of them\n");
+    printf("               it can't be combined with --stream or --index\n");
+    printf("  --serve SOCKET  answer conversion requests on the Unix domain socket SOCKET until\n");
+    printf("               interrupted, --workers N of them at once, with the other options as given\n");
+    printf("               it can't be combined with --stream, --index, --batch, --info, --pack or --archive\n");
+    printf("  --stats[=json]  print how long each part of the conversion took, the sizes, and how\n");
+    printf("               often each length of run and literal was used, to stderr as text or JSON\n");
+    printf("  -v           trace each scanline as it is decoded\n");
+    printf("  -vv          trace each RLE code as it is decoded\n");
+}
 
-int main(int argc, char *argv[]) {
+/// @brief gets the scanline index for an EGA file, from the archive or its .EGX sidecar if 
+///        there is a valid one, otherwise by walking the codes
+/// @param fi_name name of the EGA file
+/// @param member the image of an archive being converted, NULL for a file
+/// @param src memstream buffer holding the EGA file, positioned after the header
+/// @param width  width of the image in pixels
+/// @param height height of the image in pixels or lines
+/// @param offsets receives the index, must hold height entries
+/// @return 0 on success, otherwise an error code
+static int get_index(const char *fi_name, const egr_entry_t *member, memstream_buf_t *src, 
+                     uint16_t width, uint16_t height, uint32_t *offsets) {
+    if(member) {
+        if(member->index && (member->width == width) && (member->height == height) && 
+           (0 == egr_read_index(member, offsets))) {
+            INFO("Using the archive's index\n");
+            return 0;
+        }
+        memstream_buf_t ms = *src;
+        return ega_index_lines(&ms, width, height, offsets);
+    }
+
+    mapped_file_t mx;
+    char *fx_name = is_stdio(fi_name) ? NULL : change_extension(fi_name, EGX_EXT); // a pipe has no sidecar
+    if((NULL != fx_name) && (0 == map_file(&mx, fx_name))) {
+        int err = egx_read(&mx.buf, width, height, src->len, offsets);
+        unmap_file(&mx);
+        if(0 == err) {
+            INFO("Using index File: '%s'\n", fx_name);
+            free(fx_name);
+            return 0;
+        }
+        INFO("Ignoring index File: '%s', it doesn't match the image\n", fx_name);
+    }
+    free_s(fx_name);
+
+    memstream_buf_t ms = *src;
+    return ega_index_lines(&ms, width, height, offsets);
+}
+
+/// @brief writes the .EGX scanline index for an EGA file
+/// @param fi_name name of the EGA file, the index is named after it
+/// @param fi_data contents of the EGA file if it has already been read, otherwise NULL
+/// @param work receives the sizes of the files read and written
+/// @return 0 on success, otherwise an error code
+static int make_index(const char *fi_name, const memstream_buf_t *fi_data, work_t *work) {
     int rval = -1;
-    FILE *fi = NULL;
-    char *fi_name = NULL;
-    char *fo_name = NULL;
+    char *fx_name = NULL;
+    uint32_t *offsets = NULL;
+    mapped_file_t mf = {{0, 0, NULL}, false};
+    memstream_buf_t egx = {0, 0, NULL};
+    uint16_t width = 0;
+    uint16_t height = 0;
+
+    INFO("Opening EGA File: '%s'\n", fi_name);
+    if(NULL != fi_data) {
+        mf.buf = *fi_data;
+    } else if(map_file(&mf, fi_name)) {
+        fprintf(stderr, "Error: Unable to open input file\n");
+        goto CLEANUP;
+    }
+    stats_phase(&work->stats, PHASE_READ);
+    memstream_buf_t src = mf.buf;
+    if(ega_read_header(&src, &width, &height)) {
+        fprintf(stderr, "Error: Input file is too short\n");
+        goto CLEANUP;
+    }
+
+    // the header gives the size of both pieces, so they are carved out of the one block
+    if((NULL == (fx_name = change_extension(fi_name, EGX_EXT))) ||
+       arena_reserve(&work->arena, ARENA_SIZE(height * sizeof(uint32_t)) + ARENA_SIZE(egx_size(height))) ||
+       (NULL == (offsets = arena_alloc(&work->arena, height * sizeof(uint32_t)))) ||
+       arena_buf(&work->arena, &egx, egx_size(height))) {
+        fprintf(stderr, "Unable to allocate memory\n");
+        goto CLEANUP;
+    }
+    if(ega_index_lines(&src, width, height, offsets)) {
+        fprintf(stderr, "Error: Invalid or truncated EGA image data\n");
+        goto CLEANUP;
+    }
+    egx_write(&egx, width, height, mf.buf.len, offsets);
+    stats_phase(&work->stats, PHASE_CODE);
+
+    INFO("Creating index File: '%s'\n", fx_name);
+    if(write_file(fx_name, egx.data, egx.pos)) {
+        fprintf(stderr, "Error Unable write file\n");
+        goto CLEANUP;
+    }
+    stats_phase(&work->stats, PHASE_WRITE);
+    work->in_bytes = mf.buf.len;
+    work->out_bytes = egx.pos;
+    if(work->opt->stats) stats_count_codes(&work->stats, &mf.buf);
+
+    rval = 0;
+CLEANUP:
+    if(NULL == fi_data) unmap_file(&mf);
+    free_s(fx_name);
+    return rval;
+}
+
+/// @brief writes the output of a conversion, to the file named or, for a server request that 
+///        carried its image, back to the client
+/// @param work the conversion
+/// @param fo_name name of the file to create
+/// @param chunks the pieces of the output, in order
+/// @param count number of pieces
+/// @return 0 on success, otherwise an error code
+static int emit(work_t *work, const char *fo_name, const io_chunk_t *chunks, int count) {
+    return work->req ? serve_reply(work->req, chunks, count) : write_chunks(fo_name, chunks, count);
+}
+
+/// @brief converts an EGA file to a BMP file, holding the whole image in memory
+/// @param fi_name name of the EGA file to read
+/// @param fi_data contents of the EGA file if it has already been read, otherwise NULL
+/// @param member the image of an archive being converted, fi_data is its contents, NULL for a file
+/// @param fo_name name of the BMP file to create
+/// @param work buffers and settings for the conversion
+/// @return 0 on success, otherwise an error code
+static int convert(const char *fi_name, const memstream_buf_t *fi_data, const egr_entry_t *member, 
+                   const char *fo_name, work_t *work) {
+    int rval = -1;
+    const options_t *opt = work->opt;
+    mapped_file_t mf = {{0, 0, NULL}, false};
     memstream_buf_t img = {0, 0, NULL}; // decoded image
+    memstream_buf_t planes = {0, 0, NULL}; // decoded image split in to bit planes
     memstream_buf_t src = {0, 0, NULL}; // encoded image data
+    uint32_t *offsets = NULL; // scanline index for the threaded decoder
     uint16_t width = 0;
     uint16_t height = 0;
 
-    printf("Electronic Arts EGA image format to BMP image converter\n");
+    // map the input file, the decoder then reads straight from the page cache
+    // a file the batch has already read in is used as it is
+    INFO("Opening EGA File: '%s'", fi_name);
+    if(NULL != fi_data) {
+        mf.buf = *fi_data;
+    } else if(map_file(&mf, fi_name)) {
+        fprintf(stderr, "Error: Unable to open input file\n");
+        goto CLEANUP;
+    }
+    INFO("\tFile Size: %zu\n", mf.buf.len);
+    stats_phase(&work->stats, PHASE_READ);
+    src = mf.buf;
+    work->in_bytes = mf.buf.len;
 
-    if((argc < 2) || (argc > 3)) {
-        printf("USAGE: %s [infile] <outfile>\n", filename(argv[0]));
-        printf("[infile] is the name of the input file\n");
-        printf("<outfile> is optional and the name of the output file\n");
-        printf("if omitted, outfile will be named the same as infile with a '%s' extension\n", OUTEXT);
-        return -1;
+    if(ega_read_header(&src, &width, &height)) {
+        fprintf(stderr, "Error: Input file is too short\n");
+        goto CLEANUP;
     }
-    argv++; argc--; // consume the first arg (program name)
 
-    // get the filename strings from command line
-    int namelen = strlen(argv[0]);
-    if(NULL == (fi_name = calloc(1, namelen+1))) {
-        printf("Unable to allocate memory\n");
+    INFO("Resolution: %d x %d\n", width, height);
+
+    // the header gives the size of everything, so the buffers are all carved out of the one 
+    // block, which is only reallocated when a larger image comes along. the decoders write 
+    // every byte of the image, padding included, so it is never zeroed
+    uint16_t out_w = opt->crop ? opt->rect.width : EGA_SCALED(width, opt->scale);
+    uint16_t out_h = opt->crop ? opt->rect.height : EGA_SCALED(height, opt->scale);
+    // a whole image is decoded straight to the planes, anything else is decoded as usual and split after
+    bool need_index = !opt->rle4 && (1 == opt->scale) && ((opt->threads > 1) || opt->crop);
+    bool direct = opt->planar && !need_index && (1 == opt->scale);
+    size_t img_sz = opt->rle4 ? ega_rle4_bound(width, height) : 
+                    direct ? ega_planar_size(width, height) : ega_decode_packed_size(BMP4STRIDE(out_w), out_h);
+    size_t planes_sz = (opt->planar && !direct) ? ega_planar_size(out_w, out_h) : 0;
+    size_t need = ARENA_SIZE(img_sz) + (planes_sz ? ARENA_SIZE(planes_sz) : 0) + 
+                  (need_index ? ARENA_SIZE(height * sizeof(uint32_t)) : 0);
+    if(arena_reserve(&work->arena, need) || arena_buf(&work->arena, &img, img_sz) ||
+       (planes_sz && arena_buf(&work->arena, &planes, planes_sz))) {
+        fprintf(stderr, "Error: Unable to allocate buffer for output image\n");
         goto CLEANUP;
     }
-    strncpy(fi_name, argv[0], namelen);
-    argv++; argc--; // consume the arg (input file)
 
-    if(argc) { // output file name was provided
-        int namelen = strlen(argv[0]);
-        if(NULL == (fo_name = calloc(1, namelen+1))) {
-            printf("Unable to allocate memory\n");
+    if(opt->rle4) {
+        // the codes map across to BI_RLE4 one for one, so the pixels are never expanded
+        if(ega_transcode_rle4(&img, &src, width, height)) {
+            fprintf(stderr, "Error: Invalid or truncated EGA image data\n");
             goto CLEANUP;
         }
-        strncpy(fo_name, argv[0], namelen);
-        argv++; argc--; // consume the arg (input file)
-    } else { // no name was provded, so make one
-        if(NULL == (fo_name = calloc(1, namelen+5))) {
-            printf("Unable to allocate memory\n");
+        stats_phase(&work->stats, PHASE_CODE);
+        uint8_t hdr[BMP_HDR_SZ];
+        make_bmp_rle4_header(hdr, width, height, ega_pal, img.pos);
+        io_chunk_t chunks[2] = {{hdr, BMP_HDR_SZ}, {img.data, img.pos}};
+        if(emit(work, fo_name, chunks, 2)) {
+            fprintf(stderr, "Unable to write BMP image\n");
             goto CLEANUP;
         }
-        strncpy(fo_name, fi_name, namelen);
-        drop_extension(fo_name); // remove exisiting extension
-        strncat(fo_name, OUTEXT, namelen+4); // add bmp extension
+        stats_phase(&work->stats, PHASE_WRITE);
+        work->out_bytes = BMP_HDR_SZ + img.pos;
+        if(opt->stats) stats_count_codes(&work->stats, &mf.buf);
+        rval = 0;
+        goto CLEANUP;
     }
 
-    // open the input file
-    printf("Opening EGA File: '%s'", fi_name);
-    if(NULL == (fi = fopen(fi_name,"rb"))) {
-        printf("Error: Unable to open input file\n");
+    // the threaded and cropped decodes need to know where each line starts
+    if(need_index) {
+        offsets = arena_alloc(&work->arena, height * sizeof(uint32_t));
+        if(get_index(fi_name, member, &src, width, height, offsets)) {
+            fprintf(stderr, "Error: Invalid or truncated EGA image data\n");
+            goto CLEANUP;
+        }
+    }
+
+    // decode straight into the BMP pixel layout, both store the lines bottom to top
+    // and pack 2 pixels per byte, so the scanlines only need padding out
+    int err;
+    if(direct) {
+        err = ega_decode_planar(&img, &src, width, height);
+    } else if(opt->crop) {
+        err = ega_decode_region(&img, &src, width, height, offsets, &opt->rect, BMP4STRIDE(out_w));
+        if(-5 == err) {
+            fprintf(stderr, "Error: Crop rectangle is outside the image\n");
+            goto CLEANUP;
+        }
+    } else if(opt->scale > 1) {
+        // the lines between the ones kept are skipped by their code bytes, never expanded
+        err = ega_decode_thumb(&img, &src, width, height, opt->scale, BMP4STRIDE(out_w));
+    } else if(opt->threads > 1) {
+        // a quick first pass found where each line starts, so the lines can be
+        // split between the threads for the second pass that expands them
+        err = ega_decode_packed_mt(&img, &src, width, height, BMP4STRIDE(width), offsets, opt->threads);
+    } else {
+        err = ega_decode_packed(&img, &src, width, height, BMP4STRIDE(width));
+    }
+    if(err) {
+        fprintf(stderr, "Error: Invalid or truncated EGA image data\n");
         goto CLEANUP;
     }
+    if(planes_sz) ega_pack_planes(&planes, &img, out_w, out_h, BMP4STRIDE(out_w));
+    stats_phase(&work->stats, PHASE_CODE);
+
+    if(opt->planar) {
+        // the planes are written bare, ready to copy in to video memory a plane at a time
+        const memstream_buf_t *out = planes_sz ? &planes : &img;
+        io_chunk_t chunk = {out->data, out->pos};
+        if(emit(work, fo_name, &chunk, 1)) {
+            fprintf(stderr, "Unable to write planar image\n");
+            goto CLEANUP;
+        }
+        work->out_bytes = out->pos;
+    } else {
+        // the scanlines are already in order, padded and packed, so they go straight out after the header
+        uint8_t hdr[BMP_HDR_SZ];
+        make_bmp_header(hdr, out_w, out_h, ega_pal);
+        io_chunk_t chunks[2] = {{hdr, BMP_HDR_SZ}, {img.data, (size_t)BMP4STRIDE(out_w) * out_h}};
+        if(emit(work, fo_name, chunks, 2)) {
+            fprintf(stderr, "Unable to write BMP image\n");
+            goto CLEANUP;
+        }
+        work->out_bytes = BMP_HDR_SZ + img.pos;
+    }
+    stats_phase(&work->stats, PHASE_WRITE);
+    if(opt->stats) stats_count_codes(&work->stats, &mf.buf);
 
-    // determine size of image file
-    size_t fsz = filesize(fi);
-    printf("\tFile Size: %zu\n", fsz);
+    rval = 0;
+CLEANUP:
+    if(NULL == fi_data) unmap_file(&mf);
+    return rval;
+}
+
+// where the streaming decoder sends each scanline
+typedef struct {
+    FILE        *fp;         // handle to the BMP file being written
+    uint8_t     *buf;        // the line padded out to the BMP stride
+    size_t      stride;      // bytes per line in the BMP file
+    bool        timed;       // add up the time spent writing
+    double      write_time;  // seconds spent writing the lines
+} line_sink_t;
+
+/// @brief writes a decoded scanline to the BMP file
+static int write_line(void *ctx, const uint8_t *line, size_t nbytes) {
+    line_sink_t *sink = ctx;
+    double start = sink->timed ? timer_now() : 0.0;
+    if(line != sink->buf) memcpy(sink->buf, line, nbytes);
+    int rval = (1 == fwrite(sink->buf, sink->stride, 1, sink->fp)) ? 0 : -4;
+    if(sink->timed) sink->write_time += timer_now() - start;
+    return rval;
+}
+
+/// @brief converts an EGA file to a BMP file a scanline at a time, memory use is a 
+///        single line regardless of the image size
+/// @param fi_name name of the EGA file to read
+/// @param fo_name name of the BMP file to create
+/// @param work receives the sizes of the files read and written
+/// @return 0 on success, otherwise an error code
+static int convert_stream(const char *fi_name, const char *fo_name, work_t *work) {
+    int rval = -1;
+    FILE *fi = NULL;
+    line_sink_t sink = {NULL, NULL, 0, work->opt->stats != STATS_NONE, 0.0};
+    ega_stream_t es;
 
-    // allocate the packed image buffer based on the file size
-    if(NULL == (src.data = calloc(1, fsz))) {
-        printf("Unable to allocate memory\n");
+    // open the input file
+    INFO("Opening EGA File: '%s'\n", fi_name);
+    if(NULL == (fi = open_stdio(fi_name, "rb"))) {
+        fprintf(stderr, "Error: Unable to open input file\n");
         goto CLEANUP;
     }
-    src.len = fsz;
 
-    // read in the file
-    int nr = fread(src.data, src.len, 1, fi);
-    if(1 != nr) {
-        printf("Error Unable read input file\n");
+    if(ega_stream_open(&es, fi)) {
+        fprintf(stderr, "Error: Input file is too short\n");
         goto CLEANUP;
     }
+    stats_phase(&work->stats, PHASE_READ);
 
-    int16_t *par = (int16_t *)src.data;
-    width = *par++;
-    height = *par;
-    width++;
-    height++;
-    src.pos += 2 * sizeof(int16_t);
+    INFO("Resolution: %d x %d\n", es.width, es.height);
 
-    printf("Resolution: %d x %d\n", width, height);
+    // the padding at the end of the line is never written to, so zero it once up front
+    sink.stride = BMP4STRIDE(es.width);
+    if(arena_reserve(&work->arena, ARENA_SIZE(sink.stride)) ||
+       (NULL == (sink.buf = arena_alloc(&work->arena, sink.stride)))) {
+        fprintf(stderr, "Unable to allocate memory\n");
+        goto CLEANUP;
+    }
+    memset(&sink.buf[EGA_LINE_BYTES(es.width)], 0, sink.stride - EGA_LINE_BYTES(es.width));
 
-    img.len = width * height;
+    if(NULL == (sink.fp = open_stdio(fo_name, "wb"))) {
+        fprintf(stderr, "Error: Unable to open output file\n");
+        goto CLEANUP;
+    }
+    if(write_bmp_header(sink.fp, es.width, es.height, ega_pal)) {
+        fprintf(stderr, "Unable to write BMP image\n");
+        goto CLEANUP;
+    }
 
-    if(NULL == (img.data = calloc(1, img.len))) {
-        printf("Error: Unable to allocate buffer for output image\n");
+    // both formats store the lines bottom to top, so each line can be written as it is decoded
+    // the decoder is given the sink's buffer to decode into, so no copy is needed
+    int err = ega_decode_stream(&es, sink.buf, write_line, &sink);
+    if(-4 == err) {
+        fprintf(stderr, "Unable to write BMP image\n");
         goto CLEANUP;
+    } else if(err) {
+        fprintf(stderr, "Error: Invalid or truncated EGA image data\n");
+        goto CLEANUP;
+    }
+    // each line is read as it is decoded and written as soon as it is, so the reading is 
+    // part of the decode, and the time spent in the writes is taken back out of it
+    stats_phase(&work->stats, PHASE_CODE);
+    work->stats.time[PHASE_CODE] -= sink.write_time;
+    work->stats.time[PHASE_WRITE] += sink.write_time;
+    long in_pos = ftell(fi); // a pipe has no position to tell
+    work->in_bytes = (in_pos > 0) ? (size_t)in_pos : 0;
+    work->out_bytes = BMP_HDR_SZ + sink.stride * es.height;
+    work->stats.ega_bytes = work->in_bytes;
+    work->stats.width = es.width;
+    work->stats.height = es.height;
+
+    rval = 0;
+CLEANUP:
+    close_stdio(fi);
+    if(close_stdio(sink.fp) && (0 == rval)) {
+        fprintf(stderr, "Unable to write BMP image\n");
+        rval = -1;
     }
+    return rval;
+}
 
-    // image is stored from bottom scanline to top
-    // so start by pointing to the beginning of the last line.
-    uint8_t *dst = &img.data[(height-1) * width];
-    int x = 0;
-
-    // fortunately the image data is compressed on a per line
-    // basis, so we don't need to worry about the runs spanning
-    // a line boundary
-    while(src.pos < src.len) {
-        uint8_t tc = src.data[src.pos++];
-        if(tc >= 128) {
-            tc = (tc & 0x7f) + 3;
-            uint8_t tv = src.data[src.pos++];
-printf("%d [%02x]\n", tc, tv);
-            for(int i = 0; i< tc; i++) {
-                *dst++ = (tv >> 4) & 0x0f;
-                *dst++ = tv & 0x0f;
-                x += 2;
-            }
+/// @brief converts a single file the way the command line asked for, used for both a 
+///        single file and for each file of a batch
+/// @param ctx the work_t for the conversion
+/// @param fi_name name of the EGA file to read
+/// @param fi_data contents of the EGA file if the batch read it ahead, otherwise NULL
+/// @param fo_name name of the file to create
+/// @param in_bytes set to the size of the file read
+/// @param out_bytes set to the size of the file written
+/// @return 0 on success, otherwise an error code
+static int convert_file(void *ctx, const char *fi_name, memstream_buf_t *fi_data, const char *fo_name, 
+                        size_t *in_bytes, size_t *out_bytes) {
+    work_t *work = ctx;
+    int rval;
+    work->in_bytes = 0;
+    work->out_bytes = 0;
+    stats_start(&work->stats, fi_name);
+    if(work->arc) {
+        // an image in the archive is converted straight from the mapping, as if it had been read ahead
+        egr_entry_t member;
+        if(egr_find(work->arc, fi_name, &member)) {
+            fprintf(stderr, "Error: No image '%s' in the archive\n", fi_name);
+            rval = -1;
         } else {
-            tc += 1;
-printf("%d [", tc);
-            for(int i = 0; i< tc; i++) {
-                uint8_t tv = src.data[src.pos++];
-printf(" %02x", tv);
-                *dst++ = (tv >> 4) & 0x0f;
-                *dst++ = tv & 0x0f;
-                x += 2;
-            }
-printf(" ]\n");
-        }
-        if(x >= width) {
-            x = 0;
-            dst -= (2 * width); // move back to the start of the previous line
+            rval = convert(fi_name, &member.data, &member, fo_name, work);
         }
+    } else if(work->opt->index) {
+        rval = make_index(fi_name, fi_data, work);
+    } else if(work->opt->stream) {
+        rval = convert_stream(fi_name, fo_name, work);
+    } else {
+        rval = convert(fi_name, fi_data, NULL, fo_name, work);
     }
+    *in_bytes = work->in_bytes;
+    *out_bytes = work->out_bytes;
+    if((0 == rval) && work->opt->stats) {
+        work->stats.in_bytes = work->in_bytes;
+        work->stats.out_bytes = work->out_bytes;
+        stats_print(stderr, &work->stats, work->opt->stats);
+    }
+    return rval;
+}
 
-    if(save_bmp(fo_name, &img, width, height, ega_pal)) {
-            printf("Unable to write BMP image\n");
-            goto CLEANUP;
+/// @brief answers a single server request, converting the image it carried or the file it named
+/// @param ctx the work_t of the worker answering it
+/// @param req the request
+/// @return 0 on success, otherwise an error code
+static int serve_request(void *ctx, serve_req_t *req) {
+    work_t *work = ctx;
+    size_t in_bytes, out_bytes;
+    if(req->fi_name) {
+        return convert_file(work, req->fi_name, NULL, req->fo_name, &in_bytes, &out_bytes);
     }
+    // the image is converted from the request's buffer, and the BMP goes back the same way
+    work->req = req;
+    int rval = convert_file(work, STDIO_NAME, &req->data, STDIO_NAME, &in_bytes, &out_bytes);
+    work->req = NULL;
+    return rval;
+}
+
+/// @brief answers conversion requests on a Unix domain socket until the server is interrupted
+/// @param opt settings from the command line, applied to every request
+/// @return 0 once the server has shut down, otherwise an error code
+static int serve_files(const options_t *opt) {
+    int rval = -1;
+    int workers = opt->workers;
+    work_t *work = NULL;
+
+    // each worker keeps its own arena from one request to the next, like a batch
+    if(NULL == (work = calloc(workers, sizeof(work_t)))) {
+        fprintf(stderr, "Unable to allocate memory\n");
+        goto CLEANUP;
+    }
+    for(int i = 0; i < workers; i++) {
+        work[i].opt = opt;
+    }
+
+    // pick the kernels before the workers start, rather than have them race to on their first call
+    ega_select_kernel(EGA_KERNEL_AUTO);
+    quiet = true;
+    rval = serve_run(opt->serve, workers, serve_request, work, sizeof(work_t));
 
-    printf("Done\n");
-    rval = 0; // clean exit
 CLEANUP:
-    fclose_s(fi);
-    free_s(fi_name);
-    free_s(fo_name);
-    free_s(img.data);
-    free_s(src.data);
+    if(work) {
+        for(int i = 0; i < workers; i++) {
+            arena_free(&work[i].arena);
+        }
+    }
+    free_s(work);
     return rval;
 }
 
-/// @brief determins the size of the file
-/// @param f handle to an open file
-/// @return returns the size of the file
-size_t filesize(FILE *f) {
-    size_t szll, cp;
-    cp = ftell(f);           // save current position
-    fseek(f, 0, SEEK_END);   // find the end
-    szll = ftell(f);         // get positon of the end
-    fseek(f, cp, SEEK_SET);  // restore the file position
-    return szll;             // return position of the end as size
+/// @brief makes the list of files named on the command line, and in the list file if there is 
+///        one, with the directories expanded. the names of an archive's images are taken as 
+///        they are, and if none are named it is all of them
+/// @param nl the list to fill in, zeroed
+/// @param argc number of names left on the command line
+/// @param argv the names, files or directories
+/// @param opt settings from the command line
+/// @param arc the archive the images are in, NULL for files
+/// @return 0 on success, otherwise an error code
+static int make_list(name_list_t *nl, int argc, char *argv[], const options_t *opt, const egr_t *arc) {
+    for(int i = 0; i < argc; i++) {
+        if(arc ? batch_add_name(nl, argv[i]) : batch_add_path(nl, argv[i], INEXT)) {
+            fprintf(stderr, "Error: Unable to read directory '%s'\n", argv[i]);
+            return -1;
+        }
+    }
+    if(opt->list && batch_add_list(nl, opt->list, INEXT)) {
+        fprintf(stderr, "Error: Unable to read list file '%s'\n", opt->list);
+        return -1;
+    }
+    if(arc && (0 == argc) && (NULL == opt->list)) {
+        for(uint32_t i = 0; i < arc->count; i++) {
+            egr_entry_t e;
+            if(egr_entry(arc, i, &e) || batch_add_name(nl, e.name)) {
+                fprintf(stderr, "Unable to allocate memory\n");
+                return -1;
+            }
+        }
+    }
+    return 0;
 }
 
-/// @brief removes the extension from a filename
-/// @param fn sting pointer to the filename
-void drop_extension(char *fn) {
-    char *extension = strrchr(fn, '.');
-    if(NULL != extension) *extension = 0; // strip out the existing extension
+/// @brief converts all the files named on the command line, and in the list file if there is one
+/// @param argc number of names left on the command line
+/// @param argv the names, files or directories
+/// @param opt settings from the command line
+/// @param arc the archive the images are in, NULL for files
+/// @return 0 if every file was converted, otherwise an error code
+static int convert_batch(int argc, char *argv[], const options_t *opt, const egr_t *arc) {
+    int rval = -1;
+    name_list_t nl = {NULL, 0, 0};
+    int workers = opt->workers;
+    work_t *work = NULL;
+
+    if(make_list(&nl, argc, argv, opt, arc)) goto CLEANUP;
+
+    // each worker keeps its own arena, so it is only reallocated when a larger image comes along
+    if(NULL == (work = calloc(workers, sizeof(work_t)))) {
+        fprintf(stderr, "Unable to allocate memory\n");
+        goto CLEANUP;
+    }
+    for(int i = 0; i < workers; i++) {
+        work[i].opt = opt;
+        work[i].arc = arc;
+    }
+
+    // the streaming decoder reads the file itself, a scanline at a time, and an archive is already mapped
+    int ahead = (opt->ahead < 0) ? workers * 2 : opt->ahead;
+    if((opt->stream && !opt->index) || arc) ahead = 0;
+
+    // pick the kernels before the workers start, rather than have them race to on their first call
+    ega_select_kernel(EGA_KERNEL_AUTO);
+    quiet = true;
+    if(0 == batch_run(&nl, opt->out_dir, opt->index ? EGX_EXT : (opt->planar ? PLNEXT : OUTEXT), workers, ahead, 
+                      convert_file, work, sizeof(work_t))) {
+        rval = 0;
+    }
+
+CLEANUP:
+    if(work) {
+        for(int i = 0; i < workers; i++) {
+            arena_free(&work[i].arena);
+        }
+    }
+    free_s(work);
+    batch_free(&nl);
+    return rval;
 }
 
-/// @brief Returns the filename portion of a path
-/// @param path filepath string
-/// @return a pointer to the filename portion of the path string
-char *filename(char *path) {
-	int i;
-
-	if(path == NULL || path[0] == '\0')
-		return "";
-	for(i = strlen(path) - 1; i >= 0 && path[i] != '/'; i--);
-	if(i == -1)
-		return "";
-	return &path[i+1];
+/// @brief prints a line for every file named on the command line, and in the list file if there
+///        is one, giving its name, width, height, data bytes and status, separated by tabs. only
+///        the header of each file is read, unless the codes are to be checked too
+/// @param argc number of names left on the command line
+/// @param argv the names, files or directories
+/// @param opt settings from the command line
+/// @param arc the archive the images are in, NULL for files. the size of each is in its directory
+/// @return 0 if every file could be read, otherwise an error code
+static int probe_files(int argc, char *argv[], const options_t *opt, const egr_t *arc) {
+    int rval = -1;
+    name_list_t nl = {NULL, 0, 0};
+    int failed = 0;
+
+    if(make_list(&nl, argc, argv, opt, arc)) goto CLEANUP;
+
+    for(int i = 0; i < nl.count; i++) {
+        ega_info_t info = {0, 0, 0};
+        const char *status = "unreadable";
+        egr_entry_t e;
+        FILE *fp = arc ? NULL : open_stdio(nl.names[i], "rb");
+        if(arc && (0 == egr_find(arc, nl.names[i], &e))) {
+            info.width = e.width;
+            info.height = e.height;
+            status = "header";
+            if(opt->check) {
+                // walking the codes to the end of the image also gives its length
+                ega_code_hist_t hist;
+                memstream_buf_t ms = e.data;
+                int err = ega_read_header(&ms, &info.width, &info.height);
+                if(0 == err) err = ega_count_codes(&ms, info.width, info.height, &hist);
+                if(0 == err) {
+                    info.data_len = ms.pos;
+                    status = "ok";
+                } else {
+                    status = (-4 == err) ? "invalid" : "truncated";
+                }
+            }
+        } else if(NULL != fp) {
+            // unbuffered, so reading the header reads just its 4 bytes rather than a whole block
+            if(!opt->check) setvbuf(fp, NULL, _IONBF, 0);
+            int err = ega_probe(fp, &info, opt->check);
+            if(0 == err) {
+                status = opt->check ? "ok" : "header";
+            } else if(0 == info.width) {
+                status = "short";
+            } else {
+                status = (-4 == err) ? "invalid" : "truncated";
+            }
+            close_stdio(fp);
+        }
+
+        // anything that couldn't be found out is printed as '-', so every line has all the columns
+        printf("%s\t", nl.names[i]);
+        if(info.width) {
+            printf("%u\t%u\t", info.width, info.height);
+        } else {
+            printf("-\t-\t");
+        }
+        if(info.data_len) {
+            printf("%zu\t%s\n", info.data_len, status);
+        } else {
+            printf("-\t%s\n", status);
+        }
+        if((0 == info.width) || (opt->check && (0 == info.data_len))) failed++;
+    }
+
+    if(failed) {
+        fprintf(stderr, "%d of %d files failed\n", failed, nl.count);
+    } else {
+        rval = 0;
+    }
+CLEANUP:
+    batch_free(&nl);
+    return rval;
 }
 
-// allocate a header buffer large enough for all 3 parts, plus 16 bit padding at the start to 
-// maintian 32 bit alignment after the 16 bit signature.
-#define HDRBUFSZ (sizeof(bmp_signature_t) + sizeof(bmp_header_t))
+/// @brief packs all the files named on the command line, and in the list file if there is one,
+///        in to an archive, each under its name without the directories
+/// @param argc number of names left on the command line
+/// @param argv the names, files or directories
+/// @param opt settings from the command line
+/// @return 0 if every file was packed and the archive written, otherwise an error code
+static int pack_files(int argc, char *argv[], const options_t *opt) {
+    int rval = -1;
+    name_list_t nl = {NULL, 0, 0};
+    egr_builder_t b;
+    egr_builder_init(&b);
+
+    if(make_list(&nl, argc, argv, opt, NULL)) goto CLEANUP;
+    for(int i = 0; i < nl.count; i++) {
+        mapped_file_t mf;
+        if(map_file(&mf, nl.names[i])) {
+            fprintf(stderr, "Error: Unable to open input file '%s'\n", nl.names[i]);
+            goto CLEANUP;
+        }
+        int err = egr_add(&b, egr_base_name(nl.names[i]), mf.buf.data, mf.buf.len, opt->index);
+        unmap_file(&mf);
+        if(err) {
+            fprintf(stderr, "Error: Unable to pack '%s', %s\n", nl.names[i], 
+                    (-4 == err) ? "it isn't a whole EGA image" : "out of memory");
+            goto CLEANUP;
+        }
+    }
+    if(egr_save(&b, opt->pack)) {
+        fprintf(stderr, "Error: Unable to write archive '%s'\n", opt->pack);
+        goto CLEANUP;
+    }
+    fprintf(stderr, "Packed %d files in to '%s'\n", nl.count, opt->pack);
+    rval = 0;
 
-/// @brief saves the image pointed to by src as a BMP, assumes 16 colour 1 byte per pixel image data
-/// @param fn name of the file to create and write to
-/// @param src memstream buffer pointer to the source image data
-/// @param width  width of the image in pixels
-/// @param height height of the image in pixels or lines
-/// @param pal pointe to 16 entry palette
-/// @return 0 on success, otherwise an error code
-int save_bmp(const char *fn, memstream_buf_t *src, uint16_t width, uint16_t height, bmp_palette_entry_t *pal) {
-    int rval = 0;
-    FILE *fp = NULL;
-    uint8_t *buf = NULL; // line buffer, also holds header info
-
-    // do some basic error checking on the inputs
-    if((NULL == fn) || (NULL == src) || (NULL == src->data)) {
-        rval = -1;  // NULL pointer error
-        goto bmp_cleanup;
-    }
-
-    // try to open/create output file
-    if(NULL == (fp = fopen(fn,"wb"))) {
-        rval = -2;  // can't open/create output file
-        goto bmp_cleanup;
-    }
-
-    // stride is the bytes per line in the BMP file, which are padded
-    // out to 32 bit boundaries
-    uint32_t stride = ((width + 3) & (~0x0003)) / 2; // we get 2 pixels per byte for being 16 colour
-    uint32_t bmp_img_sz = (stride) * height;
-
-    // allocate a buffer to hold the header and a single scanline of data
-    // this could be optimized if necessary to only allocate the larger of
-    // the line buffer, or the header + padding as they are used at mutually
-    // exclusive times
-    if(NULL == (buf = calloc(1, HDRBUFSZ + stride + 2))) {
-        rval = -3;  // unable to allocate mem
-        goto bmp_cleanup;
-    }
-
-    // signature starts after padding to maintain 32bit alignment for the rest of the header
-    bmp_signature_t *sig = (bmp_signature_t *)&buf[stride + 2];
-
-    // bmp header starts after signature
-    bmp_header_t *bmp = (bmp_header_t *)&buf[stride + 2 + sizeof(bmp_signature_t)];
-
-    // setup the signature and DIB header fields
-    *sig = BMPFILESIG;
-    size_t palsz = sizeof(bmp_palette_entry_t) * 16;
-    bmp->dib.image_offset = HDRBUFSZ + palsz;
-    bmp->dib.file_size = bmp->dib.image_offset + bmp_img_sz;
-
-    // setup the bmi header fields
-    bmp->bmi.header_size = sizeof(bmi_header_t);
-    bmp->bmi.image_width = width;
-    bmp->bmi.image_height = height;
-    bmp->bmi.num_planes = 1;           // always 1
-    bmp->bmi.bits_per_pixel = 4;       // 16 colour image
-    bmp->bmi.compression = 0;          // uncompressed
-    bmp->bmi.bitmap_size = bmp_img_sz;
-    bmp->bmi.horiz_res = BMP96DPI;
-    bmp->bmi.vert_res = BMP96DPI;
-    bmp->bmi.num_colors = 16;          // palette has 16 colours
-    bmp->bmi.important_colors = 0;     // all colours are important
-
-    // write out the header
-    int nr = fwrite(sig, HDRBUFSZ, 1, fp);
-    if(1 != nr) {
-        rval = -4;  // unable to write file
-        goto bmp_cleanup;
-    }
-
-    // we're using our global palette here, wich is already in BMP format
-    // write out the palette
-    nr = fwrite(pal, palsz, 1, fp);
-    if(1 != nr) {
-        rval = -4;  // can't write file
-        goto bmp_cleanup;
-    }
-
-    // now we need to output the image scanlines. For maximum
-    // compatibility we do so in the natural order for BMP
-    // which is from bottom to top. For 16 colour/4 bit image
-    // the pixels are packed two per byte, left most pixel in
-    // the most significant nibble.
-    // start by pointing to start of last line of data
-    uint8_t *px = &src->data[src->len - width];
-    // loop through the lines
-    for(int y = 0; y < height; y++) {
-        memset(buf, 0, stride); // zero out the line in the output buffer
-        // loop through all the pixels for a line
-        // we are packing 2 pixels per byte, so width is half
-        for(int x = 0; x < ((width + 1) / 2); x++) {
-            uint8_t sp = *px++;          // get the first pixel
-            sp <<= 4;                    // shift to make room
-            if((x * 2 + 1) < width) {    // test for odd pixel end
-                sp |= (*px++) & 0x0f;    // get the next pixel
+CLEANUP:
+    egr_builder_free(&b);
+    batch_free(&nl);
+    return rval;
+}
+
+int main(int argc, char *argv[]) {
+    int rval = -1;
+    const char *fi_name = NULL;
+    const char *fo_name = NULL;
+    char *made_name = NULL; // output name made from the input name, if it wasn't given
+    options_t opt = {false, 1, false, false, {0, 0, 0, 0}, false, 1, false, false, false, false, STATS_NONE, NULL, NULL, 
+                     NULL, NULL, 1, -1, NULL};
+    mapped_file_t am = {{0, 0, NULL}, false}; // the archive, if the images are taken from one
+    egr_t arc;
+
+    fprintf(stderr, "Electronic Arts EGA image format to BMP image converter\n");
+
+    char *prog = filename(argv[0]);
+    argv++; argc--; // consume the first arg (program name)
+
+    // options come ahead of the file names
+    int verbose = 0;
+    while(argc && ('-' == argv[0][0]) && !is_stdio(argv[0])) { // a lone '-' is a file name
+        if(0 == strcmp(argv[0], "--stream")) {
+            opt.stream = true;
+        } else if((0 == strcmp(argv[0], "--threads")) && (argc > 1)) {
+            argv++; argc--; // consume the option, leaving its value
+            opt.threads = atoi(argv[0]);
+            if(opt.threads <= 0) opt.threads = cpu_count();
+        } else if(0 == strcmp(argv[0], "--index")) {
+            opt.index = true;
+        } else if((0 == strcmp(argv[0], "--crop")) && (argc > 1)) {
+            argv++; argc--; // consume the option, leaving its value
+            unsigned int x, y, w, h;
+            if((4 != sscanf(argv[0], "%u,%u,%u,%u", &x, &y, &w, &h)) ||
+               (x > UINT16_MAX) || (y > UINT16_MAX) || (w > UINT16_MAX) || (h > UINT16_MAX)) {
+                usage(prog);
+                return -1;
+            }
+            opt.crop = true;
+            opt.rect = (ega_rect_t){x, y, w, h};
+        } else if(0 == strcmp(argv[0], "--rle4")) {
+            opt.rle4 = true;
+        } else if((0 == strcmp(argv[0], "--scale")) && (argc > 1)) {
+            argv++; argc--; // consume the option, leaving its value
+            opt.scale = atoi(argv[0]);
+            if(opt.scale < 1) {
+                usage(prog);
+                return -1;
             }
-            buf[x] = sp;                 // write it to the line buffer
+        } else if(0 == strcmp(argv[0], "--planar")) {
+            opt.planar = true;
+        } else if(0 == strcmp(argv[0], "--batch")) {
+            opt.batch = true;
+        } else if(0 == strcmp(argv[0], "--stats")) {
+            opt.stats = STATS_TEXT;
+        } else if(0 == strcmp(argv[0], "--stats=json")) {
+            opt.stats = STATS_JSON;
+        } else if(0 == strcmp(argv[0], "--info")) {
+            opt.info = true;
+        } else if(0 == strcmp(argv[0], "--check")) {
+            opt.check = true;
+        } else if((0 == strcmp(argv[0], "--pack")) && (argc > 1)) {
+            argv++; argc--; // consume the option, leaving its value
+            opt.pack = argv[0];
+        } else if((0 == strcmp(argv[0], "--archive")) && (argc > 1)) {
+            argv++; argc--; // consume the option, leaving its value
+            opt.archive = argv[0];
+        } else if((0 == strcmp(argv[0], "--serve")) && (argc > 1)) {
+            argv++; argc--; // consume the option, leaving its value
+            opt.serve = argv[0];
+        } else if((0 == strcmp(argv[0], "--list")) && (argc > 1)) {
+            argv++; argc--; // consume the option, leaving its value
+            opt.list = argv[0];
+        } else if((0 == strcmp(argv[0], "--out")) && (argc > 1)) {
+            argv++; argc--; // consume the option, leaving its value
+            opt.out_dir = argv[0];
+        } else if((0 == strcmp(argv[0], "--workers")) && (argc > 1)) {
+            argv++; argc--; // consume the option, leaving its value
+            opt.workers = atoi(argv[0]);
+            if(opt.workers <= 0) opt.workers = cpu_count();
+        } else if((0 == strcmp(argv[0], "--ahead")) && (argc > 1)) {
+            argv++; argc--; // consume the option, leaving its value
+            opt.ahead = atoi(argv[0]);
+        } else if(0 == strcmp(argv[0], "-v")) {
+            verbose = 1;
+        } else if(0 == strcmp(argv[0], "-vv")) {
+            verbose = 2;
+        } else {
+            usage(prog);
+            return -1;
+        }
+        argv++; argc--; // consume the option
+    }
+
+    if((opt.rle4 && (opt.stream || opt.crop)) || ((opt.scale > 1) && (opt.rle4 || opt.stream || opt.crop)) ||
+       (opt.planar && (opt.stream || opt.rle4)) || (opt.archive && (opt.stream || opt.index || opt.pack))) {
+        usage(prog);
+        return -1;
+    }
+    if(opt.index && !opt.batch && (argc > 0) && is_stdio(argv[0])) {
+        fprintf(stderr, "Error: --index needs a named input file, the index is named after it\n");
+        return -1;
+    }
+    if(opt.serve) {
+        if(opt.stream || opt.index || opt.batch || opt.info || opt.check || opt.pack || opt.archive || (argc > 0)) {
+            usage(prog);
+            return -1;
         }
-        nr = fwrite(buf, stride, 1, fp); // write out the line
-        if(1 != nr) {
-            rval = -4;  // unable to write file
-            goto bmp_cleanup;
+        if(verbose && (ega_set_trace(verbose) < verbose)) {
+            fprintf(stderr, "Note: trace level %d requested, but only level %d was compiled in (EAEGA_TRACE)\n", 
+                   verbose, EAEGA_TRACE);
         }
-        px -= (width * 2); // move back to start of previous line
+        return serve_files(&opt);
+    }
+    if(opt.pack) {
+        if((argc < 1) && (NULL == opt.list)) {
+            usage(prog);
+            return -1;
+        }
+        return pack_files(argc, argv, &opt);
+    }
+    // with an archive, no names at all means every image in it
+    bool none_ok = (NULL != opt.archive);
+    if(opt.info) {
+        if((argc < 1) && (NULL == opt.list) && !none_ok) {
+            usage(prog);
+            return -1;
+        }
+    } else if(opt.check || (opt.batch ? ((argc < 1) && (NULL == opt.list) && !none_ok) : ((argc < 1) || (argc > 2)))) {
+        usage(prog);
+        return -1;
+    }
+
+    // the archive is mapped once, each image is then read straight from the mapping
+    if(opt.archive) {
+        if(map_file(&am, opt.archive)) {
+            fprintf(stderr, "Error: Unable to open archive '%s'\n", opt.archive);
+            return -1;
+        }
+        if(egr_open(&arc, &am.buf)) {
+            fprintf(stderr, "Error: '%s' isn't a valid archive\n", opt.archive);
+            goto CLEANUP;
+        }
+    }
+    if(opt.info) {
+        rval = probe_files(argc, argv, &opt, opt.archive ? &arc : NULL);
+        goto CLEANUP;
+    }
+
+    if(verbose && (ega_set_trace(verbose) < verbose)) {
+        fprintf(stderr, "Note: trace level %d requested, but only level %d was compiled in (EAEGA_TRACE)\n", 
+               verbose, EAEGA_TRACE);
+    }
+
+    if(opt.batch) {
+        rval = convert_batch(argc, argv, &opt, opt.archive ? &arc : NULL);
+        goto CLEANUP;
+    }
+
+    // the input name is used as given, the output name is made from it if there isn't one
+    // "-" reads from the standard input, and unless another name is given, writes to the standard output
+    fi_name = argv[0];
+    argv++; argc--; // consume the arg (input file)
+    if(argc) { // output file name was provided
+        fo_name = argv[0];
+        argv++; argc--; // consume the arg (output file)
+    } else if(is_stdio(fi_name)) {
+        fo_name = STDIO_NAME;
+    } else if(NULL == (fo_name = made_name = change_extension(fi_name, opt.planar ? PLNEXT : OUTEXT))) {
+        fprintf(stderr, "Unable to allocate memory\n");
+        goto CLEANUP;
     }
 
-bmp_cleanup:
-    fclose_s(fp);
-    free_s(buf);
+    work_t work = {&opt, {NULL, 0, 0}, 0, 0, {NULL}, opt.archive ? &arc : NULL, NULL};
+    size_t in_bytes, out_bytes;
+    int err = convert_file(&work, fi_name, NULL, fo_name, &in_bytes, &out_bytes);
+    arena_free(&work.arena);
+    if(err) goto CLEANUP;
+
+    fprintf(stderr, "Done\n");
+    rval = 0; // clean exit
+CLEANUP:
+    unmap_file(&am);
+    free_s(made_name);
     return rval;
 }
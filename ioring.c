@@ -0,0 +1,197 @@
+/*
+ * ioring.c
+ * a minimal io_uring for reading files asynchronously on Linux, driven straight through
+ * the system calls so no library is needed. elsewhere ioring_init() reports it unsupported
+ *
+ * This code is offered without warranty under the MIT License. Use it as you will
+ * personally or commercially, just give credit if you do.
+ */
+
+#include <stdbool.h>
+#include <string.h>
+#include "ioring.h"
+
+#ifdef __linux__
+#define HAVE_IO_URING
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <errno.h>
+
+// the kernel reads and writes the ring indexes from its side, so they need ordering
+#define load_acquire(P)     __atomic_load_n((P), __ATOMIC_ACQUIRE)
+#define store_release(P, V) __atomic_store_n((P), (V), __ATOMIC_RELEASE)
+
+#define PROBE_OPS (256)
+
+/// @brief checks the kernel can do the reads queued by ioring_read(). io_uring itself came in
+///        with 5.1, but its plain read only with 5.6, as did the probe, so a ring that can't be 
+///        probed can't do the reads either and would fail every one of them
+/// @param fd the ring
+/// @return true if reads are supported
+static bool read_supported(int fd) {
+    uint64_t buf[(sizeof(struct io_uring_probe) + PROBE_OPS * sizeof(struct io_uring_probe_op) + 7) / 8];
+    struct io_uring_probe *probe = (struct io_uring_probe *)buf;
+    memset(buf, 0, sizeof(buf));
+    if(0 > syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, probe, PROBE_OPS)) {
+        return false;
+    }
+    return (probe->last_op >= IORING_OP_READ) && (probe->ops_len > IORING_OP_READ) &&
+           (probe->ops[IORING_OP_READ].flags & IO_URING_OP_SUPPORTED);
+}
+#endif
+
+/// @brief sets up a ring
+/// @param r pointer to the ring to set up, release it with ioring_close()
+/// @param depth number of reads that can be in flight at once
+/// @return 0 on success, -6 if io_uring or its read isn't available here, otherwise an error code
+int ioring_init(ioring_t *r, unsigned depth) {
+    if(NULL == r) {
+        return -1; // NULL pointer error
+    }
+    memset(r, 0, sizeof(ioring_t));
+    r->fd = -1;
+#ifdef HAVE_IO_URING
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    int fd = (int)syscall(__NR_io_uring_setup, depth, &p);
+    if(fd < 0) {
+        return -6; // not supported, or not allowed
+    }
+    r->fd = fd;
+    if(!read_supported(fd)) {
+        ioring_close(r);
+        return -6; // not supported
+    }
+
+    r->sq_ring_sz = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    r->cq_ring_sz = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    r->sqes_sz = p.sq_entries * sizeof(struct io_uring_sqe);
+    r->sq_ring = mmap(NULL, r->sq_ring_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    r->cq_ring = mmap(NULL, r->cq_ring_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+    r->sqes = mmap(NULL, r->sqes_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if((MAP_FAILED == r->sq_ring) || (MAP_FAILED == r->cq_ring) || (MAP_FAILED == r->sqes)) {
+        if(MAP_FAILED == r->sq_ring) r->sq_ring = NULL;
+        if(MAP_FAILED == r->cq_ring) r->cq_ring = NULL;
+        if(MAP_FAILED == r->sqes) r->sqes = NULL;
+        ioring_close(r);
+        return -6; // not supported, or not allowed
+    }
+
+    uint8_t *sq = r->sq_ring;
+    uint8_t *cq = r->cq_ring;
+    r->sq_head = (unsigned *)&sq[p.sq_off.head];
+    r->sq_tail = (unsigned *)&sq[p.sq_off.tail];
+    r->sq_mask = (unsigned *)&sq[p.sq_off.ring_mask];
+    r->sq_array = (unsigned *)&sq[p.sq_off.array];
+    r->cq_head = (unsigned *)&cq[p.cq_off.head];
+    r->cq_tail = (unsigned *)&cq[p.cq_off.tail];
+    r->cq_mask = (unsigned *)&cq[p.cq_off.ring_mask];
+    r->cqes = &cq[p.cq_off.cqes];
+    return 0;
+#else
+    (void)depth;
+    return -6; // not supported
+#endif
+}
+
+/// @brief queues a read, it is handed to the kernel by the next ioring_submit()
+/// @param r pointer to the ring
+/// @param fd file to read from
+/// @param buf where to read to
+/// @param len number of bytes to read
+/// @param offset where in the file to read from
+/// @param tag returned with the read's completion by ioring_reap()
+/// @return 0 on success, -4 if the submission queue is full, otherwise an error code
+int ioring_read(ioring_t *r, int fd, void *buf, unsigned len, uint64_t offset, uint64_t tag) {
+    if((NULL == r) || (r->fd < 0) || (NULL == buf)) {
+        return -1; // NULL pointer error
+    }
+#ifdef HAVE_IO_URING
+    unsigned tail = *r->sq_tail; // only we write the tail
+    if((tail - load_acquire(r->sq_head)) > *r->sq_mask) {
+        return -4; // queue is full
+    }
+    unsigned i = tail & *r->sq_mask;
+    struct io_uring_sqe *sqe = &((struct io_uring_sqe *)r->sqes)[i];
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)buf;
+    sqe->len = len;
+    sqe->off = offset;
+    sqe->user_data = tag;
+    r->sq_array[i] = i;
+    store_release(r->sq_tail, tail + 1);
+    r->queued++;
+    return 0;
+#else
+    (void)fd; (void)len; (void)offset; (void)tag;
+    return -6; // not supported
+#endif
+}
+
+/// @brief hands the queued reads to the kernel, and optionally waits for completions
+/// @param r pointer to the ring
+/// @param wait number of completions to wait for, 0 to return straight away
+/// @return 0 on success, otherwise an error code
+int ioring_submit(ioring_t *r, unsigned wait) {
+    if((NULL == r) || (r->fd < 0)) {
+        return -1; // NULL pointer error
+    }
+#ifdef HAVE_IO_URING
+    unsigned flags = wait ? IORING_ENTER_GETEVENTS : 0;
+    long n;
+    while(0 > (n = syscall(__NR_io_uring_enter, r->fd, r->queued, wait, flags, NULL, 0))) {
+        if(EINTR != errno) {
+            return -3; // unable to submit
+        }
+    }
+    // the kernel stops at an entry it turns down, which completes with the error, and leaves 
+    // the ones after it queued for the next call
+    r->queued -= ((unsigned long)n < r->queued) ? (unsigned)n : r->queued;
+    return 0;
+#else
+    (void)wait;
+    return -6; // not supported
+#endif
+}
+
+/// @brief takes the next completed read off the ring, if there is one
+/// @param r pointer to the ring
+/// @param tag set to the tag the read was queued with
+/// @param res set to the bytes read, or a negative errno if the read failed
+/// @return 1 if a completion was taken, 0 if there were none
+int ioring_reap(ioring_t *r, uint64_t *tag, int *res) {
+    if((NULL == r) || (r->fd < 0) || (NULL == tag) || (NULL == res)) {
+        return 0;
+    }
+#ifdef HAVE_IO_URING
+    unsigned head = *r->cq_head; // only we write the head
+    if(head == load_acquire(r->cq_tail)) {
+        return 0;
+    }
+    struct io_uring_cqe *cqe = &((struct io_uring_cqe *)r->cqes)[head & *r->cq_mask];
+    *tag = cqe->user_data;
+    *res = cqe->res;
+    store_release(r->cq_head, head + 1);
+    return 1;
+#else
+    return 0;
+#endif
+}
+
+/// @brief releases a ring, any reads still in flight should be reaped first
+/// @param r pointer to the ring
+void ioring_close(ioring_t *r) {
+    if(NULL == r) return;
+#ifdef HAVE_IO_URING
+    if(r->sqes) munmap(r->sqes, r->sqes_sz);
+    if(r->cq_ring) munmap(r->cq_ring, r->cq_ring_sz);
+    if(r->sq_ring) munmap(r->sq_ring, r->sq_ring_sz);
+    if(r->fd >= 0) close(r->fd);
+#endif
+    memset(r, 0, sizeof(ioring_t));
+    r->fd = -1;
+}
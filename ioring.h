@@ -0,0 +1,41 @@
+/*
+ * ioring.h
+ * a minimal io_uring for reading files asynchronously on Linux, driven straight through
+ * the system calls so no library is needed. elsewhere ioring_init() reports it unsupported
+ *
+ * This code is offered without warranty under the MIT License. Use it as you will
+ * personally or commercially, just give credit if you do.
+ */
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef IORING_H
+#define IORING_H
+
+// a submission and completion queue pair shared with the kernel
+typedef struct {
+    int         fd;          // the ring, -1 if it isn't set up
+    unsigned    *sq_head;    // submission queue, the kernel consumes from the head
+    unsigned    *sq_tail;    // and we produce at the tail
+    unsigned    *sq_mask;
+    unsigned    *sq_array;   // indexes in to sqes of the queued entries
+    unsigned    *cq_head;    // completion queue, we consume from the head
+    unsigned    *cq_tail;    // and the kernel produces at the tail
+    unsigned    *cq_mask;
+    void        *sqes;       // the submission entries
+    void        *cqes;       // the completion entries
+    void        *sq_ring;    // mapping of the submission queue
+    size_t      sq_ring_sz;
+    void        *cq_ring;    // mapping of the completion queue
+    size_t      cq_ring_sz;
+    size_t      sqes_sz;     // size of the mapping of the submission entries
+    unsigned    queued;      // entries queued since the last ioring_submit()
+} ioring_t;
+
+int ioring_init(ioring_t *r, unsigned depth);
+int ioring_read(ioring_t *r, int fd, void *buf, unsigned len, uint64_t offset, uint64_t tag);
+int ioring_submit(ioring_t *r, unsigned wait);
+int ioring_reap(ioring_t *r, uint64_t *tag, int *res);
+void ioring_close(ioring_t *r);
+
+#endif
@@ -0,0 +1,20 @@
+/*
+ * memstream.h 
+ * simple in memory byte stream used to pass buffers between the codec and file handlers
+ * 
+ * This code is offered without warranty under the MIT License. Use it as you will 
+ * personally or commercially, just give credit if you do.
+ */
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef MEMSTREAM_H
+#define MEMSTREAM_H
+
+typedef struct {
+    size_t      len;         // length of buffer in bytes
+    size_t      pos;         // current byte position in buffer
+    uint8_t     *data;       // pointer to bytes in memory
+} memstream_buf_t;
+
+#endif
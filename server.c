@@ -0,0 +1,332 @@
+/*
+ * server.c
+ * a long running conversion server on a Unix domain socket, a fixed pool of workers each
+ * taking a connection at a time and answering its requests in turn
+ *
+ * This code is offered without warranty under the MIT License. Use it as you will
+ * personally or commercially, just give credit if you do.
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include "server.h"
+#include "thread.h"
+#include "util.h"
+
+#ifndef _WIN32
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+
+#define SERVE_MAX_WORKERS (64)
+#define SERVE_BACKLOG (64)           // connections that can wait for a worker
+#define SERVE_MAX_IOV (WRITE_MAX_CHUNKS + 1) // a reply's header and its chunks
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL (0)             // SIGPIPE is ignored as well, for where this doesn't exist
+#endif
+
+static inline uint32_t get_le32(const uint8_t *p) { return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24); }
+static inline void put_le32(uint8_t *p, uint32_t v) { p[0] = v & 0xff; p[1] = (v >> 8) & 0xff; p[2] = (v >> 16) & 0xff; p[3] = v >> 24; }
+
+// shared by all the workers
+typedef struct {
+    int         fd;          // the listening socket
+    serve_fn    fn;          // handles a request
+    bool        stopping;    // the server is shutting down
+    int         conn[SERVE_MAX_WORKERS]; // the connection each worker is serving, -1 for none
+    mutex_t     lock;        // guards stopping and conn
+} server_t;
+
+// a worker's own state
+typedef struct {
+    server_t    *server;
+    int         id;          // which of the server's conn slots is this worker's
+    void        *ctx;        // the context passed to fn
+    uint8_t     *buf;        // holds the request, kept from one request to the next
+    size_t      cap;         // size of buf
+} serve_worker_t;
+
+/// @brief reads exactly len bytes from a connection
+/// @return 0 on success, 1 if the connection was closed before any were read, otherwise -1
+static int recv_all(int fd, uint8_t *buf, size_t len) {
+    size_t got = 0;
+    while(got < len) {
+        ssize_t n = recv(fd, &buf[got], len - got, 0);
+        if(n > 0) {
+            got += n;
+        } else if(0 == n) {
+            return got ? -1 : 1; // closed, part way in to a request or between them
+        } else if(EINTR != errno) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/// @brief writes all of a list of buffers to a connection, with as few system calls as it takes
+/// @return 0 on success, otherwise -1
+static int send_all(int fd, struct iovec *iov, int count) {
+    while(count) {
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = count;
+        ssize_t n = sendmsg(fd, &msg, MSG_NOSIGNAL);
+        if(n < 0) {
+            if(EINTR == errno) continue;
+            return -1;
+        }
+        // step past what was sent, which may end part way through a buffer
+        while(count && ((size_t)n >= iov->iov_len)) {
+            n -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if(count) {
+            iov->iov_base = (uint8_t *)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+    return 0;
+}
+
+/// @brief sends a response with no output
+static int send_status(int fd, int status) {
+    uint8_t hdr[SERVE_REPLY_SZ];
+    put_le32(&hdr[0], (uint32_t)status);
+    put_le32(&hdr[4], 0);
+    struct iovec iov = {hdr, SERVE_REPLY_SZ};
+    return send_all(fd, &iov, 1);
+}
+
+/// @brief sends the output of a SERVE_DATA request back to the client, straight from the
+///        caller's buffers, as a successful response
+/// @param req the request being answered
+/// @param chunks the pieces of the output, in order
+/// @param count number of pieces, at most WRITE_MAX_CHUNKS
+/// @return 0 on success, otherwise an error code
+int serve_reply(serve_req_t *req, const io_chunk_t *chunks, int count) {
+    if((NULL == req) || ((count > 0) && (NULL == chunks)) || (count > WRITE_MAX_CHUNKS)) {
+        return -1; // NULL pointer error
+    }
+    if(req->replied) {
+        return -6; // already answered
+    }
+    size_t total = 0;
+    for(int i = 0; i < count; i++) total += chunks[i].len;
+    if(total > UINT32_MAX) {
+        return -7; // too large for the response
+    }
+
+    uint8_t hdr[SERVE_REPLY_SZ];
+    struct iovec iov[SERVE_MAX_IOV];
+    put_le32(&hdr[0], 0);
+    put_le32(&hdr[4], (uint32_t)total);
+    iov[0] = (struct iovec){hdr, SERVE_REPLY_SZ};
+    for(int i = 0; i < count; i++) {
+        iov[i + 1] = (struct iovec){(void *)chunks[i].data, chunks[i].len};
+    }
+    req->replied = true; // a response that fails part way can't be followed by another
+    return send_all(req->fd, iov, count + 1) ? -4 : 0;
+}
+
+/// @brief answers the requests of one connection until the client closes it
+/// @param w the worker
+/// @param fd the connection
+static void serve_conn(serve_worker_t *w, int fd) {
+    for(;;) {
+        uint8_t hdr[SERVE_HDR_SZ];
+        if(recv_all(fd, hdr, SERVE_HDR_SZ)) return; // closed, or the server is stopping
+        uint32_t type = get_le32(&hdr[0]);
+        size_t len_a = get_le32(&hdr[4]);
+        size_t len_b = get_le32(&hdr[8]);
+        bool ok = (SERVE_DATA == type) ? ((len_a <= SERVE_MAX_DATA) && (0 == len_b)) :
+                  (SERVE_PATHS == type) ? (len_a && len_b && (len_a <= SERVE_MAX_PATH) && (len_b <= SERVE_MAX_PATH)) :
+                  false;
+        if(!ok) {
+            fprintf(stderr, "Error: Bad request, type %u\n", (unsigned)type);
+            send_status(fd, -4);
+            return; // where the next request starts can't be known, so the connection is dropped
+        }
+
+        // the buffer only grows, so after the first few requests there is nothing to allocate
+        size_t need = len_a + len_b + 2; // room to terminate the names
+        if(need > w->cap) {
+            uint8_t *buf = realloc(w->buf, need);
+            if(NULL == buf) {
+                fprintf(stderr, "Unable to allocate memory\n");
+                send_status(fd, -5);
+                return;
+            }
+            w->buf = buf;
+            w->cap = need;
+        }
+        if(recv_all(fd, w->buf, len_a + len_b)) return;
+
+        serve_req_t req = {fd, NULL, NULL, {0, 0, NULL}, false};
+        if(SERVE_DATA == type) {
+            req.data = (memstream_buf_t){len_a, 0, w->buf};
+        } else {
+            memmove(&w->buf[len_a + 1], &w->buf[len_a], len_b);
+            w->buf[len_a] = '\0';
+            w->buf[len_a + 1 + len_b] = '\0';
+            req.fi_name = (const char *)w->buf;
+            req.fo_name = (const char *)&w->buf[len_a + 1];
+        }
+        int rval = w->server->fn(w->ctx, &req);
+        if(!req.replied && send_status(fd, rval)) return;
+        if(req.replied && rval) return; // the response went out but the request failed after it
+    }
+}
+
+/// @brief takes connections one at a time and answers them, until the server stops
+static THREAD_FUNC(serve_worker, arg) {
+    serve_worker_t *w = arg;
+    server_t *s = w->server;
+    for(;;) {
+        int fd = accept(s->fd, NULL, NULL);
+        mutex_lock(&s->lock);
+        bool stopping = s->stopping;
+        if((fd >= 0) && !stopping) s->conn[w->id] = fd;
+        mutex_unlock(&s->lock);
+        if(stopping) {
+            if(fd >= 0) close(fd);
+            break;
+        }
+        if(fd < 0) continue; // interrupted, or the client went away while it waited
+
+        serve_conn(w, fd);
+        mutex_lock(&s->lock);
+        s->conn[w->id] = -1;
+        mutex_unlock(&s->lock);
+        close(fd);
+    }
+    free_s(w->buf);
+    THREAD_RETURN;
+}
+
+/// @brief runs a conversion server, listening on a Unix domain socket, until it gets SIGINT
+///        or SIGTERM. each of a fixed pool of workers takes a connection and answers its
+///        requests in turn, connections after that wait for a worker to be free. on the
+///        signal the open connections are closed for reading, any request being converted
+///        is finished and answered, and the socket is removed
+/// @param path name of the socket, an old socket of that name is replaced
+/// @param workers number of worker threads, limited to SERVE_MAX_WORKERS
+/// @param fn handles a single request
+/// @param ctxs array of one context per worker, each ctx_size bytes, passed to fn
+/// @param ctx_size size of a single context in bytes
+/// @return 0 once the server has shut down, otherwise an error code
+int serve_run(const char *path, int workers, serve_fn fn, void *ctxs, size_t ctx_size) {
+    if((NULL == path) || (NULL == fn) || (NULL == ctxs)) {
+        return -1; // NULL pointer error
+    }
+    if(workers < 1) workers = 1;
+    if(workers > SERVE_MAX_WORKERS) workers = SERVE_MAX_WORKERS;
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if(strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Error: Socket name '%s' is too long\n", path);
+        return -2;
+    }
+    strcpy(addr.sun_path, path);
+
+    // only a socket left over from an earlier run is removed, never any other kind of file
+    struct stat st;
+    if((0 == stat(path, &st)) && S_ISSOCK(st.st_mode)) unlink(path);
+
+    server_t s;
+    memset(&s, 0, sizeof(s));
+    s.fn = fn;
+    for(int t = 0; t < SERVE_MAX_WORKERS; t++) s.conn[t] = -1;
+    if((s.fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+        fprintf(stderr, "Error: Unable to create socket\n");
+        return -2;
+    }
+    if(bind(s.fd, (struct sockaddr *)&addr, sizeof(addr)) || listen(s.fd, SERVE_BACKLOG)) {
+        fprintf(stderr, "Error: Unable to listen on '%s'\n", path);
+        close(s.fd);
+        return -2;
+    }
+    mutex_init(&s.lock);
+
+    // the workers never see the signals, this thread waits for them. a client that goes
+    // away before its response is sent mustn't kill the server
+    sigset_t sigs, old_sigs;
+    sigemptyset(&sigs);
+    sigaddset(&sigs, SIGINT);
+    sigaddset(&sigs, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &sigs, &old_sigs);
+    void (*old_pipe)(int) = signal(SIGPIPE, SIG_IGN);
+
+    serve_worker_t w[SERVE_MAX_WORKERS];
+    thread_t tid[SERVE_MAX_WORKERS];
+    bool running[SERVE_MAX_WORKERS] = {false};
+    int started = 0;
+    for(int t = 0; t < workers; t++) {
+        w[t] = (serve_worker_t){&s, t, (uint8_t *)ctxs + t * ctx_size, NULL, 0};
+        running[t] = (0 == thread_create(&tid[t], serve_worker, &w[t]));
+        if(running[t]) started++;
+    }
+    int rval = 0;
+    if(started) {
+        fprintf(stderr, "Listening on '%s' with %d workers\n", path, started);
+        int sig;
+        sigwait(&sigs, &sig);
+        fprintf(stderr, "Shutting down\n");
+    } else {
+        fprintf(stderr, "Error: Unable to start any workers\n");
+        rval = -5;
+    }
+
+    // the workers waiting in accept() are woken by connecting to them, the ones serving a
+    // client by closing its connection for reading, so the request in hand still gets answered
+    mutex_lock(&s.lock);
+    s.stopping = true;
+    for(int t = 0; t < workers; t++) {
+        if(s.conn[t] >= 0) shutdown(s.conn[t], SHUT_RD);
+    }
+    mutex_unlock(&s.lock);
+    for(int t = 0; t < started; t++) {
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if(fd < 0) continue;
+        connect(fd, (struct sockaddr *)&addr, sizeof(addr));
+        close(fd);
+    }
+    for(int t = 0; t < workers; t++) {
+        if(running[t]) thread_join(tid[t]);
+    }
+
+    close(s.fd);
+    unlink(path);
+    mutex_destroy(&s.lock);
+    signal(SIGPIPE, old_pipe);
+    pthread_sigmask(SIG_SETMASK, &old_sigs, NULL);
+    return rval;
+}
+
+#else
+
+/// @brief a conversion server needs Unix domain sockets, which this build doesn't have
+int serve_reply(serve_req_t *req, const io_chunk_t *chunks, int count) {
+    (void)req; (void)chunks; (void)count;
+    return -1;
+}
+
+int serve_run(const char *path, int workers, serve_fn fn, void *ctxs, size_t ctx_size) {
+    (void)path; (void)workers; (void)fn; (void)ctxs; (void)ctx_size;
+    fprintf(stderr, "Error: The server isn't available on this platform\n");
+    return -1;
+}
+
+#endif
@@ -0,0 +1,49 @@
+/*
+ * server.h
+ * a long running conversion server on a Unix domain socket, so a stream of small images
+ * doesn't pay for starting a process for each
+ *
+ * This code is offered without warranty under the MIT License. Use it as you will
+ * personally or commercially, just give credit if you do.
+ */
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "memstream.h"
+#include "util.h"
+
+#ifndef SERVER_H
+#define SERVER_H
+
+// every request starts with a 12 byte header: its type and two lengths, all 32 bit little
+// endian. a client can send any number of requests on one connection, one after the other,
+// each is answered before the next is read
+#define SERVE_HDR_SZ (12)
+#define SERVE_DATA (1)               // convert the len_a bytes that follow, the output comes back
+#define SERVE_PATHS (2)              // convert the file named by the len_a bytes that follow to the
+                                     // file named by the len_b bytes after them
+// every response is the status as a signed 32 bit value, 0 on success, and the length of the
+// output that follows it, 0 for a SERVE_PATHS request or a failure
+#define SERVE_REPLY_SZ (8)
+
+#define SERVE_MAX_DATA (256 * 1024 * 1024) // largest image a request can carry
+#define SERVE_MAX_PATH (4096)        // longest file name a request can carry
+
+// a request being handled
+typedef struct {
+    int         fd;          // the client's connection
+    const char  *fi_name;    // name of the file to convert, NULL for a SERVE_DATA request
+    const char  *fo_name;    // name of the file to create, NULL for a SERVE_DATA request
+    memstream_buf_t data;    // the image sent with a SERVE_DATA request
+    bool        replied;     // serve_reply() has sent the response
+} serve_req_t;
+
+// handles a single request, ctx is the worker's own context, kept from one request to the next
+// so its buffers can be reused. the output of a SERVE_DATA request is sent with serve_reply(),
+// anything not answered that way gets a response with the status returned and no output
+typedef int (*serve_fn)(void *ctx, serve_req_t *req);
+
+int serve_reply(serve_req_t *req, const io_chunk_t *chunks, int count);
+int serve_run(const char *path, int workers, serve_fn fn, void *ctxs, size_t ctx_size);
+
+#endif
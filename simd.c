@@ -0,0 +1,437 @@
+/*
+ * simd.c 
+ * vectorized versions of the codec's inner loops (run search, nibble pack and unpack, bit planes), 
+ * and the runtime selection between them.
+ * each kernel must give exactly the same results as the scalar reference in eaega.c
+ * 
+ * This code is offered without warranty under the MIT License. Use it as you will 
+ * personally or commercially, just give credit if you do.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "eaega.h"
+#include "thread.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#include <immintrin.h>
+#if defined(__SSE2__) || defined(_M_X64)
+#define EGA_HAVE_SSE2
+#endif
+#if defined(__GNUC__) && defined(EGA_HAVE_SSE2) // the AVX2 kernel shares the SSE2 line kernels
+#define EGA_HAVE_AVX2
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#elif defined(__ARM_NEON) || defined(__aarch64__) || defined(_M_ARM64)
+#define EGA_NEON
+#include <arm_neon.h>
+#endif
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+static inline int ctz32(uint32_t v) { unsigned long i; _BitScanForward(&i, v); return (int)i; }
+static inline int ctz64(uint64_t v) { unsigned long i; _BitScanForward64(&i, v); return (int)i; }
+#else
+static inline int ctz32(uint32_t v) { return __builtin_ctz(v); }
+static inline int ctz64(uint64_t v) { return __builtin_ctzll(v); }
+#endif
+
+typedef int (*find_run_fn)(uint8_t *buf, size_t len, int *rpos);
+typedef void (*line_fn)(uint8_t *dp, const uint8_t *sp, uint16_t width);
+typedef void (*planar_fn)(uint8_t *dp, size_t plane_size, const uint8_t *sp, uint16_t width);
+
+/// @brief scalar search for the first position with 3 equal bytes in a row
+/// @return position of the start of the run, or len if there is none
+static size_t find_triple(const uint8_t *buf, size_t pos, size_t len) {
+    for(; (pos + 2) < len; pos++) {
+        if((buf[pos] == buf[pos + 1]) && (buf[pos] == buf[pos + 2])) return pos;
+    }
+    return len;
+}
+
+/// @brief scalar search for the end of a run
+/// @return position of the first byte that differs from val, or len
+static size_t find_end(const uint8_t *buf, size_t pos, size_t len, uint8_t val) {
+    while((pos < len) && (buf[pos] == val)) pos++;
+    return pos;
+}
+
+#ifdef EGA_HAVE_SSE2
+/// @brief SSE2 find_run, compares the data against itself shifted by 1 and 2 bytes,
+///        16 positions at a time. a set bit in both masks is the start of a run of 3
+static int find_run_sse2(uint8_t *buf, size_t len, int *rpos) {
+    if(len < 3) return find_run_scalar(buf, len, rpos);
+
+    size_t pos = 0;
+    size_t end;
+    for(; (pos + 18) <= len; pos += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i *)&buf[pos]);
+        __m128i b = _mm_loadu_si128((const __m128i *)&buf[pos + 1]);
+        __m128i c = _mm_loadu_si128((const __m128i *)&buf[pos + 2]);
+        uint32_t m = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, b), _mm_cmpeq_epi8(b, c)));
+        if(m) {
+            pos += ctz32(m);
+            goto found;
+        }
+    }
+    pos = find_triple(buf, pos, len);
+    if(pos >= len) {
+        *rpos = len; // return our end position
+        return 0;    // return a length of 0 as we don't have a valid run
+    }
+
+found:
+    // now find where the run ends, 16 bytes at a time
+    end = pos + 3;
+    __m128i v = _mm_set1_epi8(buf[pos]);
+    for(; (end + 16) <= len; end += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i *)&buf[end]);
+        uint32_t m = ~_mm_movemask_epi8(_mm_cmpeq_epi8(a, v)) & 0xffff;
+        if(m) {
+            end += ctz32(m);
+            *rpos = pos;
+            return end - pos;
+        }
+    }
+    end = find_end(buf, end, len, buf[pos]);
+    *rpos = pos;
+    return end - pos;
+}
+#endif
+
+#ifdef EGA_HAVE_AVX2
+/// @brief AVX2 find_run, same as the SSE2 version 32 positions at a time
+TARGET_AVX2 static int find_run_avx2(uint8_t *buf, size_t len, int *rpos) {
+    if(len < 3) return find_run_scalar(buf, len, rpos);
+
+    size_t pos = 0;
+    size_t end;
+    for(; (pos + 34) <= len; pos += 32) {
+        __m256i a = _mm256_loadu_si256((const __m256i *)&buf[pos]);
+        __m256i b = _mm256_loadu_si256((const __m256i *)&buf[pos + 1]);
+        __m256i c = _mm256_loadu_si256((const __m256i *)&buf[pos + 2]);
+        uint32_t m = _mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(a, b), _mm256_cmpeq_epi8(b, c)));
+        if(m) {
+            pos += ctz32(m);
+            goto found;
+        }
+    }
+    pos = find_triple(buf, pos, len);
+    if(pos >= len) {
+        *rpos = len; // return our end position
+        return 0;    // return a length of 0 as we don't have a valid run
+    }
+
+found:
+    // now find where the run ends, 32 bytes at a time
+    end = pos + 3;
+    __m256i v = _mm256_set1_epi8(buf[pos]);
+    for(; (end + 32) <= len; end += 32) {
+        __m256i a = _mm256_loadu_si256((const __m256i *)&buf[end]);
+        uint32_t m = ~(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(a, v));
+        if(m) {
+            end += ctz32(m);
+            *rpos = pos;
+            return end - pos;
+        }
+    }
+    end = find_end(buf, end, len, buf[pos]);
+    *rpos = pos;
+    return end - pos;
+}
+#endif
+
+#ifdef EGA_NEON
+/// @brief NEON has no movemask, narrowing the compare result by 4 bits gives a 64 bit mask
+///        with 4 bits per byte instead
+static inline uint64_t neon_mask(uint8x16_t eq) {
+    return vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(eq), 4)), 0);
+}
+
+/// @brief NEON find_run, same as the SSE2 version
+static int find_run_neon(uint8_t *buf, size_t len, int *rpos) {
+    if(len < 3) return find_run_scalar(buf, len, rpos);
+
+    size_t pos = 0;
+    size_t end;
+    for(; (pos + 18) <= len; pos += 16) {
+        uint8x16_t a = vld1q_u8(&buf[pos]);
+        uint8x16_t b = vld1q_u8(&buf[pos + 1]);
+        uint8x16_t c = vld1q_u8(&buf[pos + 2]);
+        uint64_t m = neon_mask(vandq_u8(vceqq_u8(a, b), vceqq_u8(b, c)));
+        if(m) {
+            pos += ctz64(m) / 4;
+            goto found;
+        }
+    }
+    pos = find_triple(buf, pos, len);
+    if(pos >= len) {
+        *rpos = len; // return our end position
+        return 0;    // return a length of 0 as we don't have a valid run
+    }
+
+found:
+    // now find where the run ends, 16 bytes at a time
+    end = pos + 3;
+    uint8x16_t v = vdupq_n_u8(buf[pos]);
+    for(; (end + 16) <= len; end += 16) {
+        uint64_t m = ~neon_mask(vceqq_u8(vld1q_u8(&buf[end]), v));
+        if(m) {
+            end += ctz64(m) / 4;
+            *rpos = pos;
+            return end - pos;
+        }
+    }
+    end = find_end(buf, end, len, buf[pos]);
+    *rpos = pos;
+    return end - pos;
+}
+#endif
+
+#ifdef EGA_HAVE_SSE2
+/// @brief SSE2 unpack, splits 16 bytes in to high and low nibbles and interleaves them
+static void unpack_line_sse2(uint8_t *dp, const uint8_t *sp, uint16_t width) {
+    size_t n = width / 2;
+    size_t x = 0;
+    const __m128i mask = _mm_set1_epi8(0x0f);
+    for(; (x + 16) <= n; x += 16) {
+        __m128i b = _mm_loadu_si128((const __m128i *)&sp[x]);
+        __m128i hi = _mm_and_si128(_mm_srli_epi16(b, 4), mask);
+        __m128i lo = _mm_and_si128(b, mask);
+        _mm_storeu_si128((__m128i *)&dp[x * 2], _mm_unpacklo_epi8(hi, lo));
+        _mm_storeu_si128((__m128i *)&dp[x * 2 + 16], _mm_unpackhi_epi8(hi, lo));
+    }
+    ega_unpack_line_scalar(&dp[x * 2], &sp[x], width - (x * 2)); // the tail of the line
+}
+
+/// @brief SSE2 pack, treats each pair of pixels as a 16 bit value and moves the
+///        second pixel down next to the first before narrowing back to bytes
+static void pack_line_sse2(uint8_t *dp, const uint8_t *sp, uint16_t width) {
+    size_t n = width / 2;
+    size_t x = 0;
+    const __m128i mask = _mm_set1_epi16(0x000f);
+    for(; (x + 16) <= n; x += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i *)&sp[x * 2]);
+        __m128i b = _mm_loadu_si128((const __m128i *)&sp[x * 2 + 16]);
+        a = _mm_or_si128(_mm_slli_epi16(_mm_and_si128(a, mask), 4), _mm_and_si128(_mm_srli_epi16(a, 8), mask));
+        b = _mm_or_si128(_mm_slli_epi16(_mm_and_si128(b, mask), 4), _mm_and_si128(_mm_srli_epi16(b, 8), mask));
+        _mm_storeu_si128((__m128i *)&dp[x], _mm_packus_epi16(a, b));
+    }
+    ega_pack_line_scalar(&dp[x], &sp[x * 2], width - (x * 2)); // the tail of the line
+}
+
+// the scalar kernel's delta swap, on both 64 bit halves at once
+#define DELTA_SWAP_SSE2(X, M, S) do { \
+        __m128i t = _mm_and_si128(_mm_xor_si128(_mm_srli_epi64(X, S), X), M); \
+        X = _mm_xor_si128(X, _mm_xor_si128(t, _mm_slli_epi64(t, S))); \
+    } while(0)
+
+/// @brief SSE2 bit plane split, 32 pixels at a time. the 4 delta swaps of the scalar kernel
+///        leave each group of 8 pixels as a byte of each plane, then 2 rounds of interleaving 
+///        the bytes gather each plane's 4 bytes together
+static void planar_line_sse2(uint8_t *dp, size_t plane_size, const uint8_t *sp, uint16_t width) {
+    size_t n = width / 2;
+    size_t x = 0;
+    const __m128i m20 = _mm_set1_epi64x(0x00000f0f00000f0fLL);
+    const __m128i m14 = _mm_set1_epi64x(0x0000cccc0000ccccLL);
+    const __m128i m10 = _mm_set1_epi64x(0x0033003300330033LL);
+    const __m128i m7 = _mm_set1_epi64x(0x00aa00aa00aa00aaLL);
+    for(; (x + 16) <= n; x += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)&sp[x]);
+        DELTA_SWAP_SSE2(v, m20, 20);
+        DELTA_SWAP_SSE2(v, m14, 14);
+        DELTA_SWAP_SSE2(v, m10, 10);
+        DELTA_SWAP_SSE2(v, m7, 7);
+        v = _mm_unpacklo_epi8(v, _mm_srli_si128(v, 8));
+        v = _mm_unpacklo_epi8(v, _mm_srli_si128(v, 8));
+        for(int p = 0; p < 4; p++) {
+            uint32_t b = (uint32_t)_mm_cvtsi128_si32(v);
+            memcpy(&dp[p * plane_size + x / 4], &b, 4);
+            v = _mm_srli_si128(v, 4);
+        }
+    }
+    ega_planar_line_scalar(&dp[x / 4], plane_size, &sp[x], width - (x * 2)); // the tail of the line
+}
+#endif
+
+#ifdef EGA_NEON
+/// @brief NEON unpack, the interleaving store does the work
+static void unpack_line_neon(uint8_t *dp, const uint8_t *sp, uint16_t width) {
+    size_t n = width / 2;
+    size_t x = 0;
+    const uint8x16_t mask = vdupq_n_u8(0x0f);
+    for(; (x + 16) <= n; x += 16) {
+        uint8x16_t b = vld1q_u8(&sp[x]);
+        uint8x16x2_t px = {{vshrq_n_u8(b, 4), vandq_u8(b, mask)}};
+        vst2q_u8(&dp[x * 2], px);
+    }
+    ega_unpack_line_scalar(&dp[x * 2], &sp[x], width - (x * 2)); // the tail of the line
+}
+
+/// @brief NEON pack, the de-interleaving load splits the left and right pixels
+static void pack_line_neon(uint8_t *dp, const uint8_t *sp, uint16_t width) {
+    size_t n = width / 2;
+    size_t x = 0;
+    const uint8x16_t mask = vdupq_n_u8(0x0f);
+    for(; (x + 16) <= n; x += 16) {
+        uint8x16x2_t px = vld2q_u8(&sp[x * 2]);
+        vst1q_u8(&dp[x], vorrq_u8(vshlq_n_u8(px.val[0], 4), vandq_u8(px.val[1], mask)));
+    }
+    ega_pack_line_scalar(&dp[x], &sp[x * 2], width - (x * 2)); // the tail of the line
+}
+#endif
+
+static find_run_fn find_run_impl = NULL;
+static line_fn unpack_impl = ega_unpack_line_scalar;
+static line_fn pack_impl = ega_pack_line_scalar;
+static planar_fn planar_impl = ega_planar_line_scalar;
+static ega_kernel_t kernel_impl = EGA_KERNEL_SCALAR;
+static once_t auto_once = ONCE_INIT;
+static bool kernels_ready = false; // set once the kernels above are picked
+
+#if defined(__GNUC__)
+// the flag is checked on every call, so it is only ordered with the kernel pointers, not locked
+#define load_acquire(P)     __atomic_load_n((P), __ATOMIC_ACQUIRE)
+#define store_release(P, V) __atomic_store_n((P), (V), __ATOMIC_RELEASE)
+#endif
+
+/// @brief picks the best kernels the cpu supports, unless some were selected already
+static void select_auto(void) {
+    if(NULL == find_run_impl) ega_select_kernel(EGA_KERNEL_AUTO);
+}
+
+#if defined(__GNUC__)
+/// @brief waits for the kernels to be picked, kept out of line so the check in front of it stays cheap
+static __attribute__((noinline, cold)) void wait_kernels(void) {
+    thread_once(&auto_once, select_auto);
+}
+
+/// @brief makes sure the kernels have been picked before one is used. threads that get here 
+///        together on their first call all wait for the one doing the picking
+static inline void pick_kernels(void) {
+    if(__builtin_expect(!load_acquire(&kernels_ready), 0)) wait_kernels();
+}
+#else
+/// @brief makes sure the kernels have been picked before one is used. threads that get here 
+///        together on their first call all wait for the one doing the picking
+static inline void pick_kernels(void) {
+    thread_once(&auto_once, select_auto);
+}
+#endif
+
+/// @brief selects which implementation of the kernels is used. it must not be called while 
+///        other threads are encoding or decoding, so a program that forces one should do it 
+///        before it starts them. otherwise the best one is picked on the first use, safely
+/// @param kernel the implementation to use, EGA_KERNEL_AUTO for the best the cpu supports
+/// @return 0 on success, -1 if the implementation isn't available on this cpu or build
+int ega_select_kernel(ega_kernel_t kernel) {
+    if(EGA_KERNEL_AUTO == kernel) {
+#if defined(EGA_HAVE_AVX2)
+        if(__builtin_cpu_supports("avx2")) return ega_select_kernel(EGA_KERNEL_AVX2);
+#endif
+#if defined(EGA_HAVE_SSE2)
+        return ega_select_kernel(EGA_KERNEL_SSE2);
+#elif defined(EGA_NEON)
+        return ega_select_kernel(EGA_KERNEL_NEON);
+#else
+        return ega_select_kernel(EGA_KERNEL_SCALAR);
+#endif
+    }
+
+    switch(kernel) {
+        case EGA_KERNEL_SCALAR:
+            find_run_impl = find_run_scalar;
+            unpack_impl = ega_unpack_line_scalar;
+            pack_impl = ega_pack_line_scalar;
+            planar_impl = ega_planar_line_scalar;
+            break;
+#ifdef EGA_HAVE_SSE2
+        case EGA_KERNEL_SSE2:
+            find_run_impl = find_run_sse2;
+            unpack_impl = unpack_line_sse2;
+            pack_impl = pack_line_sse2;
+            planar_impl = planar_line_sse2;
+            break;
+#endif
+#ifdef EGA_HAVE_AVX2
+        case EGA_KERNEL_AVX2:
+            if(!__builtin_cpu_supports("avx2")) return -1;
+            find_run_impl = find_run_avx2;
+            unpack_impl = unpack_line_sse2; // lines are short, the wider registers don't help here
+            pack_impl = pack_line_sse2;
+            planar_impl = planar_line_sse2;
+            break;
+#endif
+#ifdef EGA_NEON
+        case EGA_KERNEL_NEON:
+            find_run_impl = find_run_neon;
+            unpack_impl = unpack_line_neon;
+            pack_impl = pack_line_neon;
+            planar_impl = ega_planar_line_scalar; // already 16 pixels to a 64 bit word
+            break;
+#endif
+        default:
+            return -1; // not available in this build
+    }
+    kernel_impl = kernel;
+#if defined(__GNUC__)
+    store_release(&kernels_ready, true);
+#else
+    kernels_ready = true;
+#endif
+    return 0;
+}
+
+/// @brief name of the kernel implementation in use
+/// @return the name as a string
+const char *ega_kernel_name(void) {
+    pick_kernels();
+    switch(kernel_impl) {
+        case EGA_KERNEL_SSE2: return "sse2";
+        case EGA_KERNEL_AVX2: return "avx2";
+        case EGA_KERNEL_NEON: return "neon";
+        default:              return "scalar";
+    }
+}
+
+/// @brief find the next run in the buffer passed in, using the selected kernel. if none has 
+///        been selected the best one the cpu supports is picked on the first call
+/// @param buf pointer to the data
+/// @param len length of the data
+/// @param rpos index of the beginning of the run in the data
+/// @return  length of the run found
+int find_run(uint8_t *buf, size_t len, int *rpos) {
+    pick_kernels();
+    return find_run_impl(buf, len, rpos);
+}
+
+/// @brief unpacks a line of packed pixels to 1 byte per pixel, using the selected kernel
+/// @param dp pointer to the output pixels, width bytes
+/// @param sp pointer to the packed pixels, EGA_LINE_BYTES(width) bytes
+/// @param width width of the line in pixels
+void ega_unpack_line(uint8_t *dp, const uint8_t *sp, uint16_t width) {
+    pick_kernels();
+    unpack_impl(dp, sp, width);
+}
+
+/// @brief packs a line of 1 byte per pixel to 2 pixels per byte, leftmost pixel in the 
+///        high nibble, using the selected kernel
+/// @param dp pointer to the output packed pixels, EGA_LINE_BYTES(width) bytes
+/// @param sp pointer to the pixels, width bytes
+/// @param width width of the line in pixels
+void ega_pack_line(uint8_t *dp, const uint8_t *sp, uint16_t width) {
+    pick_kernels();
+    pack_impl(dp, sp, width);
+}
+
+/// @brief splits a line of packed pixels in to its 4 bit planes, 8 pixels per byte with the 
+///        leftmost in the high bit, using the selected kernel
+/// @param dp pointer to the line in plane 0, EGA_PLANE_BYTES(width) bytes
+/// @param plane_size bytes from each plane to the next
+/// @param sp pointer to the packed pixels, EGA_LINE_BYTES(width) bytes
+/// @param width width of the line in pixels
+void ega_planar_line(uint8_t *dp, size_t plane_size, const uint8_t *sp, uint16_t width) {
+    pick_kernels();
+    planar_impl(dp, plane_size, sp, width);
+}
@@ -0,0 +1,171 @@
+/*
+ * stats.c
+ * timings and compression figures for a conversion, printed as text or as JSON
+ *
+ * This code is offered without warranty under the MIT License. Use it as you will
+ * personally or commercially, just give credit if you do.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdarg.h>
+#include <string.h>
+#include "stats.h"
+#include "util.h"
+
+// room for the longest report, every length of both codes used included
+#define STATS_LINE_MAX (8192)
+
+// a report is put together here, then printed in one go so those of a batch don't interleave
+typedef struct {
+    char        buf[STATS_LINE_MAX];
+    size_t      len;
+} report_t;
+
+/// @brief adds formatted text to a report, anything past the end of the buffer is dropped
+static void add(report_t *r, const char *fmt, ...) {
+    if(r->len >= (sizeof(r->buf) - 1)) return;
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(&r->buf[r->len], sizeof(r->buf) - r->len, fmt, ap);
+    va_end(ap);
+    if(n > 0) r->len += n;
+    if(r->len >= sizeof(r->buf)) r->len = sizeof(r->buf) - 1;
+}
+
+/// @brief adds a string to a report as a quoted JSON string
+static void add_json_str(report_t *r, const char *s) {
+    add(r, "\"");
+    for(; *s; s++) {
+        unsigned char ch = *s;
+        if(('"' == ch) || ('\\' == ch)) {
+            add(r, "\\%c", ch);
+        } else if(ch < 0x20) {
+            add(r, "\\u%04x", ch);
+        } else {
+            add(r, "%c", ch);
+        }
+    }
+    add(r, "\"");
+}
+
+/// @brief starts the figures for a conversion, the clock starts now
+/// @param st the figures to set up
+/// @param name name of the input file
+void stats_start(conv_stats_t *st, const char *name) {
+    memset(st, 0, sizeof(conv_stats_t));
+    st->name = name;
+    st->start = st->mark = timer_now();
+}
+
+/// @brief ends a phase of the conversion, the time since the last phase ended is added to it
+/// @param st the figures
+/// @param phase the phase that just ended
+void stats_phase(conv_stats_t *st, stats_phase_t phase) {
+    double now = timer_now();
+    st->time[phase] += now - st->mark;
+    st->mark = now;
+}
+
+/// @brief counts the codes of the EGA side of the conversion and takes the size of the image
+///        from its header. this isn't part of any phase, so call it after the last one
+/// @param st the figures
+/// @param ega the whole EGA file, header included, len is its length
+/// @return 0 on success, otherwise an error code
+int stats_count_codes(conv_stats_t *st, const memstream_buf_t *ega) {
+    memstream_buf_t ms = {ega->len, 0, ega->data};
+    uint16_t width, height;
+    int rval = ega_read_header(&ms, &width, &height);
+    if(0 == rval) rval = ega_count_codes(&ms, width, height, &st->hist);
+    if(0 == rval) {
+        st->width = width;
+        st->height = height;
+        st->ega_bytes = ms.pos;
+        st->have_hist = true;
+    }
+    return rval;
+}
+
+/// @brief adds the counts of one kind of code to a text report, lengths grouped in powers of 2
+///        with the longest length the format allows on its own
+static void add_text_hist(report_t *r, const char *what, const uint32_t *counts, int min, int max) {
+    uint64_t total = 0;
+    for(int i = min; i <= max; i++) total += counts[i];
+    add(r, "  %-9s%llu, %u at the longest (%d):", what, (unsigned long long)total, counts[max], max);
+    int lo = min;
+    while(lo < max) {
+        int hi = lo;
+        while(((hi + 1) < max) && ((hi + 1) & hi)) hi++; // up to the next power of 2, less 1
+        uint64_t n = 0;
+        for(int i = lo; i <= hi; i++) n += counts[i];
+        if(lo == hi) {
+            add(r, " %d:%llu", lo, (unsigned long long)n);
+        } else {
+            add(r, " %d-%d:%llu", lo, hi, (unsigned long long)n);
+        }
+        lo = hi + 1;
+    }
+    add(r, " %d:%u\n", max, counts[max]);
+}
+
+/// @brief adds the counts of one kind of code to a JSON report, every length that was used
+static void add_json_hist(report_t *r, const char *what, const uint32_t *counts, int min, int max) {
+    uint64_t total = 0;
+    for(int i = min; i <= max; i++) total += counts[i];
+    add(r, ",\"%s\":{\"count\":%llu,\"at_longest\":%u,\"lengths\":{", what, (unsigned long long)total, counts[max]);
+    bool first = true;
+    for(int i = min; i <= max; i++) {
+        if(0 == counts[i]) continue;
+        add(r, "%s\"%d\":%u", first ? "" : ",", i, counts[i]);
+        first = false;
+    }
+    add(r, "}}");
+}
+
+/// @brief prints the figures for a conversion, as a few lines of text or a single line of JSON
+/// @param fp where to print them
+/// @param st the figures
+/// @param mode how to print them
+void stats_print(FILE *fp, const conv_stats_t *st, stats_mode_t mode) {
+    static const char *phase_names[PHASE_COUNT] = {"read", "load", "code", "write"};
+    if((NULL == fp) || (NULL == st) || (STATS_NONE == mode)) return;
+
+    report_t r;
+    r.len = 0;
+    double total = st->mark - st->start;
+    // the ratio is of the packed pixels to the EGA data that holds them
+    size_t packed = EGA_LINE_BYTES(st->width) * st->height;
+    double ratio = st->ega_bytes ? (double)packed / st->ega_bytes : 0.0;
+
+    if(STATS_JSON == mode) {
+        add(&r, "{\"file\":");
+        add_json_str(&r, st->name);
+        add(&r, ",\"width\":%u,\"height\":%u,\"in_bytes\":%zu,\"out_bytes\":%zu,\"ega_bytes\":%zu,\"ratio\":%.4f",
+            st->width, st->height, st->in_bytes, st->out_bytes, st->ega_bytes, ratio);
+        add(&r, ",\"seconds\":{");
+        for(int i = 0; i < PHASE_COUNT; i++) {
+            add(&r, "\"%s\":%.6f,", phase_names[i], st->time[i]);
+        }
+        add(&r, "\"total\":%.6f}", total);
+        if(st->have_hist) {
+            add_json_hist(&r, "runs", st->hist.runs, EGA_MIN_RUN, EGA_MAX_RUN);
+            add_json_hist(&r, "literals", st->hist.copies, 1, EGA_MAX_COPY);
+        }
+        add(&r, "}\n");
+    } else {
+        add(&r, "Stats for '%s', %u x %u\n", st->name, st->width, st->height);
+        add(&r, "  time    ");
+        for(int i = 0; i < PHASE_COUNT; i++) {
+            add(&r, " %s %.3f ms,", phase_names[i], st->time[i] * 1e3);
+        }
+        add(&r, " total %.3f ms\n", total * 1e3);
+        add(&r, "  bytes    in %zu, out %zu, EGA data %zu, ratio %.2f:1\n",
+            st->in_bytes, st->out_bytes, st->ega_bytes, ratio);
+        if(st->have_hist) {
+            add_text_hist(&r, "runs", st->hist.runs, EGA_MIN_RUN, EGA_MAX_RUN);
+            add_text_hist(&r, "literals", st->hist.copies, 1, EGA_MAX_COPY);
+        }
+    }
+    fputs(r.buf, fp);
+}
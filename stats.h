@@ -0,0 +1,53 @@
+/*
+ * stats.h
+ * timings and compression figures for a conversion, printed as text or as JSON
+ *
+ * This code is offered without warranty under the MIT License. Use it as you will
+ * personally or commercially, just give credit if you do.
+ */
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "eaega.h"
+
+#ifndef STATS_H
+#define STATS_H
+
+// how the figures are printed, if at all
+typedef enum {
+    STATS_NONE = 0,
+    STATS_TEXT,
+    STATS_JSON,
+} stats_mode_t;
+
+// the parts of a conversion that are timed
+typedef enum {
+    PHASE_READ = 0,          // reading or mapping the input file
+    PHASE_LOAD,              // unpacking the BMP to 1 byte per pixel
+    PHASE_CODE,              // encoding or decoding, packing or unpacking the lines as it goes
+    PHASE_WRITE,             // writing the output file, and the index if there is one
+    PHASE_COUNT
+} stats_phase_t;
+
+// the figures for one file
+typedef struct {
+    const char  *name;       // the input file
+    uint16_t    width;       // width of the image in pixels
+    uint16_t    height;      // height of the image in pixels or lines
+    size_t      in_bytes;    // size of the file read
+    size_t      out_bytes;   // size of the file written
+    size_t      ega_bytes;   // size of the EGA data, whichever side of the conversion it is
+    double      start;       // timer_now() when the conversion began
+    double      mark;        // timer_now() at the end of the last phase
+    double      time[PHASE_COUNT]; // seconds spent in each phase
+    bool        have_hist;   // hist was filled in
+    ega_code_hist_t hist;    // lengths of the codes of the EGA data
+} conv_stats_t;
+
+void stats_start(conv_stats_t *st, const char *name);
+void stats_phase(conv_stats_t *st, stats_phase_t phase);
+int stats_count_codes(conv_stats_t *st, const memstream_buf_t *ega);
+void stats_print(FILE *fp, const conv_stats_t *st, stats_mode_t mode);
+
+#endif
@@ -0,0 +1,1008 @@
+/*
+ * test.c
+ * checks that the faster and alternative paths through the codec give exactly what the plain
+ * ones do, on synthetic images of many sizes and kinds. each group of checks can be run on its own
+ *
+ * This code is offered without warranty under the MIT License. Use it as you will
+ * personally or commercially, just give credit if you do.
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include "eaega.h"
+#include "bmp.h"
+#include "util.h"
+#include "cache.h"
+#include "archive.h"
+
+static int failures = 0;
+
+// reports a failed check and carries on, so one run shows everything that is wrong
+#define CHECK(COND, ...) do { \
+    if(!(COND)) { \
+        failures++; \
+        fprintf(stderr, "FAIL %s:%d: ", __FILE__, __LINE__); \
+        fprintf(stderr, __VA_ARGS__); \
+        fprintf(stderr, "\n"); \
+    } \
+} while(0)
+
+// the kinds of image tested
+typedef enum {
+    IMG_SOLID = 0,   // a single colour, all runs
+    IMG_NOISE,       // random pixels, no runs at all
+    IMG_DITHER,      // 2 colour checkerboard, never 3 pixels in a row
+    IMG_ART,         // bands of colour broken up by the odd stray pixel, like game art
+    IMG_RUNS,        // runs of every length, from 1 to well past the longest code
+    IMG_KINDS
+} image_kind_t;
+
+static const char *kind_names[IMG_KINDS] = {"solid", "noise", "dither", "art", "runs"};
+
+static const struct {
+    uint16_t    width;
+    uint16_t    height;
+} sizes[] = {
+    {1, 1}, {2, 1}, {3, 2}, {13, 5}, {16, 4}, {31, 9}, {261, 7}, {320, 200}, {333, 64}, {640, 350}, {1024, 3},
+};
+#define NUM_SIZES (sizeof(sizes) / sizeof(sizes[0]))
+
+static const int thread_counts[] = {1, 2, 3, 4, 7, 64};
+#define NUM_THREADS (sizeof(thread_counts) / sizeof(thread_counts[0]))
+
+static uint32_t seed = 1;
+
+/// @brief the next pseudo random number, the same sequence every run
+static uint32_t next_rand(void) {
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    return seed;
+}
+
+/// @brief fills in a synthetic image of the given kind, 1 byte per pixel, top line first
+static void make_image(uint8_t *px, uint16_t width, uint16_t height, image_kind_t kind) {
+    uint8_t c = 0;
+    int left = 0; // pixels left in the current run
+    for(int y = 0; y < height; y++) {
+        for(int x = 0; x < width; x++) {
+            uint32_t r = next_rand();
+            switch(kind) {
+                case IMG_SOLID:  c = 1; break;
+                case IMG_NOISE:  c = r & 0x0f; break;
+                case IMG_DITHER: c = ((x ^ y) & 1) ? 9 : 1; break;
+                case IMG_ART:
+                    c = ((x / 37) + (y / 11)) & 0x0f;
+                    if(0 == ((r >> 8) & 0x1f)) c = (r >> 24) & 0x0f;
+                    break;
+                default:
+                    if(left-- <= 0) {
+                        c = r & 0x0f;
+                        left = ((r >> 8) & 3) ? ((r >> 12) % 8) : ((r >> 12) % 400);
+                    }
+                    break;
+            }
+            *px++ = c;
+        }
+    }
+}
+
+/// @brief allocates a buffer, exiting if it can't
+static uint8_t *alloc(size_t len) {
+    uint8_t *p = malloc(len ? len : 1);
+    if(NULL == p) {
+        fprintf(stderr, "Unable to allocate memory\n");
+        exit(2);
+    }
+    return p;
+}
+
+/// @brief a pixel of a packed line, the leftmost is in the high nibble
+static uint8_t get_px(const uint8_t *line, size_t x) {
+    return (x & 1) ? (line[x / 2] & 0x0f) : (line[x / 2] >> 4);
+}
+
+/// @brief sets a pixel of a packed line, the other pixel of the byte is left as it was
+static void put_px(uint8_t *line, size_t x, uint8_t v) {
+    line[x / 2] = (x & 1) ? ((line[x / 2] & 0xf0) | v) : ((line[x / 2] & 0x0f) | (v << 4));
+}
+
+static inline void put_le16(uint8_t *p, uint16_t v) { p[0] = v & 0xff; p[1] = v >> 8; }
+static inline void put_le32(uint8_t *p, uint32_t v) { p[0] = v & 0xff; p[1] = (v >> 8) & 0xff; p[2] = (v >> 16) & 0xff; p[3] = v >> 24; }
+
+/// @brief fills a buffer with random bytes of only a few values, so runs of every length turn up
+static void fill_runs(uint8_t *buf, size_t len, int values) {
+    size_t i = 0;
+    while(i < len) {
+        uint32_t r = next_rand();
+        uint8_t c = (uint8_t)((r & 0xff) % values);
+        size_t n = 1 + ((r >> 8) % (((r >> 16) & 1) ? 4 : 40));
+        for(; n && (i < len); n--) buf[i++] = c;
+    }
+}
+
+/// @brief encodes an image with the greedy single threaded encoder
+/// @param enc set to the encoded file, free it after
+/// @return 0 on success, otherwise an error code
+static int encode(memstream_buf_t *enc, uint8_t *px, uint16_t width, uint16_t height) {
+    memstream_buf_t src = {(size_t)width * height, 0, px};
+    *enc = (memstream_buf_t){ega_encode_bound(width, height), 0, alloc(ega_encode_bound(width, height))};
+    return ega_encode(enc, &src, width, height);
+}
+
+/// @brief decodes an encoded file to 1 byte per pixel, top line first, with the plain decoder
+/// @return 0 on success, otherwise an error code
+static int decode(uint8_t *px, const memstream_buf_t *enc, uint16_t width, uint16_t height) {
+    memstream_buf_t src = {enc->pos, EGA_HDR_SZ, enc->data};
+    memstream_buf_t dst = {ega_decode_size(width, height), 0, px};
+    return ega_decode(&dst, &src, width, height);
+}
+
+/// @brief decodes an encoded file to packed lines, bottom line first, with the plain decoder
+/// @param stride bytes from each line to the next, a buffer of ega_decode_packed_size() bytes
+/// @return 0 on success, otherwise an error code
+static int decode_packed(uint8_t *lines, const memstream_buf_t *enc, uint16_t width, uint16_t height, size_t stride) {
+    memstream_buf_t src = {enc->pos, EGA_HDR_SZ, enc->data};
+    memstream_buf_t dst = {ega_decode_packed_size(stride, height), 0, lines};
+    return ega_decode_packed(&dst, &src, width, height, stride);
+}
+
+/// @brief checks packed lines, bottom line first, hold the pixels of an image
+/// @return true if every pixel matches
+static bool same_pixels(const uint8_t *lines, size_t stride, const uint8_t *px, uint16_t width, uint16_t height) {
+    bool ok = true;
+    for(int y = 0; y < height; y++) {
+        const uint8_t *line = &lines[(size_t)(height - 1 - y) * stride];
+        for(size_t x = 0; x < width; x++) ok &= (get_px(line, x) == px[(size_t)y * width + x]);
+    }
+    return ok;
+}
+
+// the streaming decoder's lines, collected by collect_line()
+typedef struct {
+    uint8_t     *data;       // the lines, bottom line first
+    size_t      nbytes;      // bytes per line
+    size_t      lines;       // lines received so far
+    size_t      max;         // lines there is room for
+} collect_t;
+
+/// @brief ega_decode_stream() callback, appends each line to a collect_t
+static int collect_line(void *ctx, const uint8_t *line, size_t nbytes) {
+    collect_t *col = ctx;
+    if((nbytes != col->nbytes) || (col->lines >= col->max)) return 1;
+    memcpy(&col->data[col->lines++ * nbytes], line, nbytes);
+    return 0;
+}
+
+/// @brief the streaming decoder, a line at a time and through a callback, against decoding the
+///        whole file at once
+static void test_stream(void) {
+    for(size_t s = 0; s < NUM_SIZES; s++) {
+        uint16_t width = sizes[s].width;
+        uint16_t height = sizes[s].height;
+        size_t nbytes = EGA_LINE_BYTES(width);
+        size_t sz = ega_decode_packed_size(nbytes, height);
+        for(int kind = 0; kind < IMG_KINDS; kind++) {
+            uint8_t *px = alloc((size_t)width * height);
+            uint8_t *full = alloc(sz);
+            uint8_t *line = alloc(nbytes);
+            collect_t col = {alloc(sz), nbytes, 0, height};
+            make_image(px, width, height, kind);
+            memstream_buf_t ref;
+            int err = encode(&ref, px, width, height);
+            CHECK(0 == err, "encode %s %ux%u", kind_names[kind], width, height);
+            err = decode_packed(full, &ref, width, height, nbytes);
+            CHECK((0 == err) && same_pixels(full, nbytes, px, width, height), "ega_decode_packed %s %ux%u",
+                  kind_names[kind], width, height);
+
+            FILE *fp = tmpfile();
+            CHECK(NULL != fp, "Unable to open a temporary file");
+            if(fp) {
+                fwrite(ref.data, 1, ref.pos, fp);
+                rewind(fp);
+                ega_stream_t es;
+                err = ega_stream_open(&es, fp);
+                bool ok = (0 == err) && (width == es.width) && (height == es.height);
+                for(int y = 0; ok && (y < height); y++) {
+                    ok = (0 == ega_stream_read_line(&es, line)) && (0 == memcmp(line, &full[y * nbytes], nbytes));
+                }
+                CHECK(ok && (1 == ega_stream_read_line(&es, line)), "ega_stream_read_line %s %ux%u",
+                      kind_names[kind], width, height);
+
+                rewind(fp);
+                err = ega_stream_open(&es, fp);
+                if(0 == err) err = ega_decode_stream(&es, line, collect_line, &col);
+                CHECK((0 == err) && (col.lines == height) && (0 == memcmp(col.data, full, sz)),
+                      "ega_decode_stream %s %ux%u", kind_names[kind], width, height);
+                fclose(fp);
+            }
+
+            free(col.data);
+            free(ref.data);
+            free(line);
+            free(full);
+            free(px);
+        }
+    }
+}
+
+/// @brief the vectorized kernels, for every one this cpu and build have, against the scalar references
+static void test_kernels(void) {
+    static const ega_kernel_t kernels[] = {EGA_KERNEL_SCALAR, EGA_KERNEL_SSE2, EGA_KERNEL_AVX2, EGA_KERNEL_NEON};
+    for(size_t k = 0; k < sizeof(kernels) / sizeof(kernels[0]); k++) {
+        if(ega_select_kernel(kernels[k])) continue; // not on this cpu or build
+        const char *name = ega_kernel_name();
+        printf("kernels: %s\n", name);
+
+        // find_run(), every length up to a few times the widest register, and at every alignment
+        for(size_t len = 1; len <= 300; len++) {
+            for(int values = 1; values <= 4; values++) {
+                for(int t = 0; t < 4; t++) {
+                    size_t off = next_rand() % 32;
+                    uint8_t *buf = alloc(len + off);
+                    fill_runs(&buf[off], len, values);
+                    int pos_a = -1;
+                    int pos_b = -1;
+                    int run_a = find_run_scalar(&buf[off], len, &pos_a);
+                    int run_b = find_run(&buf[off], len, &pos_b);
+                    CHECK((run_a == run_b) && (pos_a == pos_b), "%s find_run len %zu: run %d @ %d, scalar %d @ %d",
+                          name, len, run_b, pos_b, run_a, pos_a);
+                    free(buf);
+                }
+            }
+        }
+
+        // the line kernels, against what each pixel should be worked out one at a time
+        for(uint16_t width = 1; width <= 700; width++) {
+            size_t nbytes = EGA_LINE_BYTES(width);
+            uint8_t *px = alloc(width);
+            uint8_t *packed = alloc(nbytes);
+            uint8_t *back = alloc(width);
+            for(size_t x = 0; x < width; x++) px[x] = next_rand() & 0x0f;
+
+            ega_pack_line(packed, px, width);
+            bool ok = true;
+            for(size_t x = 0; x < width; x++) ok &= (get_px(packed, x) == px[x]);
+            if(width & 1) ok &= (0 == (packed[nbytes - 1] & 0x0f));
+            CHECK(ok, "%s ega_pack_line width %u", name, width);
+
+            if(width & 1) packed[nbytes - 1] |= 0x0f; // not part of the line, so it must be ignored
+            ega_unpack_line(back, packed, width);
+            CHECK(0 == memcmp(back, px, width), "%s ega_unpack_line width %u", name, width);
+
+            size_t pbytes = EGA_PLANE_BYTES(width);
+            uint8_t *planes = alloc(4 * pbytes);
+            memset(planes, 0xa5, 4 * pbytes);
+            ega_planar_line(planes, pbytes, packed, width);
+            ok = true;
+            for(size_t x = 0; x < (pbytes * 8); x++) {
+                for(int p = 0; p < 4; p++) {
+                    int bit = (planes[p * pbytes + x / 8] >> (7 - (x & 7))) & 1;
+                    ok &= bit == ((x < width) ? ((px[x] >> p) & 1) : 0);
+                }
+            }
+            CHECK(ok, "%s ega_planar_line width %u", name, width);
+            free(planes);
+
+            free(back);
+            free(packed);
+            free(px);
+        }
+    }
+    ega_select_kernel(EGA_KERNEL_AUTO);
+}
+
+/// @brief the threaded encoder and decoder, for a range of thread counts, against the single
+///        threaded ones
+static void test_threads(void) {
+    for(size_t s = 0; s < NUM_SIZES; s++) {
+        uint16_t width = sizes[s].width;
+        uint16_t height = sizes[s].height;
+        size_t nbytes = EGA_LINE_BYTES(width);
+        for(int kind = 0; kind < IMG_KINDS; kind++) {
+            uint8_t *px = alloc((size_t)width * height);
+            make_image(px, width, height, kind);
+            memstream_buf_t ref;
+            CHECK(0 == encode(&ref, px, width, height), "encode %s %ux%u", kind_names[kind], width, height);
+
+            memstream_buf_t src = {(size_t)width * height, 0, px};
+            memstream_buf_t enc = {ega_encode_bound(width, height), 0, alloc(ega_encode_bound(width, height))};
+            for(size_t t = 0; t < NUM_THREADS; t++) {
+                enc.pos = 0;
+                int err = ega_encode_mt(&enc, &src, width, height, thread_counts[t]);
+                CHECK((0 == err) && (enc.pos == ref.pos) && (0 == memcmp(enc.data, ref.data, ref.pos)),
+                      "ega_encode_mt %s %ux%u on %d threads", kind_names[kind], width, height, thread_counts[t]);
+            }
+
+            // the stride exactly the line, and padded out, since a line may be decoded over the next
+            uint32_t *offsets = (uint32_t *)alloc(height * sizeof(uint32_t));
+            memstream_buf_t ms = {ref.pos, EGA_HDR_SZ, ref.data};
+            CHECK(0 == ega_index_lines(&ms, width, height, offsets), "ega_index_lines %s %ux%u", kind_names[kind], width, height);
+            for(size_t stride = nbytes; stride <= ((nbytes + 3) & ~(size_t)3); stride += 3) {
+                size_t sz = ega_decode_packed_size(stride, height);
+                uint8_t *one = alloc(sz);
+                uint8_t *many = alloc(sz);
+                CHECK(0 == decode_packed(one, &ref, width, height, stride), "ega_decode_packed %s %ux%u",
+                      kind_names[kind], width, height);
+                for(size_t t = 0; t < NUM_THREADS; t++) {
+                    memstream_buf_t in = {ref.pos, EGA_HDR_SZ, ref.data};
+                    memstream_buf_t out = {sz, 0, many};
+                    int err = ega_decode_packed_mt(&out, &in, width, height, stride, offsets, thread_counts[t]);
+                    CHECK((0 == err) && (in.pos == ref.pos) && (0 == memcmp(one, many, sz)),
+                          "ega_decode_packed_mt %s %ux%u stride %zu on %d threads", kind_names[kind], width, height,
+                          stride, thread_counts[t]);
+                }
+                free(many);
+                free(one);
+            }
+            free(offsets);
+
+            free(enc.data);
+            free(ref.data);
+            free(px);
+        }
+    }
+}
+
+/// @brief regions of every shape and place, against cutting them out of the whole image
+static void test_region(void) {
+    for(size_t s = 0; s < NUM_SIZES; s++) {
+        uint16_t width = sizes[s].width;
+        uint16_t height = sizes[s].height;
+        size_t nbytes = EGA_LINE_BYTES(width);
+        for(int kind = 0; kind < IMG_KINDS; kind++) {
+            uint8_t *px = alloc((size_t)width * height);
+            uint8_t *full = alloc(ega_decode_packed_size(nbytes, height));
+            uint32_t *offsets = (uint32_t *)alloc(height * sizeof(uint32_t));
+            make_image(px, width, height, kind);
+            memstream_buf_t ref;
+            CHECK(0 == encode(&ref, px, width, height), "encode %s %ux%u", kind_names[kind], width, height);
+            CHECK(0 == decode_packed(full, &ref, width, height, nbytes), "ega_decode_packed %s %ux%u",
+                  kind_names[kind], width, height);
+            memstream_buf_t ms = {ref.pos, EGA_HDR_SZ, ref.data};
+            CHECK(0 == ega_index_lines(&ms, width, height, offsets), "ega_index_lines %s %ux%u", kind_names[kind],
+                  width, height);
+
+            // the whole image, the bottom right pixel, then rectangles starting on both nibbles
+            for(int r = 0; r < 40; r++) {
+                ega_rect_t rect = {0, 0, width, height};
+                if(1 == r) {
+                    rect = (ega_rect_t){width - 1, height - 1, 1, 1};
+                } else if(r > 1) {
+                    rect.x = next_rand() % width;
+                    rect.y = next_rand() % height;
+                    rect.width = 1 + next_rand() % (width - rect.x);
+                    rect.height = 1 + next_rand() % (height - rect.y);
+                }
+                size_t obytes = EGA_LINE_BYTES(rect.width);
+                size_t stride = obytes + (r & 3);
+                size_t sz = ega_decode_packed_size(stride, rect.height);
+                uint8_t *out = alloc(sz);
+                uint8_t *want = alloc(sz);
+                memset(want, 0, sz);
+                int first = height - (rect.y + rect.height); // the bottom line of the rectangle
+                for(size_t y = 0; y < rect.height; y++) {
+                    for(size_t x = 0; x < rect.width; x++) {
+                        put_px(&want[y * stride], x, get_px(&full[(first + y) * nbytes], rect.x + x));
+                    }
+                }
+
+                memset(out, 0xa5, sz);
+                memstream_buf_t in = {ref.pos, EGA_HDR_SZ, ref.data};
+                memstream_buf_t dst = {sz, 0, out};
+                int err = ega_decode_region(&dst, &in, width, height, offsets, &rect, stride);
+                // the pad nibble of an odd width is zeroed like the rest of the padding
+                bool ok = (0 == err) && (dst.pos == sz) && (0 == memcmp(out, want, sz));
+                CHECK(ok, "ega_decode_region %s %ux%u at %u,%u size %ux%u stride %zu", kind_names[kind], width,
+                      height, rect.x, rect.y, rect.width, rect.height, stride);
+                free(want);
+                free(out);
+            }
+
+            free(ref.data);
+            free(offsets);
+            free(full);
+            free(px);
+        }
+    }
+}
+
+/// @brief decodes BI_RLE4 codes a plain way, every line must be coded in full and end with an
+///        end of line code, or an end of bitmap code on the top line
+/// @param px receives the image, 1 byte per pixel, top line first
+/// @param rle the codes, pos is their length
+/// @return 0 if the codes are valid and cover the whole image, otherwise an error code
+static int read_rle4(uint8_t *px, const memstream_buf_t *rle, uint16_t width, uint16_t height) {
+    const uint8_t *p = rle->data;
+    size_t len = rle->pos;
+    size_t pos = 0;
+    for(int y = height - 1; y >= 0; y--) { // bottom line first
+        uint8_t *line = &px[(size_t)y * width];
+        size_t x = 0;
+        while(true) {
+            if((len - pos) < 2) return -3;
+            uint8_t n = p[pos++];
+            uint8_t v = p[pos++];
+            if(n) {
+                if((x + n) > width) return -4;
+                for(size_t i = 0; i < n; i++) line[x++] = (i & 1) ? (v & 0x0f) : (v >> 4);
+            } else if(v < 2) {
+                if((x != width) || ((1 == v) && y)) return -4;
+                break;
+            } else if(2 == v) {
+                return -7;
+            } else {
+                size_t nb = (v + 1) / 2;
+                if(((x + v) > width) || ((len - pos) < (nb + (nb & 1)))) return -4;
+                for(size_t i = 0; i < v; i++) line[x++] = get_px(&p[pos], i);
+                pos += nb + (nb & 1);
+            }
+        }
+    }
+    if(((len - pos) == 2) && (0 == p[pos]) && (1 == p[pos + 1])) pos += 2; // an end of bitmap after the last line
+    return (pos == len) ? 0 : -4;
+}
+
+/// @brief appends a byte to a buffer being built
+static void put_byte(memstream_buf_t *b, uint8_t v) {
+    b->data[b->pos++] = v;
+}
+
+/// @brief writes an image as BI_RLE4 codes a plain way, with runs and absolute strings starting
+///        on any pixel, odd ones included, unlike the codes ega_transcode_rle4() writes
+/// @param dst receives the codes, must hold 4 bytes per pixel and 2 per line more
+static void make_rle4(memstream_buf_t *dst, const uint8_t *px, uint16_t width, uint16_t height) {
+    for(int y = height - 1; y >= 0; y--) { // bottom line first
+        const uint8_t *line = &px[(size_t)y * width];
+        size_t x = 0;
+        while(x < width) {
+            size_t run = 1;
+            while(((x + run) < width) && (run < 255) && (line[x + run] == line[x])) run++;
+            if((run >= 3) || ((width - x) < 3) || (next_rand() & 1)) {
+                // a run of one colour, or a pair of pixels, as an encoded code
+                size_t n = (run >= 2) ? run : 1 + ((x + 1) < width);
+                uint8_t c = (line[x] << 4) | ((n > 1) ? line[x + 1] : line[x]);
+                put_byte(dst, (uint8_t)n);
+                put_byte(dst, c);
+                x += n;
+            } else {
+                // an absolute string, as long as the pixels don't settle in to a run
+                size_t n = 3;
+                while(((x + n) < width) && (n < 255) && !(((x + n + 2) < width) && (line[x + n] == line[x + n + 1]) &&
+                      (line[x + n] == line[x + n + 2]))) n++;
+                put_byte(dst, 0);
+                put_byte(dst, (uint8_t)n);
+                size_t bytes = (n + 1) / 2;
+                for(size_t i = 0; i < bytes; i++) {
+                    uint8_t hi = line[x + i * 2];
+                    uint8_t lo = ((i * 2 + 1) < n) ? line[x + i * 2 + 1] : 0;
+                    put_byte(dst, (hi << 4) | lo);
+                }
+                if(bytes & 1) put_byte(dst, 0); // absolute strings are padded to 16 bits
+                x += n;
+            }
+        }
+        put_byte(dst, 0);
+        put_byte(dst, y ? 0 : 1); // end of line, or of the bitmap after the top line
+    }
+}
+
+/// @brief wraps pixel data in a BMP file, with a header written out field by field rather than
+///        by the code under test
+/// @param bmp receives the file, free it after
+/// @param bpp bits per pixel, the palette has 1 << bpp entries up to 8 bits
+/// @param compression BMP_BI_RGB or BMP_BI_RLE4
+/// @param top_down store the top line first, flagged with a negative height
+/// @param pal the palette as blue, green, red and 0 for each entry, NULL for none
+/// @param data the pixel data or codes, len bytes
+static void make_bmp(memstream_buf_t *bmp, uint16_t width, uint16_t height, int bpp, int compression, bool top_down,
+                     const uint8_t *pal, const uint8_t *data, size_t len) {
+    size_t pal_len = (bpp <= 8) ? ((size_t)4 << bpp) : 0;
+    size_t off = 54 + pal_len;
+    *bmp = (memstream_buf_t){off + len, 0, alloc(off + len)};
+    uint8_t *p = bmp->data;
+    memset(p, 0, off);
+    p[0] = 'B';
+    p[1] = 'M';
+    put_le32(&p[2], off + len);
+    put_le32(&p[10], off);
+    put_le32(&p[14], 40);
+    put_le32(&p[18], width);
+    put_le32(&p[22], top_down ? (uint32_t)-(int32_t)height : height);
+    put_le16(&p[26], 1);
+    put_le16(&p[28], bpp);
+    put_le32(&p[30], compression);
+    put_le32(&p[34], len);
+    put_le32(&p[46], pal_len / 4);
+    if(pal_len) memcpy(&p[54], pal, pal_len);
+    memcpy(&p[off], data, len);
+}
+
+/// @brief the BI_RLE4 paths against the full decode: ega2bmp --rle4 transcoding the EGA codes
+///        must give the image ega_decode() does
+///        and so must loading it back, and bmp2ega's direct RLE4 encode must give the same file
+///        as encoding the loaded image
+static void test_rle4(void) {
+    for(size_t s = 0; s < NUM_SIZES; s++) {
+        uint16_t width = sizes[s].width;
+        uint16_t height = sizes[s].height;
+        size_t npx = (size_t)width * height;
+        for(int kind = 0; kind < IMG_KINDS; kind++) {
+            uint8_t *px = alloc(npx);
+            uint8_t *dec = alloc(npx);
+            uint8_t *out = alloc(npx);
+            make_image(px, width, height, kind);
+            memstream_buf_t ref;
+            CHECK(0 == encode(&ref, px, width, height), "encode %s %ux%u", kind_names[kind], width, height);
+            CHECK((0 == decode(dec, &ref, width, height)) && (0 == memcmp(dec, px, npx)), "ega_decode %s %ux%u",
+                  kind_names[kind], width, height);
+
+            // EGA codes to BI_RLE4
+            memstream_buf_t rle = {ega_rle4_bound(width, height), 0, alloc(ega_rle4_bound(width, height))};
+            memstream_buf_t src = {ref.pos, EGA_HDR_SZ, ref.data};
+            int err = ega_transcode_rle4(&rle, &src, width, height);
+            CHECK((0 == err) && (src.pos == ref.pos), "ega_transcode_rle4 %s %ux%u", kind_names[kind], width, height);
+            CHECK((0 == read_rle4(out, &rle, width, height)) && (0 == memcmp(out, dec, npx)),
+                  "ega_transcode_rle4 %s %ux%u doesn't give the decoded image", kind_names[kind], width, height);
+
+            // loaded back as a BMP
+            memstream_buf_t bmp;
+            make_bmp(&bmp, width, height, 4, BMP_BI_RLE4, false, (const uint8_t *)ega_pal, rle.data, rle.pos);
+            memstream_buf_t img = {0, 0, NULL};
+            uint16_t w = 0;
+            uint16_t h = 0;
+            err = load_bmp_mem(&img, &bmp, &w, &h);
+            CHECK((0 == err) && (w == width) && (h == height) && (0 == memcmp(img.data, dec, npx)),
+                  "ega_transcode_rle4 %s %ux%u doesn't load back as the decoded image", kind_names[kind], width, height);
+            free(bmp.data);
+
+            // BI_RLE4 codes with odd aligned runs and strings, encoded directly and in full
+            memstream_buf_t codes = {npx * 4 + (size_t)height * 2, 0, alloc(npx * 4 + (size_t)height * 2)};
+            make_rle4(&codes, px, width, height);
+            CHECK((0 == read_rle4(out, &codes, width, height)) && (0 == memcmp(out, px, npx)),
+                  "make_rle4 %s %ux%u", kind_names[kind], width, height);
+            make_bmp(&bmp, width, height, 4, BMP_BI_RLE4, false, (const uint8_t *)ega_pal, codes.data, codes.pos);
+            memstream_buf_t found;
+            err = find_bmp_rle4(&bmp, &found, &w, &h);
+            CHECK((0 == err) && (w == width) && (h == height), "find_bmp_rle4 %s %ux%u", kind_names[kind], width, height);
+            memstream_buf_t direct = {ega_encode_bound(width, height), 0, alloc(ega_encode_bound(width, height))};
+            bmp_run_t *runs = (bmp_run_t *)alloc(EGA_LINE_BYTES(width) * sizeof(bmp_run_t));
+            err = ega_encode_rle4(&direct, &found, width, height, runs);
+            CHECK((0 == err) && (direct.pos == ref.pos) && (0 == memcmp(direct.data, ref.data, ref.pos)),
+                  "ega_encode_rle4 %s %ux%u differs from encoding the loaded image", kind_names[kind], width, height);
+            bmp.pos = 0;
+            err = load_bmp_mem(&img, &bmp, &w, &h);
+            CHECK((0 == err) && (0 == memcmp(img.data, px, npx)), "load_bmp_mem BI_RLE4 %s %ux%u", kind_names[kind],
+                  width, height);
+
+            free(runs);
+            free(direct.data);
+            free(bmp.data);
+            free(codes.data);
+            free(img.data);
+            free(rle.data);
+            free(ref.data);
+            free(out);
+            free(dec);
+            free(px);
+        }
+    }
+}
+
+/// @brief a palette colour with a little noise added, as an image drawn in another program might have
+/// @param bgr receives blue, green and red
+static void near_colour(uint8_t *bgr, const bmp_palette_entry_t *c) {
+    const uint8_t in[3] = {c->b, c->g, c->r};
+    for(int i = 0; i < 3; i++) {
+        int v = in[i] + (int)(next_rand() % 13) - 6;
+        bgr[i] = (v < 0) ? 0 : ((v > 255) ? 255 : v);
+    }
+}
+
+/// @brief 256 colour and 24 bit BMPs, bottom line first and top line first, must load as the
+///        nearest colours of the 16 colour palette
+static void test_bmp(void) {
+    for(size_t s = 0; s < NUM_SIZES; s++) {
+        uint16_t width = sizes[s].width;
+        uint16_t height = sizes[s].height;
+        size_t npx = (size_t)width * height;
+        for(int depth = 8; depth <= 24; depth += 16) {
+            for(int top_down = 0; top_down < 2; top_down++) {
+                uint8_t *px = alloc(npx);
+                make_image(px, width, height, IMG_NOISE);
+
+                // each of the 256 colours is near one of the 16, every 16th the same one
+                uint8_t pal[256 * 4] = {0};
+                for(int i = 0; i < 256; i++) near_colour(&pal[i * 4], &ega_pal[i & 0x0f]);
+
+                size_t stride = ((size_t)width * (depth / 8) + 3) & ~(size_t)3;
+                uint8_t *data = alloc(stride * height);
+                memset(data, 0, stride * height);
+                for(int y = 0; y < height; y++) {
+                    uint8_t *line = &data[(size_t)(top_down ? y : (height - 1 - y)) * stride];
+                    for(size_t x = 0; x < width; x++) {
+                        uint8_t c = px[(size_t)y * width + x];
+                        if(8 == depth) {
+                            line[x] = c + 16 * (next_rand() & 0x0f);
+                        } else {
+                            near_colour(&line[x * 3], &ega_pal[c]);
+                        }
+                    }
+                }
+                memstream_buf_t bmp;
+                make_bmp(&bmp, width, height, depth, BMP_BI_RGB, top_down, pal, data, stride * height);
+                memstream_buf_t img = {0, 0, NULL};
+                uint16_t w = 0;
+                uint16_t h = 0;
+                int err = load_bmp_mem(&img, &bmp, &w, &h);
+                CHECK((0 == err) && (w == width) && (h == height) && (0 == memcmp(img.data, px, npx)),
+                      "load_bmp_mem %d bit %s %ux%u", depth, top_down ? "top down" : "bottom up", width, height);
+
+                free(img.data);
+                free(bmp.data);
+                free(data);
+                free(px);
+            }
+        }
+    }
+}
+
+/// @brief the fewest bytes a line can be coded in, searched for the simple way, trying every
+///        code that can end at each byte
+static size_t smallest_line(const uint8_t *line, size_t nbytes, size_t *best) {
+    best[0] = 0;
+    for(size_t i = 1; i <= nbytes; i++) {
+        best[i] = SIZE_MAX;
+        for(size_t n = 1; (n <= EGA_MAX_COPY) && (n <= i); n++) {
+            if((best[i - n] + 1 + n) < best[i]) best[i] = best[i - n] + 1 + n;
+        }
+        size_t same = 1; // bytes ending at i that are all the same
+        while((same < i) && (line[i - 1 - same] == line[i - 1])) same++;
+        for(size_t n = EGA_MIN_RUN; (n <= EGA_MAX_RUN) && (n <= same); n++) {
+            if((best[i - n] + 2) < best[i]) best[i] = best[i - n] + 2;
+        }
+    }
+    return best[nbytes];
+}
+
+/// @brief the optimal encoder must give back the image, be no larger than the greedy encoder,
+///        and code every line in as few bytes as a full search finds
+static void test_optimal(void) {
+    for(size_t s = 0; s < NUM_SIZES; s++) {
+        uint16_t width = sizes[s].width;
+        uint16_t height = sizes[s].height;
+        size_t npx = (size_t)width * height;
+        size_t nbytes = EGA_LINE_BYTES(width);
+        for(int kind = 0; kind < IMG_KINDS; kind++) {
+            uint8_t *px = alloc(npx);
+            uint8_t *dec = alloc(npx);
+            make_image(px, width, height, kind);
+            memstream_buf_t ref;
+            CHECK(0 == encode(&ref, px, width, height), "encode %s %ux%u", kind_names[kind], width, height);
+
+            memstream_buf_t src = {npx, 0, px};
+            memstream_buf_t opt = {ega_encode_bound(width, height), 0, alloc(ega_encode_bound(width, height))};
+            void *scratch = alloc(ega_optimal_scratch_size(width));
+            CHECK(0 == ega_encode_optimal(&opt, &src, width, height, scratch), "ega_encode_optimal %s %ux%u",
+                  kind_names[kind], width, height);
+            CHECK(opt.pos <= ref.pos, "ega_encode_optimal %s %ux%u is %zu bytes, greedy is %zu", kind_names[kind],
+                  width, height, opt.pos, ref.pos);
+            CHECK((0 == decode(dec, &opt, width, height)) && (0 == memcmp(dec, px, npx)),
+                  "ega_encode_optimal %s %ux%u doesn't decode back to the image", kind_names[kind], width, height);
+
+            size_t *best = (size_t *)alloc((nbytes + 1) * sizeof(size_t));
+            uint8_t *line = alloc(nbytes);
+            size_t smallest = EGA_HDR_SZ;
+            for(int y = 0; y < height; y++) {
+                ega_pack_line_scalar(line, &px[(size_t)y * width], width);
+                smallest += smallest_line(line, nbytes, best);
+            }
+            CHECK(opt.pos == smallest, "ega_encode_optimal %s %ux%u is %zu bytes, the smallest is %zu",
+                  kind_names[kind], width, height, opt.pos, smallest);
+
+            free(line);
+            free(best);
+            free(scratch);
+            free(opt.data);
+            free(ref.data);
+            free(dec);
+            free(px);
+        }
+    }
+}
+
+#define CACHE_NAME "eaega_test.cache"
+#define CACHE_OUT_NAME "eaega_test.ega"
+
+/// @brief gives every line in a cache the codes of the next one, as if each had hashed the same
+///        as a different line
+static void swap_lines(ega_cache_t *c) {
+    cache_line_t *prev = NULL;
+    cache_line_t first = {0};
+    for(size_t i = 0; i < c->line_cap; i++) {
+        cache_line_t *rec = &c->lines[i];
+        if(0 == rec->key) continue;
+        if(prev) {
+            prev->off = rec->off;
+            prev->len = rec->len;
+        } else {
+            first = *rec;
+        }
+        prev = rec;
+    }
+    if(prev) {
+        prev->off = first.off;
+        prev->len = first.len;
+    }
+}
+
+/// @brief encodes an image through a cache
+/// @param enc receives the encoded file, ega_encode_bound() bytes
+/// @return the number of lines taken from the cache, or -1 if the encode failed
+static long cache_encode_image(ega_cache_t *c, memstream_buf_t *enc, uint8_t *px, uint16_t width, uint16_t height) {
+    memstream_buf_t src = {(size_t)width * height, 0, px};
+    size_t hits = 0;
+    enc->pos = 0;
+    return cache_encode(c, enc, &src, width, height, &hits) ? -1 : (long)hits;
+}
+
+/// @brief a run only keeps what it used: an image that was changed loses its old lines, and
+///        the lines of a file skipped as unchanged are kept along with it
+static void test_cache_evict(void) {
+    uint16_t width = 64;
+    uint16_t height = 32;
+    size_t npx = (size_t)width * height;
+    uint8_t *a = alloc(npx);
+    uint8_t *a2 = alloc(npx);
+    uint8_t *b = alloc(npx);
+    make_image(a, width, height, IMG_NOISE); // every line different, so none are shared
+    make_image(a2, width, height, IMG_NOISE);
+    make_image(b, width, height, IMG_NOISE);
+    memstream_buf_t enc_a2, enc_b;
+    encode(&enc_a2, a2, width, height);
+    encode(&enc_b, b, width, height);
+    memstream_buf_t enc = {ega_encode_bound(width, height), 0, alloc(ega_encode_bound(width, height))};
+    memstream_buf_t in_b = {npx, 0, b};             // stands in for the BMP file
+    uint64_t key_b = cache_file_key(&in_b, CACHE_OUT_NAME);
+    remove(CACHE_NAME);
+
+    // the first run encodes both, and writes out b
+    ega_cache_t c;
+    cache_load(&c, CACHE_NAME);
+    long hits_a = cache_encode_image(&c, &enc, a, width, height);
+    long hits_b = cache_encode_image(&c, &enc, b, width, height);
+    CHECK((0 == hits_a) && (0 == hits_b), "cache_encode of a new image hit the cache");
+    CHECK(0 == write_file(CACHE_OUT_NAME, enc.data, enc.pos), "Unable to write " CACHE_OUT_NAME);
+    cache_add_file(&c, key_b, &enc);
+    CHECK(0 == cache_save(&c, CACHE_NAME), "cache_save");
+    cache_free(&c);
+
+    // the next run has a edited, and skips b as it hasn't changed
+    CHECK(0 == cache_load(&c, CACHE_NAME), "cache_load");
+    CHECK((c.line_count == 2u * height) && (1 == c.file_count), "cache_load gave %zu lines and %zu files",
+          c.line_count, c.file_count);
+    CHECK(0 == cache_encode_image(&c, &enc, a2, width, height), "cache_encode of an edited image hit the cache");
+    CHECK(cache_file_unchanged(&c, key_b, CACHE_OUT_NAME), "cache_file_unchanged");
+    CHECK(0 == cache_save(&c, CACHE_NAME), "cache_save");
+    cache_free(&c);
+
+    // so the old lines of a are gone and their codes with them
+    CHECK(0 == cache_load(&c, CACHE_NAME), "cache_load");
+    size_t codes = (enc_a2.pos - EGA_HDR_SZ) + (enc_b.pos - EGA_HDR_SZ);
+    CHECK((c.line_count == 2u * height) && (c.codes_len == codes) && (1 == c.file_count),
+          "cache_save kept %zu lines, %zu bytes of codes and %zu files, not %u, %zu and 1", c.line_count, c.codes_len,
+          c.file_count, 2u * height, codes);
+    CHECK(0 == cache_encode_image(&c, &enc, a, width, height), "cache_encode found the lines of an old image");
+    CHECK(height == cache_encode_image(&c, &enc, b, width, height), "cache_encode lost the lines of a skipped image");
+    CHECK(height == cache_encode_image(&c, &enc, a2, width, height), "cache_encode lost the lines of an edited image");
+    cache_free(&c);
+
+    remove(CACHE_NAME);
+    remove(CACHE_OUT_NAME);
+    free(enc.data);
+    free(enc_b.data);
+    free(enc_a2.data);
+    free(b);
+    free(a2);
+    free(a);
+}
+
+/// @brief a read only cache, as bmp2ega --verify uses, is looked in but never added to or saved
+static void test_cache_read_only(void) {
+    uint16_t width = 64;
+    uint16_t height = 32;
+    size_t npx = (size_t)width * height;
+    uint8_t *a = alloc(npx);
+    uint8_t *b = alloc(npx);
+    make_image(a, width, height, IMG_ART);
+    make_image(b, width, height, IMG_NOISE);
+    memstream_buf_t ref;
+    encode(&ref, b, width, height);
+    memstream_buf_t enc = {ega_encode_bound(width, height), 0, alloc(ega_encode_bound(width, height))};
+    remove(CACHE_NAME);
+
+    ega_cache_t c;
+    cache_load(&c, CACHE_NAME);
+    cache_encode_image(&c, &enc, a, width, height);
+    c.read_only = true;
+    size_t lines = c.line_count;
+    size_t codes = c.codes_len;
+    CHECK(height == cache_encode_image(&c, &enc, a, width, height), "cache_encode missed in a read only cache");
+    CHECK((0 == cache_encode_image(&c, &enc, b, width, height)) && (enc.pos == ref.pos) &&
+          (0 == memcmp(enc.data, ref.data, ref.pos)), "cache_encode with a read only cache");
+    CHECK(0 == cache_add_file(&c, 1, &enc), "cache_add_file");
+    CHECK((lines == c.line_count) && (codes == c.codes_len) && (0 == c.file_count), "a read only cache was added to");
+    CHECK(0 == cache_save(&c, CACHE_NAME), "cache_save");
+    FILE *fp = fopen(CACHE_NAME, "rb");
+    CHECK(NULL == fp, "cache_save wrote out a read only cache");
+    if(fp) fclose(fp);
+    cache_free(&c);
+
+    remove(CACHE_NAME);
+    free(enc.data);
+    free(ref.data);
+    free(b);
+    free(a);
+}
+
+/// @brief the scanline cache, empty, full and with every line hashing to the codes of a
+///        different one, against encoding without it
+static void test_cache(void) {
+    remove(CACHE_NAME);
+    for(size_t s = 0; s < NUM_SIZES; s++) {
+        uint16_t width = sizes[s].width;
+        uint16_t height = sizes[s].height;
+        for(int kind = 0; kind < IMG_KINDS; kind++) {
+            uint8_t *px = alloc((size_t)width * height);
+            make_image(px, width, height, kind);
+            memstream_buf_t ref;
+            CHECK(0 == encode(&ref, px, width, height), "encode %s %ux%u", kind_names[kind], width, height);
+
+            // a cache file that isn't there starts the cache empty
+            ega_cache_t c;
+            CHECK(0 == cache_load(&c, CACHE_NAME), "cache_load");
+            memstream_buf_t enc = {ega_encode_bound(width, height), 0, alloc(ega_encode_bound(width, height))};
+            size_t distinct = 0;
+            for(int pass = 0; pass < 3; pass++) {
+                if(2 == pass) swap_lines(&c);
+                long hits = cache_encode_image(&c, &enc, px, width, height);
+                CHECK((hits >= 0) && (enc.pos == ref.pos) && (0 == memcmp(enc.data, ref.data, ref.pos)),
+                      "cache_encode %s %ux%u pass %d", kind_names[kind], width, height, pass);
+                if(0 == pass) {
+                    // only the first of each different line is encoded
+                    distinct = c.line_count;
+                    CHECK((size_t)hits + distinct == height, "cache_encode %s %ux%u took %ld lines, %zu are different",
+                          kind_names[kind], width, height, hits, distinct);
+                } else if(1 == pass) {
+                    CHECK(hits == height, "cache_encode %s %ux%u took %ld lines of %u", kind_names[kind], width,
+                          height, hits, height);
+                } else if(distinct > 1) {
+                    // every line's codes are now another's, and must be turned down
+                    CHECK((size_t)hits + distinct <= height, "cache_encode %s %ux%u took %ld mismatched lines",
+                          kind_names[kind], width, height, hits);
+                }
+            }
+
+            cache_free(&c);
+            free(enc.data);
+            free(ref.data);
+            free(px);
+        }
+    }
+    test_cache_evict();
+    test_cache_read_only();
+}
+
+#define EGR_NAME "eaega_test.egr"
+
+/// @brief an archive of a few images, read back, then damaged in each of the ways egr_open()
+///        has to catch before any entry is used
+static void test_egr(void) {
+    static const char *names[] = {"art.ega", "noise.ega", "runs.ega", "solid.ega"};
+    static const image_kind_t kinds[] = {IMG_ART, IMG_NOISE, IMG_RUNS, IMG_SOLID};
+    const int count = sizeof(names) / sizeof(names[0]);
+    memstream_buf_t encs[4];
+    egr_builder_t b;
+    egr_builder_init(&b);
+    for(int i = count - 1; i >= 0; i--) { // added out of order, saved sorted by name
+        uint16_t width = (uint16_t)(13 + 40 * i);
+        uint16_t height = (uint16_t)(5 + 3 * i);
+        uint8_t *px = alloc((size_t)width * height);
+        make_image(px, width, height, kinds[i]);
+        CHECK(0 == encode(&encs[i], px, width, height), "encode %s", names[i]);
+        CHECK(0 == egr_add(&b, names[i], encs[i].data, encs[i].pos, i & 1), "egr_add %s", names[i]);
+        free(px);
+    }
+    CHECK(0 == egr_save(&b, EGR_NAME), "egr_save");
+    egr_builder_free(&b);
+
+    mapped_file_t mf = {{0, 0, NULL}, false};
+    if(map_file(&mf, EGR_NAME)) {
+        CHECK(false, "Unable to read " EGR_NAME);
+    } else {
+        egr_t arc;
+        CHECK((0 == egr_open(&arc, &mf.buf)) && (arc.count == (uint32_t)count), "egr_open");
+        for(int i = 0; i < count; i++) {
+            egr_entry_t e;
+            int err = egr_find(&arc, names[i], &e);
+            CHECK((0 == err) && (e.data.len == encs[i].pos) && (0 == memcmp(e.data.data, encs[i].data, encs[i].pos)) &&
+                  ((i & 1) == (NULL != e.index)), "egr_find %s", names[i]);
+        }
+
+        // damaged copies, each must be turned away
+        size_t len = mf.buf.len;
+        uint8_t *bad = alloc(len);
+        const uint8_t *p = mf.buf.data;
+        uint32_t names_len = p[8] | (p[9] << 8) | (p[10] << 16) | ((uint32_t)p[11] << 24);
+        size_t names_off = EGR_HDR_SZ + (size_t)count * EGR_ENTRY_SZ;
+        static const char *damage[] = {
+            "signature", "truncated", "directory past the end", "name past the name table",
+            "name table not terminated", "image past the end", "image too short", "index past the end",
+            "names out of order", "name repeated",
+        };
+        for(size_t d = 0; d < sizeof(damage) / sizeof(damage[0]); d++) {
+            memcpy(bad, p, len);
+            memstream_buf_t buf = {len, 0, bad};
+            uint8_t *e0 = &bad[EGR_HDR_SZ];
+            uint8_t *e1 = &bad[EGR_HDR_SZ + EGR_ENTRY_SZ];
+            switch(d) {
+                case 0: bad[0] = 'X'; break;
+                case 1: buf.len = len - 1; break;
+                case 2: put_le32(&bad[4], 0x10000000); break;
+                case 3: put_le32(&e1[0], names_len); break;
+                case 4: bad[names_off + names_len - 1] = 'x'; break;
+                case 5: put_le32(&e1[12], len); break;
+                case 6: put_le32(&e0[12], EGA_HDR_SZ - 1); break;
+                case 7: put_le32(&e1[16], len - 4); break; // e1 is indexed, with more than one line
+                case 8: memcpy(e0, &bad[EGR_HDR_SZ + 2 * EGR_ENTRY_SZ], 4); break;
+                default: memcpy(e1, e0, 4); break;
+            }
+            egr_t arc;
+            CHECK(egr_open(&arc, &buf) < 0, "egr_open took an archive with a damaged %s", damage[d]);
+        }
+        free(bad);
+        unmap_file(&mf);
+    }
+    remove(EGR_NAME);
+    for(int i = 0; i < count; i++) free(encs[i].data);
+}
+
+static const struct {
+    const char  *name;
+    void        (*fn)(void);
+} tests[] = {
+    {"stream", test_stream},
+    {"kernels", test_kernels},
+    {"threads", test_threads},
+    {"region", test_region},
+    {"rle4", test_rle4},
+    {"bmp", test_bmp},
+    {"optimal", test_optimal},
+    {"cache", test_cache},
+    {"egr", test_egr},
+};
+#define NUM_TESTS (sizeof(tests) / sizeof(tests[0]))
+
+int main(int argc, char *argv[]) {
+    // with no names given every test is run
+    int ran = 0;
+    for(size_t t = 0; t < NUM_TESTS; t++) {
+        bool wanted = (argc < 2);
+        for(int i = 1; i < argc; i++) wanted |= (0 == strcmp(argv[i], tests[t].name));
+        if(!wanted) continue;
+        int before = failures;
+        tests[t].fn();
+        printf("%s: %s\n", tests[t].name, (failures == before) ? "ok" : "FAILED");
+        ran++;
+    }
+    if(0 == ran) {
+        printf("USAGE: %s [", argv[0]);
+        for(size_t t = 0; t < NUM_TESTS; t++) printf("%s%s", t ? "|" : "", tests[t].name);
+        printf("]...\n");
+        return 2;
+    }
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,153 @@
+/*
+ * thread.c 
+ * minimal portable threads, pthreads on POSIX and win32 threads on Windows
+ * 
+ * This code is offered without warranty under the MIT License. Use it as you will 
+ * personally or commercially, just give credit if you do.
+ */
+
+#include "thread.h"
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+/// @brief starts a new thread
+/// @param t pointer to the thread handle set on return
+/// @param fn function to run, declared with THREAD_FUNC
+/// @param arg passed through to the function
+/// @return 0 on success, otherwise an error code
+int thread_create(thread_t *t, thread_fn fn, void *arg) {
+#ifdef _WIN32
+    *t = CreateThread(NULL, 0, fn, arg, 0, NULL);
+    return (NULL == *t) ? -1 : 0;
+#else
+    return pthread_create(t, NULL, fn, arg) ? -1 : 0;
+#endif
+}
+
+/// @brief waits for a thread to finish
+/// @param t handle of the thread
+void thread_join(thread_t t) {
+#ifdef _WIN32
+    WaitForSingleObject(t, INFINITE);
+    CloseHandle(t);
+#else
+    pthread_join(t, NULL);
+#endif
+}
+
+/// @brief number of cpus available to run threads on
+/// @return the count, at least 1
+int cpu_count(void) {
+#ifdef _WIN32
+    SYSTEM_INFO si;
+    GetSystemInfo(&si);
+    return (si.dwNumberOfProcessors > 0) ? (int)si.dwNumberOfProcessors : 1;
+#else
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return (n > 0) ? (int)n : 1;
+#endif
+}
+
+/// @brief sets up a mutex before its first use
+/// @param m pointer to the mutex
+void mutex_init(mutex_t *m) {
+#ifdef _WIN32
+    InitializeCriticalSection(m);
+#else
+    pthread_mutex_init(m, NULL);
+#endif
+}
+
+/// @brief waits for and takes ownership of a mutex
+/// @param m pointer to the mutex
+void mutex_lock(mutex_t *m) {
+#ifdef _WIN32
+    EnterCriticalSection(m);
+#else
+    pthread_mutex_lock(m);
+#endif
+}
+
+/// @brief releases a mutex taken with mutex_lock()
+/// @param m pointer to the mutex
+void mutex_unlock(mutex_t *m) {
+#ifdef _WIN32
+    LeaveCriticalSection(m);
+#else
+    pthread_mutex_unlock(m);
+#endif
+}
+
+/// @brief releases the resources of a mutex once it is no longer needed
+/// @param m pointer to the mutex
+void mutex_destroy(mutex_t *m) {
+#ifdef _WIN32
+    DeleteCriticalSection(m);
+#else
+    pthread_mutex_destroy(m);
+#endif
+}
+
+/// @brief sets up a condition variable before its first use
+/// @param c pointer to the condition variable
+void cond_init(cond_t *c) {
+#ifdef _WIN32
+    InitializeConditionVariable(c);
+#else
+    pthread_cond_init(c, NULL);
+#endif
+}
+
+/// @brief releases a mutex and waits for the condition to be signalled, the mutex 
+///        is held again on return. wakeups can be spurious, so check the condition in a loop
+/// @param c pointer to the condition variable
+/// @param m pointer to the mutex guarding the condition, held by the caller
+void cond_wait(cond_t *c, mutex_t *m) {
+#ifdef _WIN32
+    SleepConditionVariableCS(c, m, INFINITE);
+#else
+    pthread_cond_wait(c, m);
+#endif
+}
+
+/// @brief wakes every thread waiting on a condition variable
+/// @param c pointer to the condition variable
+void cond_broadcast(cond_t *c) {
+#ifdef _WIN32
+    WakeAllConditionVariable(c);
+#else
+    pthread_cond_broadcast(c);
+#endif
+}
+
+/// @brief releases the resources of a condition variable once it is no longer needed
+/// @param c pointer to the condition variable
+void cond_destroy(cond_t *c) {
+#ifdef _WIN32
+    (void)c; // nothing to release on windows
+#else
+    pthread_cond_destroy(c);
+#endif
+}
+
+#ifdef _WIN32
+// windows passes the function through as the once's parameter
+static BOOL CALLBACK once_thunk(PINIT_ONCE o, PVOID fn, PVOID *ctx) {
+    (void)o; (void)ctx;
+    ((void (*)(void))fn)();
+    return TRUE;
+}
+#endif
+
+/// @brief runs a function exactly once however many threads get here together, the others 
+///        wait for it to finish, and everything it wrote is visible to them on return
+/// @param o pointer to the once guard, set to ONCE_INIT before its first use
+/// @param fn function to run
+void thread_once(once_t *o, void (*fn)(void)) {
+#ifdef _WIN32
+    InitOnceExecuteOnce(o, once_thunk, (PVOID)fn, NULL);
+#else
+    pthread_once(o, fn);
+#endif
+}
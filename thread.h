@@ -0,0 +1,49 @@
+/*
+ * thread.h 
+ * minimal portable threads, pthreads on POSIX and win32 threads on Windows
+ * 
+ * This code is offered without warranty under the MIT License. Use it as you will 
+ * personally or commercially, just give credit if you do.
+ */
+
+#ifndef THREAD_H
+#define THREAD_H
+
+#ifdef _WIN32
+#include <windows.h>
+typedef HANDLE thread_t;
+typedef CRITICAL_SECTION mutex_t;
+typedef CONDITION_VARIABLE cond_t;
+typedef INIT_ONCE once_t;
+#define ONCE_INIT INIT_ONCE_STATIC_INIT
+// declares a function that can be run as a thread
+#define THREAD_FUNC(NAME, ARG) DWORD WINAPI NAME(LPVOID ARG)
+#define THREAD_RETURN return 0
+#else
+#include <pthread.h>
+typedef pthread_t thread_t;
+typedef pthread_mutex_t mutex_t;
+typedef pthread_cond_t cond_t;
+typedef pthread_once_t once_t;
+#define ONCE_INIT PTHREAD_ONCE_INIT
+// declares a function that can be run as a thread
+#define THREAD_FUNC(NAME, ARG) void *NAME(void *ARG)
+#define THREAD_RETURN return NULL
+#endif
+
+typedef THREAD_FUNC((*thread_fn), arg);
+
+int thread_create(thread_t *t, thread_fn fn, void *arg);
+void thread_join(thread_t t);
+int cpu_count(void);
+void mutex_init(mutex_t *m);
+void mutex_lock(mutex_t *m);
+void mutex_unlock(mutex_t *m);
+void mutex_destroy(mutex_t *m);
+void cond_init(cond_t *c);
+void cond_wait(cond_t *c, mutex_t *m);
+void cond_broadcast(cond_t *c);
+void cond_destroy(cond_t *c);
+void thread_once(once_t *o, void (*fn)(void));
+
+#endif
@@ -0,0 +1,516 @@
+/*
+ * util.c 
+ * small file and string helpers shared by the command line tools
+ * 
+ * This code is offered without warranty under the MIT License. Use it as you will 
+ * personally or commercially, just give credit if you do.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include "util.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#include <io.h>
+#include <fcntl.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <errno.h>
+#include <time.h>
+#endif
+
+/// @brief reads a stream to its end in to an allocated buffer, growing it as it goes, for 
+///        pipes and other input that can't be mapped or seeked, so its size isn't known up front
+/// @param mf pointer to the mapped file struct to fill in
+/// @param fp the stream to read
+/// @return 0 on success, otherwise an error code
+static int read_stream(mapped_file_t *mf, FILE *fp) {
+    size_t cap = 0;
+    size_t len = 0;
+    uint8_t *data = NULL;
+    while(true) {
+        if(len == cap) {
+            size_t ncap = cap ? cap * 2 : 65536;
+            uint8_t *p = realloc(data, ncap);
+            if(NULL == p) {
+                free_s(data);
+                return -5; // unable to allocate mem
+            }
+            data = p;
+            cap = ncap;
+        }
+        size_t nr = fread(&data[len], 1, cap - len, fp);
+        len += nr;
+        if(nr == 0) break;
+    }
+    if(ferror(fp)) {
+        free_s(data);
+        return -3; // unable to read file
+    }
+    mf->buf.data = data;
+    mf->buf.len = len;
+    return 0;
+}
+
+/// @brief reads the whole of a file into an allocated buffer, used when it can't be mapped
+/// @param mf pointer to the mapped file struct to fill in
+/// @param fn name of the file to read
+/// @return 0 on success, otherwise an error code
+static int read_file(mapped_file_t *mf, const char *fn) {
+    int rval = 0;
+    FILE *fp = NULL;
+
+    if(NULL == (fp = fopen(fn, "rb"))) {
+        rval = -2; // can't open file
+        goto read_cleanup;
+    }
+    // a file that can't be seeked is read in a single pass instead
+    if(0 != fseek(fp, 0, SEEK_END)) {
+        rval = read_stream(mf, fp);
+        goto read_cleanup;
+    }
+    rewind(fp);
+    size_t fsz = filesize(fp);
+    if(fsz) {
+        if(NULL == (mf->buf.data = malloc(fsz))) {
+            rval = -5; // unable to allocate mem
+            goto read_cleanup;
+        }
+        if(1 != fread(mf->buf.data, fsz, 1, fp)) {
+            free_s(mf->buf.data);
+            rval = -3; // unable to read file
+            goto read_cleanup;
+        }
+    }
+    mf->buf.len = fsz;
+
+read_cleanup:
+    fclose_s(fp);
+    return rval;
+}
+
+/// @brief checks if a file name stands for the standard input or output
+/// @param fn the file name
+/// @return true if it is "-"
+bool is_stdio(const char *fn) {
+    return (NULL != fn) && (0 == strcmp(fn, STDIO_NAME));
+}
+
+/// @brief switches the standard input or output to binary, so windows doesn't translate line ends
+/// @param fp stdin or stdout
+static void stdio_binary(FILE *fp) {
+#ifdef _WIN32
+    _setmode(_fileno(fp), _O_BINARY);
+#else
+    (void)fp;
+#endif
+}
+
+/// @brief opens a file as fopen(), but "-" gives the standard input or output, depending on the mode
+/// @param fn name of the file, or "-"
+/// @param mode as fopen(), binary modes are implied for the standard streams
+/// @return the open file, close it with close_stdio(), or NULL if it couldn't be opened
+FILE *open_stdio(const char *fn, const char *mode) {
+    if((NULL == fn) || (NULL == mode)) {
+        return NULL;
+    }
+    if(is_stdio(fn)) {
+        FILE *fp = ('r' == mode[0]) ? stdin : stdout;
+        stdio_binary(fp);
+        return fp;
+    }
+    return fopen(fn, mode);
+}
+
+/// @brief closes a file opened with open_stdio(), the standard streams are just flushed
+/// @param fp the open file
+/// @return 0 on success, otherwise an error code
+int close_stdio(FILE *fp) {
+    if(NULL == fp) return 0;
+    if((stdin == fp) || (stdout == fp)) {
+        return fflush(fp) ? -4 : 0; // unable to write file
+    }
+    return fclose(fp) ? -4 : 0; // unable to write file
+}
+
+/// @brief makes the contents of a file available in memory. the file is memory mapped so it is read
+///        straight from the page cache with no copy, if that fails the file is read in instead
+/// @param mf pointer to the mapped file struct to fill in, release it with unmap_file()
+/// @param fn name of the file to map
+/// @return 0 on success, otherwise an error code
+int map_file(mapped_file_t *mf, const char *fn) {
+    if((NULL == mf) || (NULL == fn)) {
+        return -1; // NULL pointer error
+    }
+    memset(mf, 0, sizeof(mapped_file_t));
+
+    // the standard input is read in a single pass, it may well be a pipe
+    if(is_stdio(fn)) {
+        stdio_binary(stdin);
+        return read_stream(mf, stdin);
+    }
+
+#ifdef _WIN32
+    HANDLE hfile = CreateFileA(fn, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, 
+                               FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if(INVALID_HANDLE_VALUE == hfile) {
+        return -2; // can't open file
+    }
+    LARGE_INTEGER fsz;
+    if(GetFileSizeEx(hfile, &fsz) && (fsz.QuadPart > 0)) {
+        HANDLE hmap = CreateFileMappingA(hfile, NULL, PAGE_READONLY, 0, 0, NULL);
+        if(NULL != hmap) {
+            void *view = MapViewOfFile(hmap, FILE_MAP_READ, 0, 0, 0);
+            if(NULL != view) {
+                mf->buf.data = view;
+                mf->buf.len = (size_t)fsz.QuadPart;
+                mf->hmap = hmap;
+                mf->mapped = true;
+            } else {
+                CloseHandle(hmap);
+            }
+        }
+    }
+    CloseHandle(hfile); // the mapping holds its own reference to the file
+#else
+    int fd = open(fn, O_RDONLY);
+    if(fd < 0) {
+        return -2; // can't open file
+    }
+    struct stat st;
+    bool st_ok = (0 == fstat(fd, &st));
+    if(st_ok && S_ISREG(st.st_mode) && (st.st_size > 0)) {
+        void *view = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(MAP_FAILED != view) {
+            madvise(view, st.st_size, MADV_SEQUENTIAL); // we read front to back
+            mf->buf.data = view;
+            mf->buf.len = st.st_size;
+            mf->mapped = true;
+        }
+    } else if(st_ok && !S_ISREG(st.st_mode)) {
+        // a pipe or fifo is read through the handle already open, opening it again would wait for another writer
+        FILE *fp = fdopen(fd, "rb");
+        if(NULL == fp) {
+            close(fd);
+            return -2; // can't open file
+        }
+        int rval = read_stream(mf, fp);
+        fclose(fp);
+        return rval;
+    }
+    close(fd); // the mapping holds its own reference to the file
+#endif
+
+    if(mf->mapped) return 0;
+    return read_file(mf, fn);
+}
+
+/// @brief releases a file made available by map_file()
+/// @param mf pointer to the mapped file struct
+void unmap_file(mapped_file_t *mf) {
+    if(NULL == mf) return;
+    if(mf->mapped) {
+#ifdef _WIN32
+        UnmapViewOfFile(mf->buf.data);
+        CloseHandle(mf->hmap);
+#else
+        munmap(mf->buf.data, mf->buf.len);
+#endif
+    } else {
+        free_s(mf->buf.data);
+    }
+    memset(mf, 0, sizeof(mapped_file_t));
+}
+
+/// @brief determins the size of the file
+/// @param f handle to an open file
+/// @return returns the size of the file
+size_t filesize(FILE *f) {
+    size_t szll, cp;
+    cp = ftell(f);           // save current position
+    fseek(f, 0, SEEK_END);   // find the end
+    szll = ftell(f);         // get positon of the end
+    fseek(f, cp, SEEK_SET);  // restore the file position
+    return szll;             // return position of the end as size
+}
+
+/// @brief reads a monotonic clock, for timing
+/// @return time in seconds from an arbitrary starting point
+double timer_now(void) {
+#ifdef _WIN32
+    LARGE_INTEGER freq, count;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&count);
+    return (double)count.QuadPart / (double)freq.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+#endif
+}
+
+/// @brief removes the extension from a filename
+/// @param fn sting pointer to the filename
+void drop_extension(char *fn) {
+    char *extension = strrchr(fn, '.');
+    // a '.' ahead of the last path separator belongs to a directory name
+    char *sep = strrchr(fn, '/');
+    char *bsep = strrchr(fn, '\\');
+    if((NULL == sep) || ((NULL != bsep) && (bsep > sep))) sep = bsep;
+    if((NULL != extension) && ((NULL == sep) || (extension > sep))) {
+        *extension = 0; // strip out the existing extension
+    }
+}
+
+/// @brief empties an arena and makes sure it has room for at least the given number of bytes. 
+///        the block is only replaced when it is too small, so a batch of files settles on one 
+///        allocation. the memory is not zeroed, and the contents are not kept when it grows
+/// @param a pointer to the arena, zero it before the first use
+/// @param len number of bytes needed, the ARENA_SIZE() of each piece added together
+/// @return 0 on success, otherwise an error code
+int arena_reserve(arena_t *a, size_t len) {
+    if(NULL == a) {
+        return -1; // NULL pointer error
+    }
+    a->used = 0;
+    if((NULL != a->base) && (a->size >= len)) {
+        return 0;
+    }
+    free_s(a->base);
+    a->size = 0;
+    if(NULL == (a->base = malloc(len ? len : 1))) {
+        return -5; // unable to allocate mem
+    }
+    a->size = len;
+    return 0;
+}
+
+/// @brief carves a piece out of an arena, the memory is not zeroed
+/// @param a pointer to the arena
+/// @param len size of the piece in bytes
+/// @return pointer to the piece, or NULL if there isn't room left for it
+void *arena_alloc(arena_t *a, size_t len) {
+    if((NULL == a) || (NULL == a->base) || ((a->size - a->used) < ARENA_SIZE(len))) {
+        return NULL;
+    }
+    void *p = &a->base[a->used];
+    a->used += ARENA_SIZE(len);
+    return p;
+}
+
+/// @brief carves a memstream buffer out of an arena, as arena_alloc()
+/// @param a pointer to the arena
+/// @param buf memstream buffer to point at the piece, len is set to its size and pos to 0
+/// @param len size of the piece in bytes
+/// @return 0 on success, otherwise an error code
+int arena_buf(arena_t *a, memstream_buf_t *buf, size_t len) {
+    if(NULL == buf) {
+        return -1; // NULL pointer error
+    }
+    if(NULL == (buf->data = arena_alloc(a, len))) {
+        return -5; // unable to allocate mem
+    }
+    buf->len = len;
+    buf->pos = 0;
+    return 0;
+}
+
+/// @brief releases an arena's block
+/// @param a pointer to the arena
+void arena_free(arena_t *a) {
+    if(NULL == a) return;
+    free_s(a->base);
+    a->size = 0;
+    a->used = 0;
+}
+
+/// @brief makes a copy of a filename with its extension replaced
+/// @param fn the filename
+/// @param ext the new extension, including the '.'
+/// @return the new filename, to be freed by the caller, or NULL if out of memory
+char *change_extension(const char *fn, const char *ext) {
+    size_t namelen = strlen(fn);
+    size_t extlen = strlen(ext);
+    char *name = malloc(namelen + extlen + 1);
+    if(NULL == name) return NULL;
+    memcpy(name, fn, namelen + 1);
+    drop_extension(name); // remove exisiting extension
+    strcat(name, ext);
+    return name;
+}
+
+/// @brief creates a file holding the given pieces of data, one after another. on POSIX systems 
+///        they are handed to the kernel in a single writev() call, so each file costs one write 
+///        no matter how many pieces it is built from
+/// @param fn name of the file to create
+/// @param chunks list of the pieces to write, in order
+/// @param count number of entries in chunks, at most WRITE_MAX_CHUNKS
+/// @return 0 on success, otherwise an error code
+int write_chunks(const char *fn, const io_chunk_t *chunks, int count) {
+    if((NULL == fn) || ((count > 0) && (NULL == chunks)) || (count > WRITE_MAX_CHUNKS)) {
+        return -1; // NULL pointer error
+    }
+    bool out = is_stdio(fn); // "-" writes to the standard output, which is left open
+#ifdef _WIN32
+    int rval = 0;
+    FILE *fp = NULL;
+    if(out) {
+        fp = stdout;
+        stdio_binary(stdout);
+    } else if(NULL == (fp = fopen(fn, "wb"))) {
+        return -2; // can't open/create file
+    } else {
+        setvbuf(fp, NULL, _IONBF, 0); // each piece goes straight out, no copy through the stdio buffer
+    }
+    for(int i = 0; (i < count) && (0 == rval); i++) {
+        if(chunks[i].len && (1 != fwrite(chunks[i].data, chunks[i].len, 1, fp))) {
+            rval = -4; // unable to write file
+        }
+    }
+    if(out ? fflush(fp) : fclose(fp)) {
+        rval = -4; // unable to write file
+    }
+    return rval;
+#else
+    int fd = out ? STDOUT_FILENO : open(fn, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if(fd < 0) {
+        return -2; // can't open/create file
+    }
+    if(out) fflush(stdout); // anything already buffered for stdout goes ahead of the file
+    struct iovec iov[WRITE_MAX_CHUNKS];
+    for(int i = 0; i < count; i++) {
+        iov[i].iov_base = (void *)chunks[i].data;
+        iov[i].iov_len = chunks[i].len;
+    }
+
+    // a single call normally writes everything, but a short write just picks up where it left off
+    int rval = 0;
+    int first = 0;
+    while(first < count) {
+        ssize_t nw = writev(fd, &iov[first], count - first);
+        if(nw < 0) {
+            if(EINTR == errno) continue;
+            rval = -4; // unable to write file
+            break;
+        }
+        size_t done = (size_t)nw;
+        while((first < count) && (done >= iov[first].iov_len)) {
+            done -= iov[first++].iov_len;
+        }
+        if(first < count) {
+            iov[first].iov_base = (uint8_t *)iov[first].iov_base + done;
+            iov[first].iov_len -= done;
+        }
+    }
+    if(!out && close(fd)) {
+        rval = -4; // unable to write file
+    }
+    return rval;
+#endif
+}
+
+/// @brief creates a file holding the given data
+/// @param fn name of the file to create
+/// @param data pointer to the data to write
+/// @param len length of the data in bytes
+/// @return 0 on success, otherwise an error code
+int write_file(const char *fn, const void *data, size_t len) {
+    io_chunk_t chunk = {data, len};
+    return write_chunks(fn, &chunk, 1);
+}
+
+#define XXH_P1 0x9E3779B185EBCA87ULL
+#define XXH_P2 0xC2B2AE3D27D4EB4FULL
+#define XXH_P3 0x165667B19E3779F9ULL
+#define XXH_P4 0x85EBCA77C2B2AE63ULL
+#define XXH_P5 0x27D4EB2F165667C5ULL
+
+static inline uint64_t rotl64(uint64_t v, int r) { return (v << r) | (v >> (64 - r)); }
+static inline uint64_t xxh_read64(const uint8_t *p) { 
+    uint64_t v = 0;
+    for(int i = 7; i >= 0; i--) v = (v << 8) | p[i];
+    return v;
+}
+static inline uint64_t xxh_read32(const uint8_t *p) { 
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint64_t)p[3] << 24);
+}
+static inline uint64_t xxh_round(uint64_t acc, uint64_t v) { 
+    return rotl64(acc + v * XXH_P2, 31) * XXH_P1;
+}
+static inline uint64_t xxh_merge(uint64_t acc, uint64_t v) {
+    return (acc ^ xxh_round(0, v)) * XXH_P1 + XXH_P4;
+}
+
+/// @brief 64 bit hash of a block of memory, this is XXH64, so it gives the same values as
+///        the xxHash library does on any platform
+/// @param data pointer to the data to hash
+/// @param len length of the data in bytes
+/// @param seed starting value, different seeds give unrelated hashes of the same data
+/// @return the hash
+uint64_t hash64(const void *data, size_t len, uint64_t seed) {
+    const uint8_t *p = data;
+    const uint8_t *end = p + len;
+    uint64_t h;
+
+    if(len >= 32) {
+        // 4 lanes of 8 bytes at a time
+        uint64_t v1 = seed + XXH_P1 + XXH_P2;
+        uint64_t v2 = seed + XXH_P2;
+        uint64_t v3 = seed;
+        uint64_t v4 = seed - XXH_P1;
+        for(; (end - p) >= 32; p += 32) {
+            v1 = xxh_round(v1, xxh_read64(&p[0]));
+            v2 = xxh_round(v2, xxh_read64(&p[8]));
+            v3 = xxh_round(v3, xxh_read64(&p[16]));
+            v4 = xxh_round(v4, xxh_read64(&p[24]));
+        }
+        h = rotl64(v1, 1) + rotl64(v2, 7) + rotl64(v3, 12) + rotl64(v4, 18);
+        h = xxh_merge(h, v1);
+        h = xxh_merge(h, v2);
+        h = xxh_merge(h, v3);
+        h = xxh_merge(h, v4);
+    } else {
+        h = seed + XXH_P5;
+    }
+    h += len;
+
+    // then the tail, 8, 4 and 1 bytes at a time
+    for(; (end - p) >= 8; p += 8) {
+        h = rotl64(h ^ xxh_round(0, xxh_read64(p)), 27) * XXH_P1 + XXH_P4;
+    }
+    if((end - p) >= 4) {
+        h = rotl64(h ^ (xxh_read32(p) * XXH_P1), 23) * XXH_P2 + XXH_P3;
+        p += 4;
+    }
+    for(; p < end; p++) {
+        h = rotl64(h ^ (*p * XXH_P5), 11) * XXH_P1;
+    }
+
+    // mix the last bits in to all of the hash
+    h ^= h >> 33;
+    h *= XXH_P2;
+    h ^= h >> 29;
+    h *= XXH_P3;
+    h ^= h >> 32;
+    return h;
+}
+
+/// @brief Returns the filename portion of a path
+/// @param path filepath string
+/// @return a pointer to the filename portion of the path string
+char *filename(char *path) {
+	int i;
+
+	if(path == NULL || path[0] == '\0')
+		return "";
+	for(i = strlen(path) - 1; i >= 0 && path[i] != '/'; i--);
+	if(i == -1)
+		return "";
+	return &path[i+1];
+}
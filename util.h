@@ -0,0 +1,73 @@
+/*
+ * util.h 
+ * small file and string helpers shared by the command line tools
+ * 
+ * This code is offered without warranty under the MIT License. Use it as you will 
+ * personally or commercially, just give credit if you do.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "memstream.h"
+
+#ifndef UTIL_H
+#define UTIL_H
+
+#define fclose_s(A) if(A) fclose(A); A=NULL
+#define free_s(A) if(A) free(A); A=NULL
+
+// a file's contents viewed through memory, mapped where the platform allows it, 
+// otherwise read into an allocated buffer
+typedef struct {
+    memstream_buf_t buf;     // the contents of the file
+    bool        mapped;      // true if buf is a mapping of the file, false if it was read in
+#ifdef _WIN32
+    void        *hmap;       // handle to the file mapping object
+#endif
+} mapped_file_t;
+
+// the file name that stands for the standard input or output
+#define STDIO_NAME "-"
+
+// most pieces a file can be written from in one write_chunks() call
+#define WRITE_MAX_CHUNKS (16)
+
+// one piece of a file to be written
+typedef struct {
+    const void  *data;       // start of the piece
+    size_t      len;         // length of the piece in bytes
+} io_chunk_t;
+
+// a single block that all of a conversion's buffers are carved out of. it is sized for 
+// each file from its header, only grows, and is reset rather than freed between files
+typedef struct {
+    uint8_t     *base;       // start of the block
+    size_t      size;        // size of the block in bytes
+    size_t      used;        // bytes handed out since the last reset
+} arena_t;
+
+// pieces are aligned to suit the SIMD kernels
+#define ARENA_ALIGN (16)
+// space a piece of len bytes takes up in an arena, use it to add up the size to reserve
+#define ARENA_SIZE(len) (((size_t)(len) + (ARENA_ALIGN - 1)) & ~(size_t)(ARENA_ALIGN - 1))
+
+bool is_stdio(const char *fn);
+FILE *open_stdio(const char *fn, const char *mode);
+int close_stdio(FILE *fp);
+int map_file(mapped_file_t *mf, const char *fn);
+void unmap_file(mapped_file_t *mf);
+size_t filesize(FILE *f);
+double timer_now(void);
+void drop_extension(char *fn);
+char *change_extension(const char *fn, const char *ext);
+int arena_reserve(arena_t *a, size_t len);
+void *arena_alloc(arena_t *a, size_t len);
+int arena_buf(arena_t *a, memstream_buf_t *buf, size_t len);
+void arena_free(arena_t *a);
+int write_file(const char *fn, const void *data, size_t len);
+int write_chunks(const char *fn, const io_chunk_t *chunks, int count);
+uint64_t hash64(const void *data, size_t len, uint64_t seed);
+char *filename(char *path);
+
+#endif